@@ -17,6 +17,10 @@
 #ifndef DMM_H
 #define DMM_H
 
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <mach/irqs.h>
+
 #define DMM_BASE 0x4E000000
 #define DMM_SIZE 0x800
 
@@ -54,8 +58,21 @@
 #define DMM_PEG_PRIO          0x620
 #define DMM_PEG_PRIO_PAT      0x640
 
+#define DMM_PAT_IRQ           (113 + OMAP44XX_IRQ_GIC_START)
+
+/* PAT engine 0 interrupt status bits */
+#define DMM_PAT_IRQ_DST       (1 << 0)	/* descriptor done */
+#define DMM_PAT_IRQ_LST       (1 << 1)	/* last descriptor of a chain done */
+#define DMM_PAT_IRQ_ERR       0x7C	/* invalid descriptor/data/update */
+#define DMM_PAT_IRQ_LUT_MISS  (1 << 7)
+
+/* Maximum time a refill may take */
+#define DMM_PAT_TIMEOUT_MS    500
+
 /**
- * PAT refill programming mode.
+ * PAT refill programming mode.  MANUAL programs one descriptor at a time
+ * through the registers, AUTO lets the DMM fetch a chain of descriptors
+ * from memory.
  */
 enum pat_mode {
 	MANUAL,
@@ -84,7 +101,8 @@ struct pat_ctrl {
 };
 
 /**
- * PAT descriptor.
+ * PAT descriptor.  Same layout as the DMM_PAT_DESCR..DMM_PAT_DATA registers,
+ * so that the DMM can fetch a chain of these from memory.
  */
 struct pat {
 	struct pat *next;
@@ -98,6 +116,15 @@ struct pat {
  */
 struct dmm {
 	void __iomem *base;
+	int irq;			/* < 0 if refills are polled */
+
+	struct mutex mtx;		/* one refill at a time */
+	struct completion done;		/* chain done or failed */
+	u32 status;			/* interrupt status of the refill */
+
+	struct pat *descs;		/* chain handed to the DMM */
+	dma_addr_t descs_pa;
+	u32 max_descs;
 };
 
 /**
@@ -110,7 +137,7 @@ struct dmm *dmm_pat_init(u32 id);
 /**
  * Program the physical address translator.
  * @param dmm   Device data
- * @param desc  PAT descriptor
+ * @param desc  PAT descriptor, or chain of descriptors linked by next
  * @param mode  programming mode
  * @return an error status.
  */
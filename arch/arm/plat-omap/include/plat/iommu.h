@@ -14,6 +14,7 @@
 #define __MACH_IOMMU_H
 
 #include <linux/list.h>
+#include <linux/rbtree.h>
 
 struct iotlb_entry {
 	u32 da;
@@ -44,7 +45,8 @@ struct iommu {
 	int		nr_tlb_entries;
 
 	struct list_head	mmap;
-	struct mutex		mmap_lock; /* protect mmap */
+	struct rb_root		mmap_rb; /* same iovmas, indexed by da */
+	struct mutex		mmap_lock; /* protect mmap and mmap_rb */
 
 	struct raw_notifier_head	notifier;
 
@@ -13,12 +13,17 @@
 #ifndef __IOMMU_MMAP_H
 #define __IOMMU_MMAP_H
 
+#include <linux/rbtree.h>
+
 struct iovm_struct {
 	struct iommu		*iommu;	/* iommu object which this belongs to */
 	u32			da_start; /* area definition */
 	u32			da_end;
 	u32			flags; /* IOVMF_: see below */
 	struct list_head	list; /* linked in ascending order */
+	struct rb_node		node; /* indexed by da_start */
+	u32			gap; /* free bytes in front of this area */
+	u32			max_gap; /* largest 'gap' in this subtree */
 	const struct sg_table	*sgt; /* keep 'page' <-> 'da' mapping */
 	void			*va; /* mpu side mapped address */
 };
@@ -9,6 +9,7 @@
 #include <linux/interrupt.h>
 #include <linux/kfifo.h>
 #include <linux/notifier.h>
+#include <linux/ktime.h>
 
 typedef u32 mbox_msg_t;
 struct omap_mbox;
@@ -22,6 +23,7 @@ typedef int __bitwise omap_mbox_type_t;
 #define OMAP_MBOX_TYPE2 ((__force omap_mbox_type_t) 2)
 
 #define MBOX_KFIFO_SIZE        (256)
+#define MBOX_RX_BATCH          (MBOX_KFIFO_SIZE / sizeof(mbox_msg_t))
 
 struct omap_mbox_ops {
 	omap_mbox_type_t	type;
@@ -52,6 +54,20 @@ struct omap_mbox_queue {
 	int	(*callback)(void *);
 	struct omap_mbox	*mbox;
 	bool full;
+	ktime_t			stamp;	/* when the fifo became non-empty */
+};
+
+struct omap_mbox_stats {
+	unsigned long		tx_msgs;	/* written to the mailbox */
+	unsigned long		tx_direct;	/* ...without the tasklet */
+	unsigned long		tx_kicks;	/* tasklet runs */
+	unsigned long		tx_full;	/* mailbox found full */
+	u64			tx_latency;	/* ns queued, summed per kick */
+	u64			tx_latency_max;
+	unsigned long		rx_msgs;
+	unsigned long		rx_batches;	/* notifier deliveries */
+	u64			rx_latency;	/* ns from irq, per batch */
+	u64			rx_latency_max;
 };
 
 struct omap_mbox {
@@ -75,9 +91,25 @@ struct omap_mbox {
 	int			nr_mbox_users;
 	int			nr_mbox;
 	struct blocking_notifier_head	notifier;
+	struct blocking_notifier_head	batch_notifier;
+
+	struct omap_mbox_stats	stats;
+	struct dentry		*dbg;
 };
 
 int omap_mbox_msg_send(struct omap_mbox *, mbox_msg_t msg);
+int omap_mbox_msg_send_batch(struct omap_mbox *, const mbox_msg_t *msgs,
+			     int count);
+
+/*
+ * Batch notifiers are called once for all messages received together, with
+ * the number of messages as the event and an array of mbox_msg_t as data.
+ * Notifiers passed to omap_mbox_get() get one call per message.
+ */
+int omap_mbox_register_batch_notifier(struct omap_mbox *,
+				      struct notifier_block *nb);
+int omap_mbox_unregister_batch_notifier(struct omap_mbox *,
+					struct notifier_block *nb);
 void omap_mbox_init_seq(struct omap_mbox *);
 
 struct omap_mbox *omap_mbox_get(const char *, struct notifier_block *nb);
@@ -993,6 +993,7 @@ static int __devinit omap_iommu_probe(struct platform_device *pdev)
 	mutex_init(&obj->mmap_lock);
 	spin_lock_init(&obj->page_table_lock);
 	INIT_LIST_HEAD(&obj->mmap);
+	obj->mmap_rb = RB_ROOT;
 
 	spin_lock_init(&obj->event_lock);
 	INIT_LIST_HEAD(&obj->event_list);
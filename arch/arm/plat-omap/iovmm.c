@@ -215,12 +215,118 @@ static inline void vunmap_sg(const void *va)
 	vunmap(va);
 }
 
+/*
+ * iovmas are kept both on the ascending obj->mmap list and in
+ * obj->mmap_rb, sorted by da_start. Each node also caches the free
+ * bytes between the previous area and itself ('gap') and the largest
+ * such hole in its subtree ('max_gap'), so that both lookups and hole
+ * searches are O(log n) in the number of iovmas.
+ */
+#define iovm_entry(n)	rb_entry(n, struct iovm_struct, node)
+
+/* last valid device address */
+#define IOVM_DA_LIMIT	((u64)(u32)~0)
+
+/*
+ * Usable hole in front of @area: a new area needs one byte of space on
+ * both sides and never starts in the first page, which is reserved for
+ * NULL.
+ */
+static u32 iovm_gap(struct iovm_struct *area)
+{
+	struct rb_node *prev = rb_prev(&area->node);
+	u64 lo, hi;
+
+	lo = prev ? (u64)iovm_entry(prev)->da_end + 1 : PAGE_SIZE;
+	hi = (u64)area->da_start - 1;
+
+	return (area->da_start && hi > lo) ? hi - lo : 0;
+}
+
+/* rb_augment_f: recompute the largest hole in the subtree under @n */
+static void iovm_update_max_gap(struct rb_node *n, void *data)
+{
+	struct iovm_struct *area = iovm_entry(n);
+	u32 max_gap = area->gap;
+
+	if (n->rb_left)
+		max_gap = max(max_gap, iovm_entry(n->rb_left)->max_gap);
+	if (n->rb_right)
+		max_gap = max(max_gap, iovm_entry(n->rb_right)->max_gap);
+
+	area->max_gap = max_gap;
+}
+
+/*
+ * The hole in front of @n has changed: refresh it and 'max_gap' from
+ * @n up to the root, which is what rb_augment_erase_end() does.
+ */
+static void iovm_update_gap(struct rb_node *n)
+{
+	struct iovm_struct *area = iovm_entry(n);
+
+	area->gap = iovm_gap(area);
+	rb_augment_erase_end(n, iovm_update_max_gap, NULL);
+}
+
+static void iovm_insert_area(struct iommu *obj, struct iovm_struct *new)
+{
+	struct rb_node **p = &obj->mmap_rb.rb_node;
+	struct rb_node *parent = NULL, *n;
+
+	while (*p) {
+		parent = *p;
+		if (new->da_start < iovm_entry(parent)->da_start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &obj->mmap_rb);
+
+	new->gap = iovm_gap(new);
+	rb_augment_insert(&new->node, iovm_update_max_gap, NULL);
+
+	/*
+	 * keep ascending order of iovmas; the hole in front of the next
+	 * area has just shrunk
+	 */
+	n = rb_next(&new->node);
+	if (n) {
+		list_add_tail(&new->list, &iovm_entry(n)->list);
+		iovm_update_gap(n);
+	} else {
+		list_add_tail(&new->list, &obj->mmap);
+	}
+}
+
+static void iovm_erase_area(struct iommu *obj, struct iovm_struct *area)
+{
+	struct rb_node *n = &area->node;
+	struct rb_node *deepest, *next;
+
+	deepest = rb_augment_erase_begin(n);
+	next = rb_next(n);
+	rb_erase(n, &obj->mmap_rb);
+	list_del(&area->list);
+
+	rb_augment_erase_end(deepest, iovm_update_max_gap, NULL);
+	if (next)
+		iovm_update_gap(next);
+}
+
 static struct iovm_struct *__find_iovm_area(struct iommu *obj, const u32 da)
 {
-	struct iovm_struct *tmp;
+	struct rb_node *n = obj->mmap_rb.rb_node;
+
+	while (n) {
+		struct iovm_struct *tmp = iovm_entry(n);
 
-	list_for_each_entry(tmp, &obj->mmap, list) {
-		if ((da >= tmp->da_start) && (da < tmp->da_end)) {
+		if (da < tmp->da_start) {
+			n = n->rb_left;
+		} else if (da >= tmp->da_end) {
+			n = n->rb_right;
+		} else {
 			size_t len;
 
 			len = tmp->da_end - tmp->da_start;
@@ -236,6 +342,59 @@ static struct iovm_struct *__find_iovm_area(struct iommu *obj, const u32 da)
 	return NULL;
 }
 
+/* the lowest iovma which ends at or above @da */
+static struct iovm_struct *__find_iovm_area_end(struct iommu *obj, u32 da)
+{
+	struct rb_node *n = obj->mmap_rb.rb_node;
+	struct iovm_struct *found = NULL;
+
+	while (n) {
+		struct iovm_struct *tmp = iovm_entry(n);
+
+		if (tmp->da_end >= da) {
+			found = tmp;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * Lowest hole under @n which fits @bytes at @align. Subtrees without a
+ * large enough hole are skipped using 'max_gap'.
+ */
+static struct iovm_struct *__find_iovm_hole(struct rb_node *n, size_t bytes,
+					    u32 align, u32 *start)
+{
+	struct iovm_struct *tmp, *found;
+
+	if (!n)
+		return NULL;
+
+	tmp = iovm_entry(n);
+	if (tmp->max_gap < bytes)
+		return NULL;
+
+	found = __find_iovm_hole(n->rb_left, bytes, align, start);
+	if (found)
+		return found;
+
+	if (tmp->gap >= bytes) {
+		u64 hi = (u64)tmp->da_start - 1;
+		u64 lo = ALIGN(hi - tmp->gap, (u64)align);
+
+		if (lo + bytes <= hi) {
+			*start = lo;
+			return tmp;
+		}
+	}
+
+	return __find_iovm_hole(n->rb_right, bytes, align, start);
+}
+
 /**
  * find_iovm_area  -  find iovma which includes @da
  * @da:		iommu device virtual address
@@ -262,39 +421,43 @@ static struct iovm_struct *alloc_iovm_area(struct iommu *obj, u32 da,
 					   size_t bytes, u32 flags)
 {
 	struct iovm_struct *new, *tmp;
-	u32 start, prev_end, alignement;
+	u32 start, alignement;
 
 	if (!obj || !bytes)
 		return ERR_PTR(-EINVAL);
-	start = da;
-	alignement = PAGE_SIZE;
+
 	if (flags & IOVMF_DA_ANON) {
+		struct rb_node *last;
+		u64 lo;
+
 		/*
-		 * Reserve the first page for NULL
+		 * Align to the largest iommu page size which fits, so that
+		 * map_iovm_area() can use super/large pages wherever the
+		 * physical memory behind is contiguous enough.
 		 */
-		start = PAGE_SIZE;
-		if (flags & IOVMF_LINEAR)
-			alignement = iopgsz_max(bytes);
-		start = roundup(start, alignement);
-	}
-	tmp = NULL;
-	if (list_empty(&obj->mmap))
-		goto found;
-	prev_end = 0;
-	list_for_each_entry(tmp, &obj->mmap, list) {
-
-		if ((prev_end < start) && (start + bytes < tmp->da_start))
+		alignement = iopgsz_max(bytes);
+		if (__find_iovm_hole(obj->mmap_rb.rb_node, bytes, alignement,
+				     &start))
 			goto found;
 
-		if (flags & IOVMF_DA_ANON)
-			start = roundup(tmp->da_end + 1, alignement);
-
-		prev_end = tmp->da_end;
+		/*
+		 * Reserve the first page for NULL
+		 */
+		last = rb_last(&obj->mmap_rb);
+		lo = last ? (u64)iovm_entry(last)->da_end + 1 : PAGE_SIZE;
+		lo = ALIGN(lo, (u64)alignement);
+		if (lo + bytes <= IOVM_DA_LIMIT) {
+			start = lo;
+			goto found;
+		}
+	} else {
+		start = da;
+		tmp = __find_iovm_area_end(obj, da);
+		if (tmp ? ((u64)start + bytes < tmp->da_start) :
+		    ((u64)start + bytes <= IOVM_DA_LIMIT))
+			goto found;
 	}
 
-	if ((start > prev_end) && (ULONG_MAX - start >= bytes))
-		goto found;
-
 	dev_dbg(obj->dev, "%s: no space to fit %08x(%x) flags: %08x\n",
 		__func__, da, bytes, flags);
 
@@ -310,13 +473,7 @@ found:
 	new->da_end = start + bytes;
 	new->flags = flags;
 
-	/*
-	 * keep ascending order of iovmas
-	 */
-	if (tmp)
-		list_add_tail(&new->list, &tmp->list);
-	else
-		list_add(&new->list, &obj->mmap);
+	iovm_insert_area(obj, new);
 
 	dev_dbg(obj->dev, "%s: found %08x-%08x-%08x(%x) %08x\n",
 		__func__, new->da_start, start, new->da_end, bytes, flags);
@@ -335,7 +492,7 @@ static void free_iovm_area(struct iommu *obj, struct iovm_struct *area)
 	dev_dbg(obj->dev, "%s: %08x-%08x(%x) %08x\n",
 		__func__, area->da_start, area->da_end, bytes, area->flags);
 
-	list_del(&area->list);
+	iovm_erase_area(obj, area);
 	kmem_cache_free(iovm_area_cachep, area);
 }
 
@@ -434,14 +591,61 @@ static inline void sgtable_drain_kmalloc(struct sg_table *sgt)
 	BUG_ON(!sgt);
 }
 
-/* create 'da' <-> 'pa' mapping from 'sgt' */
+/*
+ * Map a physically contiguous run at *@da, using the largest iommu page
+ * size which both addresses are aligned to and the run still covers.
+ * *@da is advanced over what has been mapped, even on failure, so that
+ * the caller can unwind the partial mapping.
+ */
+static int map_iovm_run(struct iommu *obj, u32 *da, u32 pa, size_t len,
+			u32 flags)
+{
+	static const size_t pgsz[] = { SZ_16M, SZ_1M, SZ_64K, SZ_4K, };
+
+	/* SZ_4K is the fallback below, it must fit exactly */
+	if (!IS_ALIGNED(*da | pa | len, SZ_4K))
+		return -EINVAL;
+
+	while (len) {
+		int i, err;
+		size_t bytes;
+		struct iotlb_entry e;
+
+		for (i = 0; i < ARRAY_SIZE(pgsz) - 1; i++)
+			if (len >= pgsz[i] && IS_ALIGNED(*da | pa, pgsz[i]))
+				break;
+		bytes = pgsz[i];
+
+		flags &= ~IOVMF_PGSZ_MASK;
+		flags |= bytes_to_iopgsz(bytes);
+
+		pr_debug("%s: %08x %08x(%x)\n", __func__, *da, pa, bytes);
+
+		iotlb_init_entry(&e, *da, pa, flags);
+		err = iopgtable_store_entry(obj, &e);
+		if (err)
+			return err;
+
+		*da += bytes;
+		pa += bytes;
+		len -= bytes;
+	}
+	return 0;
+}
+
+/*
+ * create 'da' <-> 'pa' mapping from 'sgt'; physically contiguous sg
+ * entries are merged so that super/large pages can be used across them
+ */
 static int map_iovm_area(struct iommu *obj, struct iovm_struct *new,
 			 const struct sg_table *sgt, u32 flags)
 {
 	int err = 0;
-	unsigned int i, j;
+	unsigned int i;
 	struct scatterlist *sg;
-	u32 da = new->da_start;
+	u32 da = new->da_start, end;
+	u32 run_pa = 0;
+	size_t run_len = 0;
 
 	if (!obj || !sgt)
 		return -EINVAL;
@@ -450,35 +654,34 @@ static int map_iovm_area(struct iommu *obj, struct iovm_struct *new,
 
 	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
 		u32 pa;
-		int pgsz;
 		size_t bytes;
-		struct iotlb_entry e;
 
 		pa = sg_phys(sg);
 		bytes = sg_dma_len(sg);
 
-		flags &= ~IOVMF_PGSZ_MASK;
-		pgsz = bytes_to_iopgsz(bytes);
-		if (pgsz < 0)
-			goto err_out;
-		flags |= pgsz;
-
-		pr_debug("%s: [%d] %08x %08x(%x)\n", __func__,
-			 i, da, pa, bytes);
+		if (run_len && run_pa + run_len == pa) {
+			run_len += bytes;
+			continue;
+		}
 
-		iotlb_init_entry(&e, da, pa, flags);
-		err = iopgtable_store_entry(obj, &e);
+		err = map_iovm_run(obj, &da, run_pa, run_len, flags);
 		if (err)
 			goto err_out;
 
-		da += bytes;
+		run_pa = pa;
+		run_len = bytes;
 	}
+
+	err = map_iovm_run(obj, &da, run_pa, run_len, flags);
+	if (err)
+		goto err_out;
 	return 0;
 
 err_out:
+	/* 'da' is where the mapping stopped */
+	end = da;
 	da = new->da_start;
-
-	for_each_sg(sgt->sgl, sg, i, j) {
+	while (da < end) {
 		size_t bytes;
 
 		bytes = iopgtable_clear_entry(obj, da);
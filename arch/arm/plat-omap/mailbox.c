@@ -24,16 +24,18 @@
 #include <linux/module.h>
 #include <linux/interrupt.h>
 #include <linux/device.h>
-#include <linux/delay.h>
 #include <linux/slab.h>
 #include <linux/kfifo.h>
 #include <linux/notifier.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <plat/mailbox.h>
 
 static struct workqueue_struct *mboxd;
 static struct omap_mbox *mboxes;
 static DEFINE_MUTEX(mboxes_lock);
+static struct dentry *mbox_dbg;
 
 static int mbox_configured;
 
@@ -66,36 +68,48 @@ static inline int is_mbox_irq(struct omap_mbox *mbox, omap_mbox_irq_t irq)
 	return mbox->ops->is_irq(mbox, irq);
 }
 
-/*
- * message sender
- */
-static int __mbox_poll_for_space(struct omap_mbox *mbox)
+static void mbox_account(u64 *sum, u64 *max, ktime_t since)
 {
-	int ret = 0, i = 1000;
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), since));
 
-	while (mbox_fifo_full(mbox)) {
-		if (--i == 0)
-			return -1;
-		udelay(1);
-		printk(KERN_ERR "Mailbox FIFO full %d\n", i);
-	}
-	return ret;
+	*sum += ns;
+	if (ns > *max)
+		*max = ns;
 }
 
-
-int omap_mbox_msg_send(struct omap_mbox *mbox, mbox_msg_t msg)
+/*
+ * message sender
+ */
+int omap_mbox_msg_send_batch(struct omap_mbox *mbox, const mbox_msg_t *msgs,
+			     int count)
 {
 	struct omap_mbox_queue *mq = mbox->txq;
-	int ret = 0, len;
+	int ret = 0, len, i = 0;
+
+	if (count <= 0)
+		return -EINVAL;
 
 	spin_lock_bh(&mq->lock);
-	if (kfifo_avail(&mq->fifo) < sizeof(msg)) {
+	if (kfifo_avail(&mq->fifo) < count * sizeof(*msgs)) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
-	len = kfifo_in(&mq->fifo, (unsigned char *)&msg, sizeof(msg));
-	if (unlikely(len != sizeof(msg))) {
+	/* if nothing is queued, write to the mailbox while it has room */
+	if (!kfifo_len(&mq->fifo)) {
+		for (; i < count && !mbox_fifo_full(mbox); i++)
+			mbox_fifo_write(mbox, msgs[i]);
+		mbox->stats.tx_msgs += i;
+		mbox->stats.tx_direct += i;
+		if (i == count)
+			goto out;
+		mq->stamp = ktime_get();
+	}
+
+	/* and leave the rest to the tasklet */
+	len = kfifo_in(&mq->fifo, (unsigned char *)(msgs + i),
+		       (count - i) * sizeof(*msgs));
+	if (unlikely(len != (count - i) * sizeof(*msgs))) {
 		pr_err("%s: kfifo_in anomaly\n", __func__);
 		ret = -ENOMEM;
 	}
@@ -106,6 +120,12 @@ out:
 	spin_unlock_bh(&mq->lock);
 	return ret;
 }
+EXPORT_SYMBOL(omap_mbox_msg_send_batch);
+
+int omap_mbox_msg_send(struct omap_mbox *mbox, mbox_msg_t msg)
+{
+	return omap_mbox_msg_send_batch(mbox, &msg, 1);
+}
 EXPORT_SYMBOL(omap_mbox_msg_send);
 
 static void mbox_tx_tasklet(unsigned long tx_data)
@@ -116,8 +136,11 @@ static void mbox_tx_tasklet(unsigned long tx_data)
 	int ret;
 
 	spin_lock(&mq->lock);
+	mbox->stats.tx_kicks++;
 	while (kfifo_len(&mq->fifo)) {
-		if (__mbox_poll_for_space(mbox)) {
+		/* the tx interrupt reschedules us when there is room */
+		if (mbox_fifo_full(mbox)) {
+			mbox->stats.tx_full++;
 			omap_mbox_enable_irq(mbox, IRQ_TX);
 			break;
 		}
@@ -128,9 +151,11 @@ static void mbox_tx_tasklet(unsigned long tx_data)
 			pr_err("%s: kfifo_out anomaly\n", __func__);
 
 		mbox_fifo_write(mbox, msg);
-
-
+		mbox->stats.tx_msgs++;
 	}
+	if (!kfifo_len(&mq->fifo))
+		mbox_account(&mbox->stats.tx_latency,
+			     &mbox->stats.tx_latency_max, mq->stamp);
 	spin_unlock(&mq->lock);
 }
 
@@ -141,20 +166,31 @@ static void mbox_rx_work(struct work_struct *work)
 {
 	struct omap_mbox_queue *mq =
 			container_of(work, struct omap_mbox_queue, work);
-	mbox_msg_t msg;
-	int len;
-
-	while (kfifo_len(&mq->fifo) >= sizeof(msg)) {
-		len = kfifo_out(&mq->fifo, (unsigned char *)&msg, sizeof(msg));
-		if (unlikely(len != sizeof(msg)))
+	struct omap_mbox *mbox = mq->mbox;
+	mbox_msg_t msgs[MBOX_RX_BATCH];
+	int len, n, i;
+
+	/* deliver everything received so far at once */
+	while ((len = kfifo_out(&mq->fifo, (unsigned char *)msgs,
+						sizeof(msgs)))) {
+		if (unlikely(len % sizeof(*msgs)))
 			pr_err("%s: kfifo_out anomaly detected\n", __func__);
+		n = len / sizeof(*msgs);
+
+		mbox->stats.rx_msgs += n;
+		mbox->stats.rx_batches++;
+		mbox_account(&mbox->stats.rx_latency,
+			     &mbox->stats.rx_latency_max, mq->stamp);
+
+		blocking_notifier_call_chain(&mbox->batch_notifier, n, msgs);
+		for (i = 0; i < n; i++)
+			blocking_notifier_call_chain(&mbox->notifier,
+					sizeof(*msgs), (void *)msgs[i]);
 
-		blocking_notifier_call_chain(&mq->mbox->notifier, len,
-							(void *)msg);
 		spin_lock_irq(&mq->lock);
 		if (mq->full) {
 			mq->full = false;
-			omap_mbox_enable_irq(mq->mbox, IRQ_RX);
+			omap_mbox_enable_irq(mbox, IRQ_RX);
 		}
 		spin_unlock_irq(&mq->lock);
 	}
@@ -204,6 +240,8 @@ static void __mbox_rx_interrupt(struct omap_mbox *mbox)
 
 			msg = mbox_fifo_read(mbox_curr);
 
+			if (!kfifo_len(&mq->fifo))
+				mq->stamp = ktime_get();
 			len = kfifo_in(&mq->fifo, (unsigned char *)&msg,
 								sizeof(msg));
 			if (unlikely(len != sizeof(msg)))
@@ -390,6 +428,56 @@ void omap_mbox_put(struct omap_mbox *mbox, struct notifier_block *nb)
 }
 EXPORT_SYMBOL(omap_mbox_put);
 
+int omap_mbox_register_batch_notifier(struct omap_mbox *mbox,
+				      struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&mbox->batch_notifier, nb);
+}
+EXPORT_SYMBOL(omap_mbox_register_batch_notifier);
+
+int omap_mbox_unregister_batch_notifier(struct omap_mbox *mbox,
+					struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&mbox->batch_notifier, nb);
+}
+EXPORT_SYMBOL(omap_mbox_unregister_batch_notifier);
+
+static u64 mbox_avg_us(u64 sum, unsigned long n)
+{
+	return n ? div64_u64(sum, (u64)n * NSEC_PER_USEC) : 0;
+}
+
+static int mbox_stats_show(struct seq_file *s, void *unused)
+{
+	struct omap_mbox *mbox = s->private;
+	struct omap_mbox_stats *st = &mbox->stats;
+
+	seq_printf(s, "tx: %lu msgs (%lu direct), %lu tasklet runs, "
+		   "%lu times full\n", st->tx_msgs, st->tx_direct,
+		   st->tx_kicks, st->tx_full);
+	seq_printf(s, "tx latency: avg %llu us, max %llu us\n",
+		   mbox_avg_us(st->tx_latency, st->tx_kicks),
+		   div64_u64(st->tx_latency_max, NSEC_PER_USEC));
+	seq_printf(s, "rx: %lu msgs, %lu batches\n", st->rx_msgs,
+		   st->rx_batches);
+	seq_printf(s, "rx latency: avg %llu us, max %llu us\n",
+		   mbox_avg_us(st->rx_latency, st->rx_batches),
+		   div64_u64(st->rx_latency_max, NSEC_PER_USEC));
+	return 0;
+}
+
+static int mbox_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mbox_stats_show, inode->i_private);
+}
+
+static const struct file_operations mbox_stats_fops = {
+	.open		= mbox_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 int omap_mbox_register(struct device *parent, struct omap_mbox *mbox)
 {
 	int ret = 0;
@@ -409,6 +497,20 @@ int omap_mbox_register(struct device *parent, struct omap_mbox *mbox)
 	}
 	*tmp = mbox;
 	BLOCKING_INIT_NOTIFIER_HEAD(&mbox->notifier);
+	BLOCKING_INIT_NOTIFIER_HEAD(&mbox->batch_notifier);
+
+	/* per-mailbox counters in debugfs */
+	if (!mbox_dbg) {
+		mbox_dbg = debugfs_create_dir("mailbox", NULL);
+		if (IS_ERR(mbox_dbg))
+			mbox_dbg = NULL;
+	}
+	if (mbox_dbg) {
+		mbox->dbg = debugfs_create_file(mbox->name, S_IRUGO, mbox_dbg,
+						mbox, &mbox_stats_fops);
+		if (IS_ERR(mbox->dbg))
+			mbox->dbg = NULL;
+	}
 	mutex_unlock(&mboxes_lock);
 
 	return 0;
@@ -428,6 +530,8 @@ int omap_mbox_unregister(struct omap_mbox *mbox)
 		if (mbox == *tmp) {
 			*tmp = mbox->next;
 			mbox->next = NULL;
+			debugfs_remove(mbox->dbg);
+			mbox->dbg = NULL;
 			mutex_unlock(&mboxes_lock);
 			return 0;
 		}
@@ -451,6 +555,7 @@ module_init(omap_mbox_init);
 
 static void __exit omap_mbox_exit(void)
 {
+	debugfs_remove(mbox_dbg);
 	destroy_workqueue(mboxd);
 }
 module_exit(omap_mbox_exit);
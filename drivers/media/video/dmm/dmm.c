@@ -22,25 +22,11 @@
 #include <linux/device.h>          /* struct class */
 #include <linux/platform_device.h> /* platform_device() */
 #include <linux/err.h>             /* IS_ERR() */
-#include <linux/io.h>              /* ioremap() */
 #include <linux/errno.h>
 #include <linux/slab.h>
 
 #include <mach/dmm.h>
 
-#undef __DEBUG__
-#define BITS_32(in_NbBits) ((((u32)1 << in_NbBits) - 1) | ((u32)1 << in_NbBits))
-#define BITFIELD_32(in_UpBit, in_LowBit)\
-	(BITS_32(in_UpBit) & ~((BITS_32(in_LowBit)) >> 1))
-#define BF BITFIELD_32
-
-#ifdef __DEBUG__
-#define DEBUG(x, y) printk(KERN_NOTICE "%s()::%d:%s=(0x%08x)\n", \
-				__func__, __LINE__, x, (s32)y);
-#else
-#define DEBUG(x, y)
-#endif
-
 static s32 dmm_major;
 static s32 dmm_minor;
 
@@ -61,156 +47,6 @@ static struct platform_driver dmm_driver_ldm = {
 	.remove = NULL,
 };
 
-s32 dmm_pat_refill(struct dmm *dmm, struct pat *pd, enum pat_mode mode)
-{
-	void __iomem *r = NULL;
-	u32 v = -1, w = -1;
-
-	/* Only manual refill supported */
-	if (mode != MANUAL)
-		return -EFAULT;
-
-	/*
-	 * Check that the DMM_PAT_STATUS register
-	 * has not reported an error.
-	*/
-	r = (void __iomem *)((u32)dmm->base | DMM_PAT_STATUS__0);
-	v = __raw_readl(r);
-	if ((v & 0xFC00) != 0) {
-		while (1)
-			printk(KERN_ERR "dmm_pat_refill() error.\n");
-	}
-
-	/* Set "next" register to NULL */
-	r = (void __iomem *)((u32)dmm->base | DMM_PAT_DESCR__0);
-	v = __raw_readl(r);
-	w = (v & (~(BF(31, 4)))) | ((((u32)NULL) << 4) & BF(31, 4));
-	__raw_writel(w, r);
-
-	/* Set area to be refilled */
-	r = (void __iomem *)((u32)dmm->base | DMM_PAT_AREA__0);
-	v = __raw_readl(r);
-	w = (v & (~(BF(30, 24)))) | ((((s8)pd->area.y1) << 24) & BF(30, 24));
-	__raw_writel(w, r);
-
-	v = __raw_readl(r);
-	w = (v & (~(BF(23, 16)))) | ((((s8)pd->area.x1) << 16) & BF(23, 16));
-	__raw_writel(w, r);
-
-	v = __raw_readl(r);
-	w = (v & (~(BF(14, 8)))) | ((((s8)pd->area.y0) << 8) & BF(14, 8));
-	__raw_writel(w, r);
-
-	v = __raw_readl(r);
-	w = (v & (~(BF(7, 0)))) | ((((s8)pd->area.x0) << 0) & BF(7, 0));
-	__raw_writel(w, r);
-	wmb();
-
-#ifdef __DEBUG__
-	printk(KERN_NOTICE "\nx0=(%d),y0=(%d),x1=(%d),y1=(%d)\n",
-						(char)pd->area.x0,
-						(char)pd->area.y0,
-						(char)pd->area.x1,
-						(char)pd->area.y1);
-#endif
-
-	/* First, clear the DMM_PAT_IRQSTATUS register */
-	r = (void __iomem *)((u32)dmm->base | (u32)DMM_PAT_IRQSTATUS);
-	__raw_writel(0xFFFFFFFF, r);
-	wmb();
-
-	r = (void __iomem *)((u32)dmm->base | (u32)DMM_PAT_IRQSTATUS_RAW);
-	v = 0xFFFFFFFF;
-
-	while (v != 0x0) {
-		v = __raw_readl(r);
-		DEBUG("DMM_PAT_IRQSTATUS_RAW", v);
-	}
-
-	/* Fill data register */
-	r = (void __iomem *)((u32)dmm->base | DMM_PAT_DATA__0);
-	v = __raw_readl(r);
-
-	/* Apply 4 bit left shft to counter the 4 bit right shift */
-	w = (v & (~(BF(31, 4)))) | ((((u32)(pd->data >> 4)) << 4) & BF(31, 4));
-	__raw_writel(w, r);
-	wmb();
-
-	/* Read back PAT_DATA__0 to see if write was successful */
-	v = 0x0;
-	while (v != pd->data) {
-		v = __raw_readl(r);
-		DEBUG("DMM_PAT_DATA__0", v);
-	}
-
-	r = (void __iomem *)((u32)dmm->base | (u32)DMM_PAT_CTRL__0);
-	v = __raw_readl(r);
-
-	w = (v & (~(BF(31, 28)))) | ((((u32)pd->ctrl.ini) << 28) & BF(31, 28));
-	__raw_writel(w, r);
-
-	v = __raw_readl(r);
-	w = (v & (~(BF(16, 16)))) | ((((u32)pd->ctrl.sync) << 16) & BF(16, 16));
-	__raw_writel(w, r);
-
-	v = __raw_readl(r);
-	w = (v & (~(BF(9, 8)))) | ((((u32)pd->ctrl.lut_id) << 8) & BF(9, 8));
-	__raw_writel(w, r);
-
-	v = __raw_readl(r);
-	w = (v & (~(BF(6, 4)))) | ((((u32)pd->ctrl.dir) << 4) & BF(6, 4));
-	__raw_writel(w, r);
-
-	v = __raw_readl(r);
-	w = (v & (~(BF(0, 0)))) | ((((u32)pd->ctrl.start) << 0) & BF(0, 0));
-	__raw_writel(w, r);
-	wmb();
-
-	/*
-	 * Now, check if PAT_IRQSTATUS_RAW has been
-	 * set after the PAT has been refilled
-	 */
-	r = (void __iomem *)((u32)dmm->base | (u32)DMM_PAT_IRQSTATUS_RAW);
-	v = 0x0;
-	while ((v & 0x3) != 0x3) {
-		v = __raw_readl(r);
-		DEBUG("DMM_PAT_IRQSTATUS_RAW", v);
-	}
-
-	/* Again, clear the DMM_PAT_IRQSTATUS register */
-	r = (void __iomem *)((u32)dmm->base | (u32)DMM_PAT_IRQSTATUS);
-	__raw_writel(0xFFFFFFFF, r);
-	wmb();
-
-	r = (void __iomem *)((u32)dmm->base | (u32)DMM_PAT_IRQSTATUS_RAW);
-	v = 0xFFFFFFFF;
-
-	while (v != 0x0) {
-		v = __raw_readl(r);
-		DEBUG("DMM_PAT_IRQSTATUS_RAW", v);
-	}
-
-	/* Again, set "next" register to NULL to clear any PAT STATUS errors */
-	r = (void __iomem *)((u32)dmm->base | DMM_PAT_DESCR__0);
-	v = __raw_readl(r);
-	w = (v & (~(BF(31, 4)))) | ((((u32)NULL) << 4) & BF(31, 4));
-	__raw_writel(w, r);
-
-	/*
-	 * Now, check that the DMM_PAT_STATUS register
-	 * has not reported an error before exiting.
-	*/
-	r = (void __iomem *)((u32)dmm->base | DMM_PAT_STATUS__0);
-	v = __raw_readl(r);
-	if ((v & 0xFC00) != 0) {
-		while (1)
-			printk(KERN_ERR "dmm_pat_refill() error.\n");
-	}
-
-	return 0;
-}
-EXPORT_SYMBOL(dmm_pat_refill);
-
 static s32 dmm_open(struct inode *ip, struct file *filp)
 {
 	return 0;
@@ -226,54 +62,6 @@ static const struct file_operations dmm_fops = {
 	.release = dmm_release,
 };
 
-struct dmm *dmm_pat_init(u32 id)
-{
-	u32 base = 0;
-	struct dmm *dmm = NULL;
-	switch (id) {
-	case 0:
-		/* only support id 0 for now */
-		base = DMM_BASE;
-		break;
-	default:
-		return NULL;
-	}
-
-	dmm = kmalloc(sizeof(*dmm), GFP_KERNEL);
-	if (!dmm)
-		return NULL;
-
-	dmm->base = ioremap(base, DMM_SIZE);
-	if (!dmm->base) {
-		kfree(dmm);
-		return NULL;
-	}
-
-	__raw_writel(0x88888888, dmm->base + DMM_PAT_VIEW__0);
-	__raw_writel(0x88888888, dmm->base + DMM_PAT_VIEW__1);
-	__raw_writel(0x80808080, dmm->base + DMM_PAT_VIEW_MAP__0);
-	__raw_writel(0x80000000, dmm->base + DMM_PAT_VIEW_MAP_BASE);
-	__raw_writel(0x88888888, dmm->base + DMM_TILER_OR__0);
-	__raw_writel(0x88888888, dmm->base + DMM_TILER_OR__1);
-
-	return dmm;
-}
-EXPORT_SYMBOL(dmm_pat_init);
-
-/**
- * Clean up the physical address translator.
- * @param dmm    Device data
- * @return an error status.
- */
-void dmm_pat_release(struct dmm *dmm)
-{
-	if (dmm) {
-		iounmap(dmm->base);
-		kfree(dmm);
-	}
-}
-EXPORT_SYMBOL(dmm_pat_release);
-
 static s32 __init dmm_init(void)
 {
 	dev_t dev  = 0;
@@ -0,0 +1,378 @@
+/*
+ * dmm_pat.c
+ *
+ * DMM physical address translator (PAT) refill engine for TI OMAP
+ * processors.
+ *
+ * Copyright (C) 2009-2010 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <linux/module.h>
+#include <linux/io.h>              /* ioremap() */
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/interrupt.h>
+#include <linux/jiffies.h>
+#include <linux/dma-mapping.h>
+
+#include <mach/dmm.h>
+
+#undef __DEBUG__
+#define BITS_32(in_NbBits) ((((u32)1 << in_NbBits) - 1) | ((u32)1 << in_NbBits))
+#define BITFIELD_32(in_UpBit, in_LowBit)\
+	(BITS_32(in_UpBit) & ~((BITS_32(in_LowBit)) >> 1))
+#define BF BITFIELD_32
+
+#ifdef __DEBUG__
+#define DEBUG(x, y) printk(KERN_NOTICE "%s()::%d:%s=(0x%08x)\n", \
+				__func__, __LINE__, x, (s32)y);
+#else
+#define DEBUG(x, y)
+#endif
+
+/* program a single descriptor through the registers (mutex is locked) */
+static s32 dmm_pat_refill_manual(struct dmm *dmm, struct pat *pd)
+{
+	void __iomem *r = NULL;
+	u32 v = -1, w = -1;
+
+	/*
+	 * Check that the DMM_PAT_STATUS register
+	 * has not reported an error.
+	*/
+	r = dmm->base + DMM_PAT_STATUS__0;
+	v = __raw_readl(r);
+	if ((v & 0xFC00) != 0) {
+		printk(KERN_ERR "dmm_pat_refill() error (status 0x%x)\n", v);
+		return -EIO;
+	}
+
+	/* Set "next" register to NULL */
+	r = dmm->base + DMM_PAT_DESCR__0;
+	v = __raw_readl(r);
+	w = v & ~BF(31, 4);
+	__raw_writel(w, r);
+
+	/* Set area to be refilled */
+	r = dmm->base + DMM_PAT_AREA__0;
+	v = __raw_readl(r);
+	w = (v & (~(BF(30, 24)))) | ((((s8)pd->area.y1) << 24) & BF(30, 24));
+	__raw_writel(w, r);
+
+	v = __raw_readl(r);
+	w = (v & (~(BF(23, 16)))) | ((((s8)pd->area.x1) << 16) & BF(23, 16));
+	__raw_writel(w, r);
+
+	v = __raw_readl(r);
+	w = (v & (~(BF(14, 8)))) | ((((s8)pd->area.y0) << 8) & BF(14, 8));
+	__raw_writel(w, r);
+
+	v = __raw_readl(r);
+	w = (v & (~(BF(7, 0)))) | ((((s8)pd->area.x0) << 0) & BF(7, 0));
+	__raw_writel(w, r);
+	wmb();
+
+#ifdef __DEBUG__
+	printk(KERN_NOTICE "\nx0=(%d),y0=(%d),x1=(%d),y1=(%d)\n",
+						(char)pd->area.x0,
+						(char)pd->area.y0,
+						(char)pd->area.x1,
+						(char)pd->area.y1);
+#endif
+
+	/* First, clear the DMM_PAT_IRQSTATUS register */
+	r = dmm->base + DMM_PAT_IRQSTATUS;
+	__raw_writel(0xFFFFFFFF, r);
+	wmb();
+
+	r = dmm->base + DMM_PAT_IRQSTATUS_RAW;
+	v = 0xFFFFFFFF;
+
+	while (v != 0x0) {
+		v = __raw_readl(r);
+		DEBUG("DMM_PAT_IRQSTATUS_RAW", v);
+	}
+
+	/* Fill data register */
+	r = dmm->base + DMM_PAT_DATA__0;
+	v = __raw_readl(r);
+
+	/* Apply 4 bit left shft to counter the 4 bit right shift */
+	w = (v & (~(BF(31, 4)))) | ((((u32)(pd->data >> 4)) << 4) & BF(31, 4));
+	__raw_writel(w, r);
+	wmb();
+
+	/* Read back PAT_DATA__0 to see if write was successful */
+	v = 0x0;
+	while (v != pd->data) {
+		v = __raw_readl(r);
+		DEBUG("DMM_PAT_DATA__0", v);
+	}
+
+	r = dmm->base + DMM_PAT_CTRL__0;
+	v = __raw_readl(r);
+
+	w = (v & (~(BF(31, 28)))) | ((((u32)pd->ctrl.ini) << 28) & BF(31, 28));
+	__raw_writel(w, r);
+
+	v = __raw_readl(r);
+	w = (v & (~(BF(16, 16)))) | ((((u32)pd->ctrl.sync) << 16) & BF(16, 16));
+	__raw_writel(w, r);
+
+	v = __raw_readl(r);
+	w = (v & (~(BF(9, 8)))) | ((((u32)pd->ctrl.lut_id) << 8) & BF(9, 8));
+	__raw_writel(w, r);
+
+	v = __raw_readl(r);
+	w = (v & (~(BF(6, 4)))) | ((((u32)pd->ctrl.dir) << 4) & BF(6, 4));
+	__raw_writel(w, r);
+
+	v = __raw_readl(r);
+	w = (v & (~(BF(0, 0)))) | ((((u32)pd->ctrl.start) << 0) & BF(0, 0));
+	__raw_writel(w, r);
+	wmb();
+
+	/*
+	 * Now, check if PAT_IRQSTATUS_RAW has been
+	 * set after the PAT has been refilled
+	 */
+	r = dmm->base + DMM_PAT_IRQSTATUS_RAW;
+	v = 0x0;
+	while ((v & 0x3) != 0x3) {
+		v = __raw_readl(r);
+		DEBUG("DMM_PAT_IRQSTATUS_RAW", v);
+	}
+
+	/* Again, clear the DMM_PAT_IRQSTATUS register */
+	r = dmm->base + DMM_PAT_IRQSTATUS;
+	__raw_writel(0xFFFFFFFF, r);
+	wmb();
+
+	r = dmm->base + DMM_PAT_IRQSTATUS_RAW;
+	v = 0xFFFFFFFF;
+
+	while (v != 0x0) {
+		v = __raw_readl(r);
+		DEBUG("DMM_PAT_IRQSTATUS_RAW", v);
+	}
+
+	/* Again, set "next" register to NULL to clear any PAT STATUS errors */
+	r = dmm->base + DMM_PAT_DESCR__0;
+	v = __raw_readl(r);
+	w = v & ~BF(31, 4);
+	__raw_writel(w, r);
+
+	/*
+	 * Now, check that the DMM_PAT_STATUS register
+	 * has not reported an error before exiting.
+	*/
+	r = dmm->base + DMM_PAT_STATUS__0;
+	v = __raw_readl(r);
+	if ((v & 0xFC00) != 0) {
+		printk(KERN_ERR "dmm_pat_refill() error (status 0x%x)\n", v);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static irqreturn_t dmm_pat_isr(int irq, void *data)
+{
+	struct dmm *dmm = data;
+	u32 status;
+
+	status = __raw_readl(dmm->base + DMM_PAT_IRQSTATUS) & 0xFF;
+	if (!status)
+		return IRQ_NONE;
+
+	__raw_writel(status, dmm->base + DMM_PAT_IRQSTATUS);
+	__raw_writel(0, dmm->base + DMM_PAT_IRQ_EOI);
+
+	dmm->status |= status;
+	if (status & (DMM_PAT_IRQ_LST | DMM_PAT_IRQ_ERR))
+		complete(&dmm->done);
+	return IRQ_HANDLED;
+}
+
+/* wait for the DMM to finish a chain (mutex is locked) */
+static s32 dmm_pat_wait(struct dmm *dmm)
+{
+	unsigned long timeout = jiffies + msecs_to_jiffies(DMM_PAT_TIMEOUT_MS);
+	u32 v;
+
+	if (dmm->irq >= 0) {
+		if (!wait_for_completion_timeout(&dmm->done,
+				msecs_to_jiffies(DMM_PAT_TIMEOUT_MS)))
+			return -ETIMEDOUT;
+		return 0;
+	}
+
+	/* no interrupt: poll for the end of the chain */
+	do {
+		v = __raw_readl(dmm->base + DMM_PAT_IRQSTATUS_RAW) & 0xFF;
+		if (v & (DMM_PAT_IRQ_LST | DMM_PAT_IRQ_ERR)) {
+			__raw_writel(v, dmm->base + DMM_PAT_IRQSTATUS);
+			dmm->status = v;
+			return 0;
+		}
+		cpu_relax();
+	} while (time_before(jiffies, timeout));
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * Hand a chain of descriptors to the DMM (mutex is locked).  The chain is
+ * copied to coherent memory with next pointing to physical addresses, and
+ * the DMM walks it on its own once the head is written to DMM_PAT_DESCR.
+ * Returns the number of descriptors programmed, or an error.
+ */
+static s32 dmm_pat_refill_chain(struct dmm *dmm, struct pat *pd)
+{
+	struct pat *d = dmm->descs;
+	s32 n = 0, r;
+
+	for (; pd && n < dmm->max_descs; pd = pd->next, n++, d++) {
+		*d = *pd;
+		d->next = NULL;
+		if (n)
+			d[-1].next = (struct pat *)(unsigned long)
+				(dmm->descs_pa + n * sizeof(*d));
+	}
+	wmb();
+
+	dmm->status = 0;
+	INIT_COMPLETION(dmm->done);
+	__raw_writel(dmm->descs_pa, dmm->base + DMM_PAT_DESCR__0);
+
+	r = dmm_pat_wait(dmm);
+	if (!r && (dmm->status & DMM_PAT_IRQ_ERR))
+		r = -EIO;
+	if (r) {
+		printk(KERN_ERR "dmm_pat_refill() error %d (irq status 0x%x, "
+			"status 0x%x)\n", r, dmm->status,
+			__raw_readl(dmm->base + DMM_PAT_STATUS__0));
+		/* writing a NULL descriptor clears the error state */
+		__raw_writel(0, dmm->base + DMM_PAT_DESCR__0);
+		return r;
+	}
+	return n;
+}
+
+s32 dmm_pat_refill(struct dmm *dmm, struct pat *pd, enum pat_mode mode)
+{
+	s32 r = 0;
+
+	mutex_lock(&dmm->mtx);
+	if (mode == AUTO) {
+		/* chains longer than the descriptor buffer take several runs */
+		while (pd) {
+			r = dmm_pat_refill_chain(dmm, pd);
+			if (r < 0)
+				break;
+			while (r--)
+				pd = pd->next;
+			r = 0;
+		}
+	} else {
+		/* keep the interrupt handler off the status we poll */
+		if (dmm->irq >= 0)
+			__raw_writel(DMM_PAT_IRQ_LST | DMM_PAT_IRQ_ERR,
+				     dmm->base + DMM_PAT_IRQENABLE_CLR);
+		for (; pd && !r; pd = pd->next)
+			r = dmm_pat_refill_manual(dmm, pd);
+		if (dmm->irq >= 0)
+			__raw_writel(DMM_PAT_IRQ_LST | DMM_PAT_IRQ_ERR,
+				     dmm->base + DMM_PAT_IRQENABLE_SET);
+	}
+	mutex_unlock(&dmm->mtx);
+
+	return r < 0 ? r : 0;
+}
+EXPORT_SYMBOL(dmm_pat_refill);
+
+struct dmm *dmm_pat_init(u32 id)
+{
+	u32 base = 0;
+	struct dmm *dmm = NULL;
+	switch (id) {
+	case 0:
+		/* only support id 0 for now */
+		base = DMM_BASE;
+		break;
+	default:
+		return NULL;
+	}
+
+	dmm = kzalloc(sizeof(*dmm), GFP_KERNEL);
+	if (!dmm)
+		return NULL;
+
+	dmm->base = ioremap(base, DMM_SIZE);
+	if (!dmm->base) {
+		kfree(dmm);
+		return NULL;
+	}
+
+	/* descriptors must be 16-byte aligned; a page of them is plenty */
+	dmm->descs = dma_alloc_coherent(NULL, PAGE_SIZE, &dmm->descs_pa,
+					GFP_KERNEL);
+	if (!dmm->descs) {
+		iounmap(dmm->base);
+		kfree(dmm);
+		return NULL;
+	}
+	dmm->max_descs = PAGE_SIZE / sizeof(*dmm->descs);
+	mutex_init(&dmm->mtx);
+	init_completion(&dmm->done);
+
+	__raw_writel(0x88888888, dmm->base + DMM_PAT_VIEW__0);
+	__raw_writel(0x88888888, dmm->base + DMM_PAT_VIEW__1);
+	__raw_writel(0x80808080, dmm->base + DMM_PAT_VIEW_MAP__0);
+	__raw_writel(0x80000000, dmm->base + DMM_PAT_VIEW_MAP_BASE);
+	__raw_writel(0x88888888, dmm->base + DMM_TILER_OR__0);
+	__raw_writel(0x88888888, dmm->base + DMM_TILER_OR__1);
+
+	/* refills complete by interrupt, or are polled if that fails */
+	__raw_writel(0xFFFFFFFF, dmm->base + DMM_PAT_IRQSTATUS);
+	dmm->irq = DMM_PAT_IRQ;
+	if (request_irq(dmm->irq, dmm_pat_isr, 0, "dmm", dmm)) {
+		printk(KERN_WARNING "dmm: no interrupt, polling refills\n");
+		dmm->irq = -1;
+	} else {
+		__raw_writel(DMM_PAT_IRQ_LST | DMM_PAT_IRQ_ERR,
+			     dmm->base + DMM_PAT_IRQENABLE_SET);
+	}
+
+	return dmm;
+}
+EXPORT_SYMBOL(dmm_pat_init);
+
+/**
+ * Clean up the physical address translator.
+ * @param dmm    Device data
+ * @return an error status.
+ */
+void dmm_pat_release(struct dmm *dmm)
+{
+	if (dmm) {
+		if (dmm->irq >= 0) {
+			__raw_writel(0xFFFFFFFF,
+				     dmm->base + DMM_PAT_IRQENABLE_CLR);
+			free_irq(dmm->irq, dmm);
+		}
+		dma_free_coherent(NULL, PAGE_SIZE, dmm->descs, dmm->descs_pa);
+		mutex_destroy(&dmm->mtx);
+		iounmap(dmm->base);
+		kfree(dmm);
+	}
+}
+EXPORT_SYMBOL(dmm_pat_release);
@@ -26,7 +26,9 @@ struct tmm {
 	/* function table */
 	u32 *(*get)    (struct tmm *tmm, s32 num_pages);
 	void (*free)   (struct tmm *tmm, u32 *pages);
-	s32  (*map)    (struct tmm *tmm, struct pat_area area, u32 page_pa);
+	void (*release)(struct tmm *tmm, u32 *pages);
+	s32  (*map)    (struct tmm *tmm, struct pat_area *area, u32 *page_pa,
+			u32 num_areas);
 	void (*clear)  (struct tmm *tmm, struct pat_area area);
 	void (*deinit) (struct tmm *tmm);
 };
@@ -55,15 +57,32 @@ void tmm_free(struct tmm *tmm, u32 *pages)
 }
 
 /**
- * Program the physical address translator.
- * @param area PAT area
- * @param list of pages
+ * Return a set of used pages to the system, bypassing the DMM free page
+ * stack.  Falls back to tmm_free() if not supported.
+ * @param list a pointer to a list of physical page addresses.
+ */
+static inline
+void tmm_release(struct tmm *tmm, u32 *pages)
+{
+	if (tmm && tmm->release && tmm->pvt)
+		tmm->release(tmm, pages);
+	else
+		tmm_free(tmm, pages);
+}
+
+/**
+ * Program the physical address translator.  All areas are programmed in
+ * one operation.
+ * @param area array of PAT areas
+ * @param page_pa physical address of the page list for each area
+ * @param num_areas number of areas
  */
 static inline
-s32 tmm_map(struct tmm *tmm, struct pat_area area, u32 page_pa)
+s32 tmm_map(struct tmm *tmm, struct pat_area *area, u32 *page_pa,
+	    u32 num_areas)
 {
 	if (tmm && tmm->map && tmm->pvt)
-		return tmm->map(tmm, area, page_pa);
+		return tmm->map(tmm, area, page_pa, num_areas);
 	return -ENODEV;
 }
 
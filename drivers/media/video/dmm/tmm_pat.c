@@ -21,6 +21,9 @@
 #include <linux/mutex.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
 
 #include "tmm.h"
 
@@ -37,6 +40,49 @@
 /* Number of pages currently allocated */
 static unsigned long count;
 
+/*
+ * Page pool.  Allocations take pages off the free page stack; when it drops
+ * below pool_low a kthread refills it up to pool_high, so that allocating
+ * does not wait for the page allocator.  Pages are allocated in blocks of
+ * 2^pool_order pages when possible, to save allocator calls and flushes.
+ */
+static uint pool_low = 512;
+module_param(pool_low, uint, 0644);
+static uint pool_high = 2048;
+module_param(pool_high, uint, 0644);
+static uint pool_order = 4;
+module_param(pool_order, uint, 0644);
+
+/* pool statistics */
+static unsigned long pool_pages;	/* pages on the free page stack */
+module_param(pool_pages, ulong, 0444);
+static unsigned long pool_refills;	/* background refills */
+module_param(pool_refills, ulong, 0444);
+static unsigned long pool_misses;	/* allocations that had to refill */
+module_param(pool_misses, ulong, 0444);
+
+/* allocation latency: "<allocations> <avg us> <max us>", write to reset */
+static unsigned long alloc_num;
+static u64 alloc_ns, alloc_ns_max;
+
+static int param_get_alloc_latency(char *buffer, struct kernel_param *kp)
+{
+	u64 avg = alloc_num ? div64_u64(alloc_ns, alloc_num) : 0;
+
+	return sprintf(buffer, "%lu %llu %llu", alloc_num,
+		       div64_u64(avg, NSEC_PER_USEC),
+		       div64_u64(alloc_ns_max, NSEC_PER_USEC));
+}
+
+static int param_set_alloc_latency(const char *val, struct kernel_param *kp)
+{
+	alloc_num = 0;
+	alloc_ns = alloc_ns_max = 0;
+	return 0;
+}
+module_param_call(alloc_latency, param_set_alloc_latency,
+		  param_get_alloc_latency, NULL, 0644);
+
 /**
   * Used to keep track of mem per
   * dmm_get_pages call.
@@ -67,6 +113,7 @@ struct dmm_mem {
 	struct mem used_list;
 	struct mutex mtx;
 	struct dmm *dmm;
+	struct task_struct *refill_task;
 };
 
 static void dmm_free_fast_list(struct fast *fast)
@@ -87,39 +134,96 @@ static void dmm_free_fast_list(struct fast *fast)
 	}
 }
 
-static u32 fill_page_stack(struct mem *mem, struct mutex *mtx)
+/* add about n pages to the free page stack */
+static s32 fill_page_stack(struct dmm_mem *pvt, u32 n)
 {
-	s32 i = 0;
+	u32 i = 0, got = 0, order = min_t(u32, pool_order, MAX_ORDER - 1);
+	struct page *pg = NULL;
 	struct mem *m = NULL;
+	void *va;
+	LIST_HEAD(pages);
 
-	for (i = 0; i < MAX; i++) {
-		m = kmalloc(sizeof(*m), GFP_KERNEL);
-		if (!m)
-			return -ENOMEM;
-		memset(m, 0x0, sizeof(*m));
-
-		m->pg = alloc_page(GFP_KERNEL | GFP_DMA);
-		if (!m->pg) {
-			kfree(m);
-			return -ENOMEM;
+	while (got < n) {
+		/*
+		 * alloc_pages_exact() returns the block already split into
+		 * pages.  Fall back to single pages once a block fails.
+		 */
+		va = NULL;
+		if (order)
+			va = alloc_pages_exact(DMM_PAGE << order, GFP_KERNEL |
+					GFP_DMA | __GFP_NOWARN | __GFP_NORETRY);
+		if (va) {
+			pg = virt_to_page(va);
+		} else {
+			order = 0;
+			pg = alloc_page(GFP_KERNEL | GFP_DMA);
+			if (!pg)
+				break;
 		}
 
-		m->pa = page_to_phys(m->pg);
-
 		/**
 		 * Note: we need to flush the cache
 		 * entry for each page we allocate.
 		*/
-		dmac_flush_range((void *)page_address(m->pg),
-					(void *)page_address(m->pg) + DMM_PAGE);
-		outer_flush_range(m->pa, m->pa + DMM_PAGE);
-
-		mutex_lock(mtx);
-		count++;
-		list_add(&m->list, &mem->list);
-		mutex_unlock(mtx);
+		dmac_flush_range((void *)page_address(pg),
+				(void *)page_address(pg) + (DMM_PAGE << order));
+		outer_flush_range(page_to_phys(pg),
+				page_to_phys(pg) + (DMM_PAGE << order));
+
+		for (i = 0; i < (1 << order); i++) {
+			m = kmalloc(sizeof(*m), GFP_KERNEL);
+			if (!m)
+				break;
+			m->pg = pg + i;
+			m->pa = page_to_phys(m->pg);
+			list_add(&m->list, &pages);
+		}
+		got += i;
+		if (i < (1 << order)) {
+			for (; i < (1 << order); i++)
+				__free_page(pg + i);
+			break;
+		}
 	}
-	return 0x0;
+
+	mutex_lock(&pvt->mtx);
+	list_splice(&pages, &pvt->free_list.list);
+	count += got;
+	pool_pages += got;
+	mutex_unlock(&pvt->mtx);
+
+	return got ? 0 : -ENOMEM;
+}
+
+/* keep the free page stack between pool_low and pool_high */
+static int tmm_pat_refill_thread(void *data)
+{
+	struct dmm_mem *pvt = data;
+	unsigned long high;
+	bool failed = false;
+
+	while (!kthread_should_stop()) {
+		/* after a failed refill, wait for the next allocation */
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (failed || pool_pages >= pool_low || count >= PAGE_CAP) {
+			failed = false;
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		pool_refills++;
+		high = max(pool_high, pool_low);
+		while (pool_pages < high && count < PAGE_CAP &&
+		       !kthread_should_stop()) {
+			if (fill_page_stack(pvt, min_t(unsigned long, MAX,
+						       high - pool_pages))) {
+				failed = true;
+				break;
+			}
+		}
+	}
+	return 0;
 }
 
 static void dmm_free_page_stack(struct mem *mem)
@@ -140,6 +244,8 @@ static void tmm_pat_deinit(struct tmm *tmm)
 {
 	struct dmm_mem *pvt = (struct dmm_mem *) tmm->pvt;
 
+	kthread_stop(pvt->refill_task);
+
 	mutex_lock(&pvt->mtx);
 	dmm_free_fast_list(&pvt->fast_list);
 	dmm_free_page_stack(&pvt->free_list);
@@ -150,18 +256,16 @@ static void tmm_pat_deinit(struct tmm *tmm)
 static u32 *tmm_pat_get_pages(struct tmm *tmm, s32 n)
 {
 	s32 i = 0;
-	struct list_head *pos = NULL, *q = NULL;
 	struct mem *m = NULL;
 	struct fast *f = NULL;
 	struct dmm_mem *pvt = (struct dmm_mem *) tmm->pvt;
+	ktime_t start = ktime_get();
+	u32 need;
+	u64 ns;
 
 	if (n <= 0 || n > 0x8000)
 		return NULL;
 
-	if (list_empty_careful(&pvt->free_list.list))
-		if (fill_page_stack(&pvt->free_list, &pvt->mtx))
-			return NULL;
-
 	f = kmalloc(sizeof(*f), GFP_KERNEL);
 	if (!f)
 		return NULL;
@@ -187,58 +291,60 @@ static u32 *tmm_pat_get_pages(struct tmm *tmm, s32 n)
 	 */
 	f->num = n;
 
-	for (i = 0; i < n; i++) {
-		if (list_empty_careful(&pvt->free_list.list))
-			if (fill_page_stack(&pvt->free_list, &pvt->mtx))
-				goto cleanup;
-
-		mutex_lock(&pvt->mtx);
-		pos = NULL;
-		q = NULL;
-		m = NULL;
-
-		/*
-		 * remove one mem struct from the free list and
-		 * add the address to the fast struct mem array
-		 */
-		list_for_each_safe(pos, q, &pvt->free_list.list) {
-			m = list_entry(pos, struct mem, list);
-			list_del(pos);
-			break;
-		}
+	/* if the pool cannot cover the request, refill it here */
+	mutex_lock(&pvt->mtx);
+	while (pool_pages < n) {
+		need = n - pool_pages;
+		pool_misses++;
 		mutex_unlock(&pvt->mtx);
-
-		if (m != NULL) {
-			f->mem[i] = m;
-			f->pa[i] = m->pa;
-		} else {
+		if (fill_page_stack(pvt, max_t(u32, need, MAX)))
 			goto cleanup;
-		}
+		mutex_lock(&pvt->mtx);
 	}
 
-	mutex_lock(&pvt->mtx);
+	/*
+	 * remove mem structs from the free list and
+	 * add the addresses to the fast struct mem array
+	 */
+	for (i = 0; i < n; i++) {
+		m = list_first_entry(&pvt->free_list.list, struct mem, list);
+		list_del(&m->list);
+		f->mem[i] = m;
+		f->pa[i] = m->pa;
+	}
+	pool_pages -= n;
 	list_add(&f->list, &pvt->fast_list.list);
+
+	if (pool_pages < pool_low)
+		wake_up_process(pvt->refill_task);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	alloc_num++;
+	alloc_ns += ns;
+	if (ns > alloc_ns_max)
+		alloc_ns_max = ns;
 	mutex_unlock(&pvt->mtx);
 
-	if (f != NULL)
-		return f->pa;
+	return f->pa;
+
 cleanup:
-	for (; i > 0; i--) {
-		mutex_lock(&pvt->mtx);
-		list_add(&f->mem[i - 1]->list, &pvt->free_list.list);
-		mutex_unlock(&pvt->mtx);
-	}
 	kfree(f->pa);
 	kfree(f->mem);
 	kfree(f);
 	return NULL;
 }
 
-static void tmm_pat_free_pages(struct tmm *tmm, u32 *list)
+/*
+ * Give back the pages of a tmm_pat_get_pages() call.  They go on the free
+ * page stack while it is below pool_high, or if keep is false straight
+ * back to the system.
+ */
+static void tmm_pat_put_pages(struct tmm *tmm, u32 *list, bool keep)
 {
 	struct dmm_mem *pvt = (struct dmm_mem *) tmm->pvt;
 	struct list_head *pos = NULL, *q = NULL;
 	struct fast *f = NULL;
+	struct mem *m;
 	s32 i = 0;
 
 	mutex_lock(&pvt->mtx);
@@ -248,13 +354,15 @@ static void tmm_pat_free_pages(struct tmm *tmm, u32 *list)
 		f = list_entry(pos, struct fast, list);
 		if (f->pa[0] == list[0]) {
 			for (i = 0; i < f->num; i++) {
-				if (count < PAGE_CAP) {
-					list_add(
-					&((struct mem *)f->mem[i])->list,
-					&pvt->free_list.list);
+				m = f->mem[i];
+				if (keep &&
+				    pool_pages < max(pool_high, pool_low)) {
+					list_add(&m->list,
+						 &pvt->free_list.list);
+					pool_pages++;
 				} else {
-					__free_page(
-						((struct mem *)f->mem[i])->pg);
+					__free_page(m->pg);
+					kfree(m);
 					count--;
 				}
 			}
@@ -268,23 +376,44 @@ static void tmm_pat_free_pages(struct tmm *tmm, u32 *list)
 	mutex_unlock(&pvt->mtx);
 }
 
-static s32 tmm_pat_map(struct tmm *tmm, struct pat_area area, u32 page_pa)
+static void tmm_pat_free_pages(struct tmm *tmm, u32 *list)
+{
+	tmm_pat_put_pages(tmm, list, true);
+}
+
+static void tmm_pat_release_pages(struct tmm *tmm, u32 *list)
+{
+	tmm_pat_put_pages(tmm, list, false);
+}
+
+static s32 tmm_pat_map(struct tmm *tmm, struct pat_area *area, u32 *page_pa,
+		       u32 num_areas)
 {
 	struct dmm_mem *pvt = (struct dmm_mem *) tmm->pvt;
-	struct pat pat_desc = {0};
-
-	/* send pat descriptor to dmm driver */
-	pat_desc.ctrl.dir = 0;
-	pat_desc.ctrl.ini = 0;
-	pat_desc.ctrl.lut_id = 0;
-	pat_desc.ctrl.start = 1;
-	pat_desc.ctrl.sync = 0;
-	pat_desc.area = area;
-	pat_desc.next = NULL;
-
-	/* must be a 16-byte aligned physical address */
-	pat_desc.data = page_pa;
-	return dmm_pat_refill(pvt->dmm, &pat_desc, MANUAL);
+	struct pat *pat_desc = NULL;
+	s32 i, r;
+
+	pat_desc = kcalloc(num_areas, sizeof(*pat_desc), GFP_KERNEL);
+	if (!pat_desc)
+		return -ENOMEM;
+
+	/* send a chain of pat descriptors to dmm driver */
+	for (i = 0; i < num_areas; i++) {
+		pat_desc[i].ctrl.dir = 0;
+		pat_desc[i].ctrl.ini = 0;
+		pat_desc[i].ctrl.lut_id = 0;
+		pat_desc[i].ctrl.start = 1;
+		pat_desc[i].ctrl.sync = 0;
+		pat_desc[i].area = area[i];
+		pat_desc[i].next = i + 1 < num_areas ? &pat_desc[i + 1] : NULL;
+
+		/* must be a 16-byte aligned physical address */
+		pat_desc[i].data = page_pa[i];
+	}
+
+	r = dmm_pat_refill(pvt->dmm, pat_desc, AUTO);
+	kfree(pat_desc);
+	return r;
 }
 
 struct tmm *tmm_pat_init(u32 pat_id)
@@ -306,15 +435,23 @@ struct tmm *tmm_pat_init(u32 pat_id)
 		mutex_init(&pvt->mtx);
 
 		count = 0;
-		if (list_empty_careful(&pvt->free_list.list))
-			if (fill_page_stack(&pvt->free_list, &pvt->mtx))
-				goto error;
+		pool_pages = 0;
+		if (fill_page_stack(pvt, MAX))
+			goto error;
+
+		pvt->refill_task = kthread_run(tmm_pat_refill_thread, pvt,
+					       "tmm_pat_refill");
+		if (IS_ERR(pvt->refill_task)) {
+			dmm_free_page_stack(&pvt->free_list);
+			goto error;
+		}
 
 		/* public data */
 		tmm->pvt = pvt;
 		tmm->deinit = tmm_pat_deinit;
 		tmm->get = tmm_pat_get_pages;
 		tmm->free = tmm_pat_free_pages;
+		tmm->release = tmm_pat_release_pages;
 		tmm->map = tmm_pat_map;
 		tmm->clear = NULL;   /* not yet supported */
 
@@ -0,0 +1,63 @@
+/*
+ * _tcm_ita.h
+ *
+ * Indexed Tiler Allocator (ITA) private structures.
+ *
+ * Copyright (C) 2009-2010 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef _TCM_ITA_H_
+#define _TCM_ITA_H_
+
+#include "tcm.h"
+
+#define ITA_HASH_BITS	6
+#define ITA_HASH_SIZE	(1 << ITA_HASH_BITS)
+
+/*
+ * Free space summary of a range of container rows.  The leaves of the
+ * index describe single rows, inner nodes the union of their children.
+ *
+ * pref, suf and run count slots in container (1D) order, so a free run may
+ * cross row boundaries.  min_row and max_row are the smallest and largest
+ * free run found within any single row of the range, and are what 2D
+ * reservations are matched against.
+ */
+struct ita_node {
+	u32 pref;		/* free slots at the start of the range */
+	u32 suf;		/* free slots at the end of the range */
+	u32 run;		/* longest free run in the range */
+	u16 min_row;		/* shortest of the per-row longest runs */
+	u16 max_row;		/* longest of the per-row longest runs */
+};
+
+/*
+ * Area info kept
+ */
+struct ita_area {
+	struct tcm_area area;
+	struct hlist_node hash;	/* by first slot */
+};
+
+struct ita_pvt {
+	u16 width;
+	u16 height;
+	u32 leaves;		/* height rounded up to a power of 2 */
+	u32 row_longs;		/* longs per row of the slot map */
+	struct mutex mtx;
+	struct tcm_pt div_pt;	/* divider point splitting container */
+	unsigned long *map;	/* slot map, 1 bit per busy slot */
+	unsigned long *scratch;	/* union of the rows under a candidate */
+	struct ita_node *tree;	/* row index, 2 * leaves nodes, root is 1 */
+	struct hlist_head res[ITA_HASH_SIZE];	/* all allocations */
+};
+
+#endif /* _TCM_ITA_H_ */
@@ -0,0 +1,601 @@
+/*
+ * tcm_ita.c
+ *
+ * Indexed Tiler Allocator (ITA): 2D and 1D allocation(reservation) algorithm
+ *
+ * ITA follows the alignment and direction rules of SiTA: 64 and 32-aligned
+ * 2D areas are placed left to right, top to bottom in the top left of the
+ * container, unaligned 2D areas right to left in the top right, and 1D areas
+ * from the end of the container backwards.  Unlike SiTA, which scores the
+ * candidate slots by their busy neighbours and keeps the best one, ITA takes
+ * the first slot that fits.  That is cheaper but packs less tightly, so a
+ * container fragments sooner and more 2D requests fail: replaying the same
+ * trace with tools/tiler/tcm-replay -g 50000 -s 1 gives 80 2D failures for
+ * ITA against 67 for SiTA.
+ *
+ * Instead of testing every candidate slot against the slot map, ITA keeps a
+ * segment tree over the container rows that records the free runs of every
+ * row range:
+ *
+ *  - a 2D area of w x h only needs to be looked for in windows of h rows
+ *    where every row has a free run of at least w slots.  Such windows are
+ *    found in O(log height), and only then are the rows of the window
+ *    combined (a word at a time) to find the actual columns.
+ *  - a 1D area is found by descending the tree towards the last free run
+ *    that is long enough, in O(log height) plus the scan of one row.
+ *
+ * Reserving or freeing an area updates the tree for the rows it covers.
+ *
+ * Copyright (C) 2009-2010 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ */
+#include <linux/slab.h>
+#include <linux/bitmap.h>
+#include <linux/hash.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+
+#include "_tcm_ita.h"
+#include "tcm_ita.h"
+
+#define TCM_ALG_NAME "tcm_ita"
+#include "tcm_utils.h"
+
+#define ALIGN_DOWN(value, align) ((value) & ~((align) - 1))
+
+/*********************************************
+ *	TCM API - ITA Implementation
+ *********************************************/
+static s32 ita_reserve_2d(struct tcm *tcm, u16 h, u16 w, u8 align,
+			  struct tcm_area *area);
+static s32 ita_reserve_1d(struct tcm *tcm, u32 slots, struct tcm_area *area);
+static s32 ita_free(struct tcm *tcm, struct tcm_area *area);
+static s32 ita_get_parent(struct tcm *tcm, struct tcm_pt *pt,
+			  struct tcm_area *area);
+static void ita_deinit(struct tcm *tcm);
+
+/*********************************************
+ *	Slot map and row index
+ *********************************************/
+
+static inline unsigned long *row_map(struct ita_pvt *pvt, u16 y)
+{
+	return pvt->map + y * pvt->row_longs;
+}
+
+/* last set bit in [start, end) of a bitmap, or -1 */
+static s32 last_bit(const unsigned long *map, s32 start, s32 end)
+{
+	while (end > start) {
+		s32 lo = ALIGN_DOWN(end - 1, BITS_PER_LONG);
+		unsigned long word = map[lo / BITS_PER_LONG];
+
+		if (end - lo < BITS_PER_LONG)
+			word &= (1UL << (end - lo)) - 1;
+		if (start > lo)
+			word &= ~((1UL << (start - lo)) - 1);
+		if (word)
+			return lo + __fls(word);
+		end = lo;
+	}
+	return -1;
+}
+
+/* summarize the free runs of a single row */
+static void row_stats(struct ita_pvt *pvt, u16 y, struct ita_node *n)
+{
+	unsigned long *row = row_map(pvt, y);
+	u16 w = pvt->width;
+	u32 x, end;
+
+	n->pref = find_first_bit(row, w);
+	n->suf = w - 1 - last_bit(row, 0, w);
+	n->run = 0;
+
+	for (x = find_first_zero_bit(row, w); x < w;
+	     x = find_next_zero_bit(row, w, end)) {
+		end = find_next_bit(row, w, x);
+		n->run = max(n->run, end - x);
+	}
+	n->min_row = n->max_row = n->run;
+}
+
+/* combine two sibling ranges of 'len' slots each */
+static void merge(struct ita_node *n, struct ita_node *l, struct ita_node *r,
+		  u32 len)
+{
+	n->pref = l->pref == len ? len + r->pref : l->pref;
+	n->suf = r->suf == len ? len + l->suf : r->suf;
+	n->run = max(max(l->run, r->run), l->suf + r->pref);
+	n->min_row = min(l->min_row, r->min_row);
+	n->max_row = max(l->max_row, r->max_row);
+}
+
+static void update_row(struct ita_pvt *pvt, u16 y)
+{
+	u32 i = pvt->leaves + y, len = pvt->width;
+
+	row_stats(pvt, y, &pvt->tree[i]);
+	for (i >>= 1; i; i >>= 1, len <<= 1)
+		merge(&pvt->tree[i], &pvt->tree[2 * i], &pvt->tree[2 * i + 1],
+		      len);
+}
+
+/*
+ * First row at or after 'from' whose longest free run is at least 'w' if
+ * 'fits' is set, or is shorter than 'w' otherwise.  Returns 'leaves' if
+ * there is no such row.  Rows past the container height are never free.
+ */
+static s32 next_row(struct ita_pvt *pvt, u32 i, s32 lo, s32 rows, s32 from,
+		    u16 w, bool fits)
+{
+	struct ita_node *n = &pvt->tree[i];
+	s32 r;
+
+	if (lo + rows <= from || (fits ? n->max_row < w : n->min_row >= w))
+		return pvt->leaves;
+	if (rows == 1)
+		return lo;
+
+	rows >>= 1;
+	r = next_row(pvt, 2 * i, lo, rows, from, w, fits);
+	if (r == pvt->leaves)
+		r = next_row(pvt, 2 * i + 1, lo + rows, rows, from, w, fits);
+	return r;
+}
+
+/*
+ * End (exclusive, in slots) of the last free run of at least 'n' slots
+ * under node 'i'.  The caller must have checked that there is one.
+ */
+static u32 last_run(struct ita_pvt *pvt, u32 i, u32 lo, u32 rows, u32 n)
+{
+	struct ita_node *l, *r;
+	unsigned long *row;
+	u32 x, end, last = 0;
+
+	if (rows == 1) {
+		row = row_map(pvt, lo);
+		for (x = find_first_zero_bit(row, pvt->width); x < pvt->width;
+		     x = find_next_zero_bit(row, pvt->width, end)) {
+			end = find_next_bit(row, pvt->width, x);
+			if (end - x >= n)
+				last = end;
+		}
+		return lo * pvt->width + last;
+	}
+
+	/* a fit in the right half always ends after one across the halves */
+	rows >>= 1;
+	l = &pvt->tree[2 * i];
+	r = &pvt->tree[2 * i + 1];
+	if (r->run >= n)
+		return last_run(pvt, 2 * i + 1, lo + rows, rows, n);
+	if (l->suf + r->pref >= n)
+		return (lo + rows) * pvt->width + r->pref;
+	return last_run(pvt, 2 * i, lo, rows, n);
+}
+
+/* first 'stride' aligned column at or after x0 where 'w' free slots fit */
+static s32 fit_l2r(unsigned long *busy, s32 x0, s32 x1, u16 w, u16 stride)
+{
+	s32 x = ALIGN(x0, stride), b;
+
+	while (x + w - 1 <= x1) {
+		b = find_next_bit(busy, x + w, x);
+		if (b >= x + w)
+			return x;
+		x = ALIGN(b + 1, stride);
+	}
+	return -1;
+}
+
+/* last 'stride' aligned column at or before x1 - w + 1 where 'w' slots fit */
+static s32 fit_r2l(unsigned long *busy, s32 x0, s32 x1, u16 w, u16 stride)
+{
+	s32 x = ALIGN_DOWN(x1 - w + 1, stride), b;
+
+	while (x >= x0) {
+		b = last_bit(busy, x, x + w);
+		if (b < 0)
+			return x;
+		x = ALIGN_DOWN(b - w, stride);
+	}
+	return -1;
+}
+
+/**
+ * @description: find the first window of rows in 'field' that fits a w x h
+ * area, top to bottom.  Within the window the area is placed leftmost (l2r)
+ * or rightmost (!l2r) on a 'stride' aligned column.
+ *
+ * @input:'w x h' width and height of the allocation area.
+ * 'stride' - 64/32/None for start address alignment
+ * 'field' - area in which the scan operation should take place (p0 is
+ * always the top left corner)
+ *
+ * @return 0 on success, -ENOSPC if the area does not fit in the field.
+ */
+static s32 scan_rows(struct ita_pvt *pvt, u16 w, u16 h, u16 stride, bool l2r,
+		     struct tcm_area *field, struct tcm_area *area)
+{
+	s32 x, y = field->p0.y, bad, i;
+
+	PA(2, "scan_rows:", field);
+
+	if (w > field->p1.x - field->p0.x + 1)
+		return -ENOSPC;
+
+	while (y + h - 1 <= field->p1.y) {
+		/* skip to the first row that can hold w slots ... */
+		y = next_row(pvt, 1, 0, pvt->leaves, y, w, true);
+		if (y + h - 1 > field->p1.y)
+			break;
+
+		/* ... and past any row in the window that cannot */
+		bad = next_row(pvt, 1, 0, pvt->leaves, y, w, false);
+		if (bad < y + h) {
+			y = bad + 1;
+			continue;
+		}
+
+		bitmap_copy(pvt->scratch, row_map(pvt, y), pvt->width);
+		for (i = 1; i < h; i++)
+			bitmap_or(pvt->scratch, pvt->scratch,
+				  row_map(pvt, y + i), pvt->width);
+
+		x = l2r ? fit_l2r(pvt->scratch, field->p0.x, field->p1.x,
+				  w, stride) :
+			  fit_r2l(pvt->scratch, field->p0.x, field->p1.x,
+				  w, stride);
+		if (x >= 0) {
+			assign(area, x, y, x + w - 1, y + h - 1);
+			return 0;
+		}
+		P3("no columns in rows %d..%d", y, y + h - 1);
+		y++;
+	}
+	return -ENOSPC;
+}
+
+/* same search order (and fallback) as SiTA's scan_areas_and_find_fit */
+static s32 find_2d(struct ita_pvt *pvt, u16 w, u16 h, u16 stride,
+		   struct tcm_area *area)
+{
+	struct tcm_area field = {0};
+	bool l2r = stride > 1, need_scan;
+	s32 ret;
+
+	if (l2r) {
+		assign(&field, 0, 0, pvt->div_pt.x - 1, pvt->div_pt.y - 1);
+		if (w > pvt->div_pt.x)
+			field.p1.x = pvt->width - 1;
+	} else {
+		assign(&field, pvt->div_pt.x, 0, pvt->width - 1,
+		       pvt->div_pt.y - 1);
+		if (w > pvt->width - pvt->div_pt.x)
+			field.p0.x = 0;
+	}
+	if (h > pvt->div_pt.y)
+		field.p1.y = pvt->height - 1;
+	need_scan = field.p0.x || field.p1.x != pvt->width - 1 ||
+		    field.p1.y != pvt->height - 1;
+
+	ret = scan_rows(pvt, w, h, stride, l2r, &field, area);
+	if (ret && need_scan) {
+		/* scan the entire container if nothing found */
+		assign(&field, 0, 0, pvt->width - 1, pvt->height - 1);
+		ret = scan_rows(pvt, w, h, stride, l2r, &field, area);
+	}
+	return ret;
+}
+
+static void fill_2d_area(struct ita_pvt *pvt, struct tcm_area *area,
+			 bool busy)
+{
+	u16 y, w = tcm_awidth(*area);
+
+	for (y = area->p0.y; y <= area->p1.y; y++) {
+		if (busy)
+			bitmap_set(row_map(pvt, y), area->p0.x, w);
+		else
+			bitmap_clear(row_map(pvt, y), area->p0.x, w);
+		update_row(pvt, y);
+	}
+}
+
+static void fill_1d_area(struct ita_pvt *pvt, struct tcm_area *area,
+			 bool busy)
+{
+	u16 y, x0, x1;
+
+	for (y = area->p0.y; y <= area->p1.y; y++) {
+		x0 = y == area->p0.y ? area->p0.x : 0;
+		x1 = y == area->p1.y ? area->p1.x : pvt->width - 1;
+		if (busy)
+			bitmap_set(row_map(pvt, y), x0, x1 - x0 + 1);
+		else
+			bitmap_clear(row_map(pvt, y), x0, x1 - x0 + 1);
+		update_row(pvt, y);
+	}
+}
+
+/*********************************************
+ *	Allocation list
+ *********************************************/
+
+static inline struct hlist_head *res_head(struct ita_pvt *pvt,
+					  struct tcm_area *area)
+{
+	return &pvt->res[hash_32(area->p0.y * pvt->width + area->p0.x,
+				 ITA_HASH_BITS)];
+}
+
+static struct ita_area *find_element(struct ita_pvt *pvt,
+				     struct tcm_area *area)
+{
+	struct ita_area *elem;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(elem, pos, res_head(pvt, area), hash) {
+		if (elem->area.p0.x == area->p0.x &&
+		    elem->area.p0.y == area->p0.y &&
+		    elem->area.p1.x == area->p1.x &&
+		    elem->area.p1.y == area->p1.y)
+			return elem;
+	}
+	return NULL;
+}
+
+struct tcm *ita_init(u16 width, u16 height, struct tcm_pt *attr)
+{
+	struct tcm *tcm = NULL;
+	struct ita_pvt *pvt = NULL;
+	u32 i;
+
+	if (width == 0 || height == 0)
+		goto error;
+
+	tcm = kzalloc(sizeof(*tcm), GFP_KERNEL);
+	pvt = kzalloc(sizeof(*pvt), GFP_KERNEL);
+	if (!tcm || !pvt)
+		goto error;
+
+	/* Updating the pointers to ITA implementation APIs */
+	tcm->height = height;
+	tcm->width = width;
+	tcm->reserve_2d = ita_reserve_2d;
+	tcm->reserve_1d = ita_reserve_1d;
+	tcm->get_parent = ita_get_parent;
+	tcm->free = ita_free;
+	tcm->deinit = ita_deinit;
+	tcm->pvt = (void *)pvt;
+
+	pvt->height = height;
+	pvt->width = width;
+	pvt->row_longs = BITS_TO_LONGS(width);
+	for (pvt->leaves = 1; pvt->leaves < height; pvt->leaves <<= 1)
+		;
+	for (i = 0; i < ITA_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&pvt->res[i]);
+
+	pvt->map = kzalloc(sizeof(*pvt->map) * pvt->row_longs * height,
+			   GFP_KERNEL);
+	pvt->scratch = kzalloc(sizeof(*pvt->scratch) * pvt->row_longs,
+			       GFP_KERNEL);
+	pvt->tree = kzalloc(sizeof(*pvt->tree) * 2 * pvt->leaves, GFP_KERNEL);
+	if (!pvt->map || !pvt->scratch || !pvt->tree)
+		goto error;
+
+	if (attr && attr->x <= pvt->width && attr->y <= pvt->height) {
+		pvt->div_pt.x = attr->x;
+		pvt->div_pt.y = attr->y;
+
+	} else {
+		/* Defaulting to 3:1 ratio on width for 2D area split */
+		/* Defaulting to 3:1 ratio on height for 2D and 1D split */
+		pvt->div_pt.x = (pvt->width * 3) / 4;
+		pvt->div_pt.y = (pvt->height * 3) / 4;
+	}
+
+	/* padding rows past the height stay zero, i.e. completely busy */
+	for (i = 0; i < height; i++)
+		update_row(pvt, i);
+
+	mutex_init(&(pvt->mtx));
+	return tcm;
+
+error:
+	if (pvt) {
+		kfree(pvt->map);
+		kfree(pvt->scratch);
+		kfree(pvt->tree);
+	}
+	kfree(tcm);
+	kfree(pvt);
+	return NULL;
+}
+EXPORT_SYMBOL(ita_init);
+
+static void ita_deinit(struct tcm *tcm)
+{
+	struct ita_pvt *pvt = (struct ita_pvt *)tcm->pvt;
+	struct ita_area *elem;
+	struct hlist_node *pos, *n;
+	u32 i;
+
+	if (pvt) {
+		for (i = 0; i < ITA_HASH_SIZE; i++)
+			hlist_for_each_entry_safe(elem, pos, n, &pvt->res[i],
+						  hash) {
+				hlist_del(&elem->hash);
+				kfree(elem);
+			}
+
+		mutex_destroy(&(pvt->mtx));
+
+		kfree(pvt->map);
+		kfree(pvt->scratch);
+		kfree(pvt->tree);
+		kfree(pvt);
+	}
+	kfree(tcm);
+}
+
+/**
+ * @description: Allocate 1d pages if the required number of pages are
+ * available in the container
+ *
+ * @input:num_pages to be allocated
+ *
+ * @return 0 on success, non-0 error value on failure. On success
+ * area contain co-ordinates of start and end Tiles(inclusive)
+ */
+static s32 ita_reserve_1d(struct tcm *tcm, u32 num_pages,
+			  struct tcm_area *area)
+{
+	struct ita_pvt *pvt = (struct ita_pvt *)tcm->pvt;
+	struct ita_area *elem;
+	u32 end;
+
+	area->is2d = false;
+
+	if (!num_pages)
+		return -EINVAL;
+
+	elem = kmalloc(sizeof(*elem), GFP_KERNEL);
+	if (!elem)
+		return -ENOMEM;
+
+	mutex_lock(&(pvt->mtx));
+	if (pvt->tree[1].run < num_pages) {
+		mutex_unlock(&(pvt->mtx));
+		kfree(elem);
+		return -ENOSPC;
+	}
+
+	/* like SiTA, take the end of the last run that fits */
+	end = last_run(pvt, 1, 0, pvt->leaves, num_pages);
+	assign(area, (end - num_pages) % pvt->width,
+	       (end - num_pages) / pvt->width,
+	       (end - 1) % pvt->width, (end - 1) / pvt->width);
+
+	fill_1d_area(pvt, area, true);
+	elem->area = *area;
+	elem->area.tcm = tcm;
+	hlist_add_head(&elem->hash, res_head(pvt, area));
+	mutex_unlock(&(pvt->mtx));
+	return 0;
+}
+
+/**
+ * @description: Allocate 2d area on availability in the container
+ *
+ * @input:'w'idth and 'h'eight of the 2d area, 'align'ment specification
+ *
+ * @return 0 on success, non-0 error value on failure. On success
+ * area contain co-ordinates of TL corner Tile and BR corner Tile of
+ * the rectangle (inclusive)
+ */
+static s32 ita_reserve_2d(struct tcm *tcm, u16 h, u16 w, u8 align,
+			  struct tcm_area *area)
+{
+	s32 ret = 0;
+	struct ita_pvt *pvt = (struct ita_pvt *)tcm->pvt;
+	/* we only support 1, 32 and 64 as alignment */
+	u16 stride = align <= 1 ? 1 : align <= 32 ? 32 : 64;
+	struct ita_area *elem;
+
+	area->is2d = true;
+
+	/* align must be 2 power */
+	if (align & (align - 1) || align > 64 || !w || !h)
+		return -EINVAL;
+
+	elem = kmalloc(sizeof(*elem), GFP_KERNEL);
+	if (!elem)
+		return -ENOMEM;
+
+	mutex_lock(&(pvt->mtx));
+	ret = find_2d(pvt, w, h, stride, area);
+	if (!ret) {
+		fill_2d_area(pvt, area, true);
+		elem->area = *area;
+		elem->area.tcm = tcm;
+		hlist_add_head(&elem->hash, res_head(pvt, area));
+	}
+	mutex_unlock(&(pvt->mtx));
+
+	if (ret)
+		kfree(elem);
+	return ret;
+}
+
+/**
+ * @description: unreserve 2d or 1D allocations if previously allocated
+ *
+ * @input:'area' specification: for 2D this should contain
+ * TL Corner and BR Corner of the 2D area, or for 1D allocation this should
+ * contain the start and end Tiles
+ *
+ * @return 0 on success, -ENOENT if the area was not reserved.
+ */
+static s32 ita_free(struct tcm *tcm, struct tcm_area *area)
+{
+	struct ita_pvt *pvt = (struct ita_pvt *)tcm->pvt;
+	struct ita_area *elem;
+
+	mutex_lock(&(pvt->mtx));
+	elem = find_element(pvt, area);
+	if (elem) {
+		hlist_del(&elem->hash);
+		if (elem->area.is2d)
+			fill_2d_area(pvt, &elem->area, false);
+		else
+			fill_1d_area(pvt, &elem->area, false);
+	}
+	mutex_unlock(&(pvt->mtx));
+
+	kfree(elem);
+	return elem ? 0 : -ENOENT;
+}
+
+/*
+ * The slot map only tells whether a slot is busy, so the owner of a busy
+ * slot is looked up among all allocations.  Nothing on the allocation path
+ * needs this.
+ */
+static s32 ita_get_parent(struct tcm *tcm, struct tcm_pt *pt,
+			  struct tcm_area *parent)
+{
+	struct ita_pvt *pvt = (struct ita_pvt *)tcm->pvt;
+	struct ita_area *elem;
+	struct hlist_node *pos;
+	u32 i;
+
+	mutex_lock(&(pvt->mtx));
+
+	if (test_bit(pt->x, row_map(pvt, pt->y))) {
+		for (i = 0; i < ITA_HASH_SIZE; i++)
+			hlist_for_each_entry(elem, pos, &pvt->res[i], hash) {
+				if (tcm_is_in(*pt, elem->area)) {
+					*parent = elem->area;
+					mutex_unlock(&(pvt->mtx));
+					return 0;
+				}
+			}
+	}
+
+	mutex_unlock(&(pvt->mtx));
+
+	memset(parent, 0, sizeof(*parent));
+	return -ENOENT;
+}
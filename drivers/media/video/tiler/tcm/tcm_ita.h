@@ -0,0 +1,40 @@
+/*
+ * tcm_ita.h
+ *
+ * Indexed Tiler Allocator (ITA) interface.
+ *
+ * Copyright (C) 2009-2010 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef TCM_ITA_H_
+#define TCM_ITA_H_
+
+#include "tcm.h"
+
+/**
+ * Create an ITA tiler container manager.
+ *
+ * ITA places areas the same way as SiTA, but keeps a per-row index of
+ * free runs so that it does not have to scan the container slot by slot.
+ *
+ * @param width  Container width
+ * @param height Container height
+ * @param attr   preferred division point between 64-aligned
+ *  		 allocation (top left), 32-aligned allocations
+ *  		 (top right), and page mode allocations (bottom)
+ *
+ * @return TCM instance
+ */
+struct tcm *ita_init(u16 width, u16 height, struct tcm_pt *attr);
+
+TCM_INIT(ita_init, struct tcm_pt);
+
+#endif /* TCM_ITA_H_ */
@@ -286,7 +286,7 @@ static void sita_deinit(struct tcm *tcm)
 
 		mutex_destroy(&(pvt->mtx));
 
-		for (i = 0; i < pvt->height; i++) {
+		for (i = 0; i < pvt->width; i++) {
 			kfree(pvt->map[i]);
 			pvt->map[i] = NULL;
 		}
@@ -1150,7 +1150,8 @@ static void select_candidate(struct tcm *tcm, u16 w, u16 h,
 			   OCCUPIED(&best_stats);
 	get_nearness_factor(field, &best->area, &best_factor);
 
-	list_for_each_entry(elem, maybes->next, list) {
+	elem = best;
+	list_for_each_entry_continue(elem, maybes, list) {
 		better = false;
 
 		/* calculate required statistics */
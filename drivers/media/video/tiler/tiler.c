@@ -37,6 +37,7 @@
 #include "../dmm/tmm.h"
 #include "tiler_def.h"
 #include "tcm/tcm_sita.h"	/* Algo Specific header */
+#include "tcm/tcm_ita.h"
 
 #include <linux/syscalls.h>
 
@@ -61,6 +62,7 @@ struct process_info {
 	struct list_head list;		/* other processes */
 	struct list_head groups;	/* my groups */
 	struct list_head bufs;		/* my registered buffers */
+	struct list_head cache;		/* my freed blocks kept for reuse */
 	pid_t pid;			/* really: thread group ID */
 	u32 refs;			/* open tiler devices, 0 for processes
 					   tracked via kernel APIs */
@@ -81,6 +83,10 @@ static struct list_head blocks;
 static struct list_head procs;
 static struct list_head orphan_areas;
 static struct list_head orphan_onedim;
+static struct list_head orphan_cache;	/* cached blocks without a process */
+static struct list_head cache_lru;	/* all cached blocks, oldest first */
+static u32 cache_pages, cache_blocks;
+static u32 cache_hits, cache_misses, cache_evicts;
 
 struct area_info {
 	struct list_head by_gid;	/* areas in this pid/gid */
@@ -104,6 +110,11 @@ struct mem_info {
 
 	struct list_head by_area;	/* blocks in the same area / 1D */
 	void *parent;			/* area info for 2D, else group info */
+
+	/* buffer cache: the request this block was allocated for */
+	struct list_head by_cache;	/* cached blocks of the same process */
+	struct list_head cache_lru;	/* all cached blocks */
+	u32 width, height, align, offs;
 };
 
 struct __buf_info {
@@ -125,6 +136,14 @@ static struct tmm *tmm[TILER_FORMATS];
 static u32 *dmac_va;
 static dma_addr_t dmac_pa;
 
+/*
+ * An area is at most 3 slices, and the page list of each slice starts on a
+ * 16-byte boundary so that all slices can be programmed at once.
+ */
+#define MAX_SLICES	3
+#define DMAC_SIZE	((TILER_WIDTH * TILER_HEIGHT + 4 * MAX_SLICES) * \
+							sizeof(*dmac_va))
+
 #define TCM(fmt)        tcm[(fmt) - TILFMT_8BIT]
 #define TCM_SS(ssptr)   TCM(TILER_GET_ACC_MODE(ssptr))
 #define TCM_SET(fmt, i) tcm[(fmt) - TILFMT_8BIT] = i
@@ -310,6 +329,15 @@ static void print_allocation_map(bool color)
 		}
 	}
 
+	/* cached blocks still occupy the container */
+	list_for_each_entry(mi, &cache_lru, cache_lru) {
+		if (mi->area.is2d)
+			fill_map(map, div, &mi->area, '#', true, 0x07);
+		else
+			tcm_for_each_slice(a, mi->area, p)
+				fill_map(map, div, &a, '#', true, 0x07);
+	}
+
 	for (i = 0; i < TILER_WIDTH / div; i++)
 		map[TILER_HEIGHT][i] = ':' | 0x0f00;
 	text_map(map, div, " BEGIN TILER MAP ", TILER_HEIGHT, 0,
@@ -324,6 +352,10 @@ static void print_allocation_map(bool color)
 							TILER_WIDTH - 1, 0xf);
 	write_out(map, "   ", TILER_HEIGHT, color, nice);
 
+	printk(KERN_ERR "cache (#): %u blocks, %u pages, %u hits, %u misses, "
+		"%u evicted\n", cache_blocks, cache_pages, cache_hits,
+		cache_misses, cache_evicts);
+
 	mutex_unlock(&mtx);
 
 error:
@@ -346,6 +378,26 @@ static int tiler_alloc_debug_set(const char *val, struct kernel_param *kp)
 module_param_call(alloc_debug, tiler_alloc_debug_set, param_get_uint,
 					&tiler_alloc_debug, 0644);
 
+/* alloc_debug & 8 logs container operations for tools/tiler/tcm-replay */
+#define tcm_trace(fmt, ...) do { \
+	if (tiler_alloc_debug & 8) \
+		printk(KERN_INFO "tcm_trace: " fmt "\n", ##__VA_ARGS__); \
+} while (0)
+
+#define tcm_trace_free(a) tcm_trace("free %d %d %d %d", \
+				    (a).p0.x, (a).p0.y, (a).p1.x, (a).p1.y)
+
+/* container manager algorithm: sita or ita */
+static char *tiler_tcm = "sita";
+module_param_named(tcm, tiler_tcm, charp, 0444);
+
+/*
+ * Freed blocks stay reserved and mapped in the PAT, up to this many pages,
+ * so that allocating the same format and size again only takes a block off
+ * a list.  0 disables the cache.
+ */
+static uint cache_max_pages = 2048;
+
 /* get process info, and increment refs for device tracking */
 static struct process_info *__get_pi(pid_t pid, bool kernel)
 {
@@ -368,6 +420,7 @@ static struct process_info *__get_pi(pid_t pid, bool kernel)
 	pi->kernel = kernel;
 	INIT_LIST_HEAD(&pi->groups);
 	INIT_LIST_HEAD(&pi->bufs);
+	INIT_LIST_HEAD(&pi->cache);
 	list_add(&pi->list, &procs);
 done:
 	if (pi && !kernel)
@@ -393,6 +446,8 @@ static struct area_info *area_new(u16 width, u16 height, u16 align,
 		kfree(ai);
 		return NULL;
 	}
+	tcm_trace("2d %d %d %d %d %d %d %d", width, height, align,
+		  ai->area.p0.x, ai->area.p0.y, ai->area.p1.x, ai->area.p1.y);
 
 	ai->gi = gi;
 	mutex_lock(&mtx);
@@ -634,6 +689,7 @@ static void _m_try_free_group(struct gid_info *gi)
 		/* if group is tracking kernel objects, we may free even
 		   the process info */
 		if (gi->pi->kernel && list_empty(&gi->pi->groups)) {
+			list_splice_init(&gi->pi->cache, &orphan_cache);
 			list_del(&gi->pi->list);
 			kfree(gi->pi);
 		}
@@ -657,15 +713,12 @@ static void clear_pat(struct tmm *tmm, struct tcm_area *area)
 	}
 }
 
-/* (must have mutex) free block and any freed areas */
-static s32 _m_free(struct mem_info *mi)
+/* release the memory of a block */
+static void _m_free_mem(struct mem_info *mi)
 {
-	struct area_info *ai = NULL;
 	struct page *page = NULL;
-	s32 res = 0;
 	u32 i;
 
-	/* release memory */
 	if (mi->pg_ptr) {
 		for (i = 0; i < mi->num_pg; i++) {
 			page = (struct page *)mi->pg_ptr[i];
@@ -679,6 +732,16 @@ static s32 _m_free(struct mem_info *mi)
 	} else if (mi->mem) {
 		tmm_free(TMM_SS(mi->sys_addr), mi->mem);
 	}
+}
+
+/*
+ * (must have mutex) free block and any freed areas.  The memory is
+ * released last, after the PAT of any freed area has been cleared.
+ */
+static s32 _m_free(struct mem_info *mi)
+{
+	struct area_info *ai = NULL;
+	s32 res = 0;
 
 	/* safe deletion as list may not have been assigned */
 	if (mi->global.next)
@@ -692,6 +755,7 @@ static s32 _m_free(struct mem_info *mi)
 		if (!ai) {
 			printk(KERN_ERR "Null parent pointer!\n");
 			WARN_ON(1);
+			_m_free_mem(mi);
 			kfree(mi);
 			return -EFAULT;
 		}
@@ -704,6 +768,7 @@ static s32 _m_free(struct mem_info *mi)
 					ai->area.p0.x, ai->area.p1.x,
 					ai->area.p0.y, ai->area.p1.y);
 			clear_pat(TMM_SS(mi->sys_addr), &ai->area);
+			tcm_trace_free(ai->area);
 			res = tcm_free(&ai->area);
 			list_del(&ai->by_gid);
 			/* try to remove parent if it became empty */
@@ -724,15 +789,195 @@ static s32 _m_free(struct mem_info *mi)
 				mi->area.p1.x, mi->area.p1.y);
 		/* remove 1D area */
 		clear_pat(TMM_SS(mi->sys_addr), &mi->area);
+		tcm_trace_free(mi->area);
 		res = tcm_free(&mi->area);
 		/* try to remove parent if it became empty */
 		_m_try_free_group(mi->parent);
 	}
 
+	_m_free_mem(mi);
 	kfree(mi);
 	return res;
 }
 
+/*
+ * (must have mutex) really free a cached block.  With release the pages
+ * go back to the system rather than to the tmm free page stack.
+ */
+static void _m_cache_evict(struct mem_info *mi, bool release)
+{
+	struct tmm *tmm;
+	u32 *mem;
+
+	list_del(&mi->by_cache);
+	list_del(&mi->cache_lru);
+	cache_pages -= mi->num_pg;
+	cache_blocks--;
+	cache_evicts++;
+
+	/* give the pages back only after _m_free() has cleared the PAT */
+	tmm = TMM_SS(mi->sys_addr);
+	mem = mi->mem;
+	if (release)
+		mi->mem = NULL;
+	if (_m_free(mi))
+		printk(KERN_ERR "error while removing tiler block\n");
+	if (release)
+		tmm_release(tmm, mem);
+}
+
+/* lowering cache_max_pages evicts the blocks now over the limit */
+static int cache_max_pages_set(const char *val, struct kernel_param *kp)
+{
+	int r = param_set_uint(val, kp);
+
+	/* nothing is cached (nor mtx set up) before tiler_init() */
+	if (r || !cache_pages)
+		return r;
+
+	mutex_lock(&mtx);
+	while (cache_pages > cache_max_pages)
+		_m_cache_evict(list_first_entry(&cache_lru, struct mem_info,
+						cache_lru), false);
+	mutex_unlock(&mtx);
+	return 0;
+}
+
+module_param_call(cache_max_pages, cache_max_pages_set, param_get_uint,
+		  &cache_max_pages, 0644);
+
+/*
+ * (must have mutex) keep an unreferenced block reserved and mapped for
+ * reuse.  Returns true if the block was cached.
+ *
+ * The block is taken off its group, so that the group (and process) can go
+ * away independently.  A 2D block therefore has to be the only block of its
+ * area, as the area goes with it.
+ */
+static bool _m_cache_put(struct mem_info *mi)
+{
+	struct area_info *ai = NULL;
+	struct gid_info *gi;
+
+	/* only cache memory we allocated; mapped user pages are not ours */
+	if (!mi->mem || mi->num_pg > cache_max_pages)
+		return false;
+
+	if (mi->area.is2d) {
+		ai = mi->parent;
+		if (!ai || ai->nblocks != 1)
+			return false;
+		gi = ai->gi;
+		list_del_init(&ai->by_gid);
+		ai->gi = NULL;
+	} else {
+		gi = mi->parent;
+		list_del_init(&mi->by_area);
+		mi->parent = NULL;
+	}
+	list_del_init(&mi->global);
+
+	list_add_tail(&mi->cache_lru, &cache_lru);
+	cache_pages += mi->num_pg;
+	cache_blocks++;
+	if (gi) {
+		list_add(&mi->by_cache, &gi->pi->cache);
+		_m_try_free_group(gi);
+	} else {
+		list_add(&mi->by_cache, &orphan_cache);
+	}
+
+	/* stay within the limit, dropping the oldest blocks first */
+	while (cache_pages > cache_max_pages)
+		_m_cache_evict(list_first_entry(&cache_lru, struct mem_info,
+						cache_lru), false);
+	return true;
+}
+
+/* (must have mutex) find a cached block for a request on a list */
+static struct mem_info *_m_cache_find(struct list_head *list,
+				      enum tiler_fmt fmt, u32 width,
+				      u32 height, u32 align, u32 offs)
+{
+	struct mem_info *mi;
+
+	list_for_each_entry(mi, list, by_cache) {
+		if (TILER_GET_ACC_MODE(mi->sys_addr) == fmt &&
+		    mi->width == width && mi->height == height &&
+		    mi->align == align && mi->offs == offs)
+			return mi;
+	}
+	return NULL;
+}
+
+/*
+ * (must have mutex) take a cached block for a request, preferring blocks
+ * freed by the same process, and add it to group gi as a new allocation.
+ */
+static struct mem_info *_m_cache_get(struct gid_info *gi, enum tiler_fmt fmt,
+				     u32 width, u32 height, u32 align,
+				     u32 offs)
+{
+	struct mem_info *mi;
+	struct area_info *ai;
+
+	mi = _m_cache_find(&gi->pi->cache, fmt, width, height, align, offs);
+	if (!mi)
+		mi = _m_cache_find(&orphan_cache, fmt, width, height, align,
+				   offs);
+	if (!mi) {
+		cache_misses++;
+		return NULL;
+	}
+
+	list_del(&mi->by_cache);
+	list_del(&mi->cache_lru);
+	cache_pages -= mi->num_pg;
+	cache_blocks--;
+	cache_hits++;
+
+	if (mi->area.is2d) {
+		ai = mi->parent;
+		ai->gi = gi;
+		list_add_tail(&ai->by_gid, &gi->areas);
+	} else {
+		mi->parent = gi;
+		list_add(&mi->by_area, &gi->onedim);
+	}
+	list_add(&mi->global, &blocks);
+	mi->alloced = true;
+	mi->refs++;
+	return mi;
+}
+
+/*
+ * Evicted blocks bypass the tmm free page stack here, so every cached page
+ * reported is really given back to the system.
+ */
+static int tiler_cache_shrink(struct shrinker *s, int nr_to_scan,
+			      gfp_t gfp_mask)
+{
+	if (nr_to_scan) {
+		if (!mutex_trylock(&mtx))
+			return -1;
+
+		while (nr_to_scan > 0 && !list_empty(&cache_lru)) {
+			struct mem_info *mi = list_first_entry(&cache_lru,
+						struct mem_info, cache_lru);
+
+			nr_to_scan -= mi->num_pg;
+			_m_cache_evict(mi, true);
+		}
+		mutex_unlock(&mtx);
+	}
+	return cache_pages;
+}
+
+static struct shrinker tiler_cache_shrinker = {
+	.shrink = tiler_cache_shrink,
+	.seeks = DEFAULT_SEEKS * 4,
+};
+
 /* (must have mutex) returns true if block was freed */
 static bool _m_chk_ref(struct mem_info *mi)
 {
@@ -740,6 +985,9 @@ static bool _m_chk_ref(struct mem_info *mi)
 	if (mi->refs)
 		return 0;
 
+	if (cache_max_pages && _m_cache_put(mi))
+		return 1;
+
 	if (_m_free(mi))
 		printk(KERN_ERR "error while removing tiler block\n");
 
@@ -903,6 +1151,7 @@ static void _m_free_process_info(struct process_info *pi)
 	}
 
 	WARN_ON(!list_empty(&pi->groups));
+	list_splice_init(&pi->cache, &orphan_cache);
 	list_del(&pi->list);
 	kfree(pi);
 }
@@ -1014,6 +1263,9 @@ static struct mem_info *__get_area(enum tiler_fmt fmt, u32 width, u32 height,
 			kfree(mi);
 			return NULL;
 		}
+		tcm_trace("1d %d %d %d %d %d", x * y,
+			  mi->area.p0.x, mi->area.p0.y,
+			  mi->area.p1.x, mi->area.p1.y);
 		if (tiler_alloc_debug & 1)
 			printk(KERN_ERR "(+1d: %d,%d..%d,%d)\n",
 				mi->area.p0.x, mi->area.p0.y,
@@ -1098,26 +1350,28 @@ static s32 tiler_mmap(struct file *filp, struct vm_area_struct *vma)
 
 static s32 refill_pat(struct tmm *tmm, struct tcm_area *area, u32 *ptr)
 {
-	s32 res = 0;
-	struct pat_area p_area = {0};
+	struct pat_area p_area[MAX_SLICES];
+	u32 page_pa[MAX_SLICES];
 	struct tcm_area slice, area_s;
+	u32 n = 0, offs = 0;
 
+	/* program all slices of the area in one go */
 	tcm_for_each_slice(slice, *area, area_s) {
-		p_area.x0 = slice.p0.x;
-		p_area.y0 = slice.p0.y;
-		p_area.x1 = slice.p1.x;
-		p_area.y1 = slice.p1.y;
+		if (WARN_ON(n == MAX_SLICES))
+			return -EFAULT;
 
-		memcpy(dmac_va, ptr, sizeof(*ptr) * tcm_sizeof(slice));
-		ptr += tcm_sizeof(slice);
+		p_area[n].x0 = slice.p0.x;
+		p_area[n].y0 = slice.p0.y;
+		p_area[n].x1 = slice.p1.x;
+		p_area[n].y1 = slice.p1.y;
 
-		if (tmm_map(tmm, p_area, dmac_pa)) {
-			res = -EFAULT;
-			break;
-		}
+		memcpy(dmac_va + offs, ptr, sizeof(*ptr) * tcm_sizeof(slice));
+		page_pa[n++] = dmac_pa + offs * sizeof(*dmac_va);
+		ptr += tcm_sizeof(slice);
+		offs = ALIGN(offs + tcm_sizeof(slice), 4);
 	}
 
-	return res;
+	return tmm_map(tmm, p_area, page_pa, n) ? -EFAULT : 0;
 }
 
 static s32 map_block(enum tiler_fmt fmt, u32 width, u32 height, u32 gid,
@@ -1550,14 +1804,21 @@ static s32 alloc_block(enum tiler_fmt fmt, u32 width, u32 height,
 	if (align > PAGE_SIZE || offs > align || !pi)
 		return -EINVAL;
 
-	/* get group context */
+	/* get group context, and a recently freed block if there is one */
 	mutex_lock(&mtx);
 	gi = _m_get_gi(pi, gid);
+	if (gi && cache_max_pages && tmm_can_map(TMM(fmt)))
+		mi = _m_cache_get(gi, fmt, width, height, align, offs);
 	mutex_unlock(&mtx);
 
 	if (!gi)
 		return -ENOMEM;
 
+	if (mi) {
+		*sys_addr = mi->sys_addr;
+		return 0;
+	}
+
 	/* reserve area in tiler container */
 	mi = __get_area(fmt, width, height, align, offs, gi);
 	if (!mi) {
@@ -1568,6 +1829,10 @@ static s32 alloc_block(enum tiler_fmt fmt, u32 width, u32 height,
 	}
 
 	*sys_addr = mi->sys_addr;
+	mi->width = width;
+	mi->height = height;
+	mi->align = align;
+	mi->offs = offs;
 
 	/* allocate and map if mapping is supported */
 	if (tmm_can_map(TMM(fmt))) {
@@ -1691,12 +1956,19 @@ static void __exit tiler_exit(void)
 	struct process_info *pi = NULL, *pi_ = NULL;
 	int i, j;
 
+	unregister_shrinker(&tiler_cache_shrinker);
+
 	mutex_lock(&mtx);
 
 	/* free all process data */
 	list_for_each_entry_safe(pi, pi_, &procs, list)
 		_m_free_process_info(pi);
 
+	/* and all cached blocks */
+	while (!list_empty(&cache_lru))
+		_m_cache_evict(list_first_entry(&cache_lru, struct mem_info,
+						cache_lru), false);
+
 	/* all lists should have cleared */
 	WARN_ON(!list_empty(&blocks));
 	WARN_ON(!list_empty(&procs));
@@ -1705,8 +1977,7 @@ static void __exit tiler_exit(void)
 
 	mutex_unlock(&mtx);
 
-	dma_free_coherent(NULL, TILER_WIDTH * TILER_HEIGHT * sizeof(*dmac_va),
-							dmac_va, dmac_pa);
+	dma_free_coherent(NULL, DMAC_SIZE, dmac_va, dmac_pa);
 
 	/* close containers only once */
 	for (i = TILFMT_8BIT; i <= TILFMT_MAX; i++) {
@@ -1767,7 +2038,7 @@ static s32 __init tiler_init(void)
 	s32 r = -1;
 	struct device *device = NULL;
 	struct tcm_pt div_pt;
-	struct tcm *sita = NULL;
+	struct tcm *tcm_c = NULL;
 	struct tmm *tmm_pat = NULL;
 
 	if (!cpu_is_omap44xx())
@@ -1777,20 +2048,22 @@ static s32 __init tiler_init(void)
 	  * Array of physical pages for PAT programming, which must be a 16-byte
 	  * aligned physical address
 	*/
-	dmac_va = dma_alloc_coherent(NULL, TILER_WIDTH * TILER_HEIGHT *
-					sizeof(*dmac_va), &dmac_pa, GFP_ATOMIC);
+	dmac_va = dma_alloc_coherent(NULL, DMAC_SIZE, &dmac_pa, GFP_ATOMIC);
 	if (!dmac_va)
 		return -ENOMEM;
 
 	/* Allocate tiler container manager (we share 1 on OMAP4) */
 	div_pt.x = TILER_WIDTH;   /* hardcoded default */
 	div_pt.y = (3 * TILER_HEIGHT) / 4;
-	sita = sita_init(TILER_WIDTH, TILER_HEIGHT, (void *)&div_pt);
+	if (!strcmp(tiler_tcm, "ita"))
+		tcm_c = ita_init(TILER_WIDTH, TILER_HEIGHT, (void *)&div_pt);
+	else
+		tcm_c = sita_init(TILER_WIDTH, TILER_HEIGHT, (void *)&div_pt);
 
-	TCM_SET(TILFMT_8BIT, sita);
-	TCM_SET(TILFMT_16BIT, sita);
-	TCM_SET(TILFMT_32BIT, sita);
-	TCM_SET(TILFMT_PAGE, sita);
+	TCM_SET(TILFMT_8BIT, tcm_c);
+	TCM_SET(TILFMT_16BIT, tcm_c);
+	TCM_SET(TILFMT_32BIT, tcm_c);
+	TCM_SET(TILFMT_PAGE, tcm_c);
 
 	/* Allocate tiler memory manager (must have 1 unique TMM per TCM ) */
 	tmm_pat = tmm_pat_init(0);
@@ -1800,7 +2073,7 @@ static s32 __init tiler_init(void)
 	TMM_SET(TILFMT_PAGE, tmm_pat);
 
 	tiler_device = kmalloc(sizeof(*tiler_device), GFP_KERNEL);
-	if (!tiler_device || !sita || !tmm_pat) {
+	if (!tiler_device || !tcm_c || !tmm_pat) {
 		r = -ENOMEM;
 		goto error;
 	}
@@ -1840,6 +2113,9 @@ static s32 __init tiler_init(void)
 	INIT_LIST_HEAD(&procs);
 	INIT_LIST_HEAD(&orphan_areas);
 	INIT_LIST_HEAD(&orphan_onedim);
+	INIT_LIST_HEAD(&orphan_cache);
+	INIT_LIST_HEAD(&cache_lru);
+	register_shrinker(&tiler_cache_shrinker);
 	BLOCKING_INIT_NOTIFIER_HEAD(&tiler_device->notifier);
 	id = 0xda7a000;
 
@@ -1847,10 +2123,9 @@ error:
 	/* TODO: error handling for device registration */
 	if (r) {
 		kfree(tiler_device);
-		tcm_deinit(sita);
+		tcm_deinit(tcm_c);
 		tmm_deinit(tmm_pat);
-		dma_free_coherent(NULL, TILER_WIDTH * TILER_HEIGHT *
-					sizeof(*dmac_va), dmac_va, dmac_pa);
+		dma_free_coherent(NULL, DMAC_SIZE, dmac_va, dmac_pa);
 	}
 
 	return r;
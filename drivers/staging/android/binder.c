@@ -19,6 +19,8 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -32,11 +34,12 @@
 #include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/vmalloc.h>
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+static DEFINE_MUTEX(binder_main_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 
 static HLIST_HEAD(binder_procs);
@@ -50,6 +53,10 @@ static uid_t binder_context_mgr_uid = -1;
 static int binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
+static DEFINE_SPINLOCK(binder_lru_lock);
+static LIST_HEAD(binder_lru);
+static int binder_lru_count;
+
 #define BINDER_DEBUG_ENTRY(name) \
 static int binder_##name##_open(struct inode *inode, struct file *file) \
 { \
@@ -120,6 +127,15 @@ static int binder_set_stop_on_user_error(const char *val,
 module_param_call(stop_on_user_error, binder_set_stop_on_user_error,
 	param_get_int, &binder_stop_on_user_error, S_IWUSR | S_IRUGO);
 
+/*
+ * Ask user-space for another looper thread when the average number of
+ * transactions queued on proc->todo exceeds the number of idle loopers,
+ * instead of only once no looper is left waiting.
+ */
+static int binder_looper_prespawn = 1;
+module_param_named(looper_prespawn, binder_looper_prespawn, bool,
+		   S_IWUSR | S_IRUGO);
+
 #define binder_debug(mask, x...) \
 	do { \
 		if (binder_debug_mask & mask) \
@@ -147,7 +163,7 @@ enum binder_stat_types {
 
 struct binder_stats {
 	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	int bc[_IOC_NR(BC_REPLY_SG) + 1];
 	int obj_created[BINDER_STAT_COUNT];
 	int obj_deleted[BINDER_STAT_COUNT];
 };
@@ -164,6 +180,20 @@ static inline void binder_stats_created(enum binder_stat_types type)
 	binder_stats.obj_created[type]++;
 }
 
+/*
+ * Contention statistics for the binder locks. The counters are only
+ * updated by the owner of the lock they describe, so they need no
+ * locking of their own.
+ */
+struct binder_lock_stats {
+	unsigned long acquired;
+	unsigned long contended;
+	u64 wait_ns;
+	u64 max_wait_ns;
+};
+
+static struct binder_lock_stats binder_main_lock_stats;
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -175,6 +205,8 @@ struct binder_transaction_log_entry {
 	int to_node;
 	int data_size;
 	int offsets_size;
+	int sg_count;
+	int copy_usecs;
 };
 struct binder_transaction_log {
 	int next;
@@ -184,6 +216,17 @@ struct binder_transaction_log {
 static struct binder_transaction_log binder_transaction_log;
 static struct binder_transaction_log binder_transaction_log_failed;
 
+/* payload copy statistics, updated under binder_main_lock */
+struct binder_copy_stats {
+	unsigned long transactions;
+	unsigned long sg_transactions;
+	unsigned long sg_segments;
+	u64 bytes;
+	u64 copy_ns;
+	u64 max_copy_ns;
+};
+static struct binder_copy_stats binder_copy_stats;
+
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
@@ -258,12 +301,16 @@ struct binder_ref {
 
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
-	struct rb_node rb_node; /* free entry by size or allocated entry */
-				/* by address */
+	union {
+		struct rb_node rb_node; /* free entry by size or allocated */
+					/* entry by address */
+		struct list_head cache_entry; /* cached entry by size class */
+	};
 	unsigned free:1;
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
-	unsigned debug_id:29;
+	unsigned cached:1;
+	unsigned debug_id:28;
 
 	struct binder_transaction *transaction;
 
@@ -273,6 +320,48 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+/*
+ * Small buffers are not merged back into the free tree when they are
+ * freed but kept, still mapped, on per-size-class lists so the next
+ * transaction of the same size reuses them without a tree walk.
+ */
+#define BINDER_CACHED_BUF_GRANULE	32
+#define BINDER_CACHED_BUF_CLASSES	8
+#define BINDER_CACHED_BUF_MAX \
+	(BINDER_CACHED_BUF_GRANULE * BINDER_CACHED_BUF_CLASSES)
+#define BINDER_CACHED_BUF_PER_CLASS	16
+
+/*
+ * Pages that no buffer uses any more stay mapped on binder_lru until the
+ * shrinker reclaims them.
+ */
+struct binder_lru_page {
+	struct list_head lru;
+	struct page *page_ptr;
+	struct binder_proc *proc;
+};
+
+/*
+ * log2 histogram of latencies in microseconds: bucket 0 counts latencies
+ * below 1us, bucket i those in [2^(i-1), 2^i) us and the last bucket
+ * everything longer.
+ */
+#define BINDER_LATENCY_BUCKETS	24
+
+struct binder_latency_hist {
+	unsigned long count[BINDER_LATENCY_BUCKETS];
+};
+
+static void binder_latency_add(struct binder_latency_hist *hist, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	int bucket = fls64(us);
+
+	if (bucket >= BINDER_LATENCY_BUCKETS)
+		bucket = BINDER_LATENCY_BUCKETS - 1;
+	hist->count[bucket]++;
+}
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -281,6 +370,8 @@ enum binder_deferred_state {
 
 struct binder_proc {
 	struct hlist_node proc_node;
+	int tmp_ref;
+	int is_dead;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -294,12 +385,17 @@ struct binder_proc {
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	struct mutex alloc_lock;
+	struct binder_lock_stats alloc_lock_stats;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
+	struct list_head cached_buffers[BINDER_CACHED_BUF_CLASSES];
+	int cached_buffer_count[BINDER_CACHED_BUF_CLASSES];
+	unsigned long cached_buffer_hits;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -311,7 +407,13 @@ struct binder_proc {
 	int requested_threads_started;
 	int ready_threads;
 	long default_priority;
+	/* proc->todo transaction depth, scaled by 8 (BINDER_QUEUE_EWMA_SHIFT) */
+	unsigned int queue_depth_ewma;
 	struct dentry *debugfs_entry;
+	/* BC_TRANSACTION to BR_TRANSACTION, as received by this proc */
+	struct binder_latency_hist transaction_latency;
+	/* BC_TRANSACTION to BR_REPLY, as received by this proc */
+	struct binder_latency_hist reply_latency;
 };
 
 enum {
@@ -354,11 +456,103 @@ struct binder_transaction {
 	unsigned int	flags;
 	long	priority;
 	long	saved_priority;
+	int	sched_policy;
+	unsigned int	rt_priority;
+	int	saved_sched_policy;
+	unsigned int	saved_rt_priority;
 	uid_t	sender_euid;
+	ktime_t	start_time;
+	ktime_t	call_time; /* start_time of the transaction replied to */
 };
 
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
+/* Takes @lock, accounting the wait in @stats. Returns the time waited. */
+static u64 binder_mutex_lock(struct mutex *lock,
+			     struct binder_lock_stats *stats)
+{
+	ktime_t start;
+	u64 wait_ns;
+
+	if (mutex_trylock(lock)) {
+		stats->acquired++;
+		return 0;
+	}
+	start = ktime_get();
+	mutex_lock(lock);
+	wait_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	stats->acquired++;
+	stats->contended++;
+	stats->wait_ns += wait_ns;
+	if (wait_ns > stats->max_wait_ns)
+		stats->max_wait_ns = wait_ns;
+	return wait_ns;
+}
+
+/*
+ * binder_main_lock is still the one global lock for the object graph:
+ * procs, threads, nodes, refs, transaction stacks and todo lists, so
+ * unrelated transactions still serialize on it while they translate
+ * objects and queue work. Only the buffer allocator of each proc has its
+ * own lock, proc->alloc_lock, which nests inside binder_main_lock and is
+ * also taken on its own while a transaction allocates and copies its
+ * payload outside the main lock.
+ */
+static inline void binder_lock(const char *tag)
+{
+	u64 wait_ns;
+
+	trace_binder_lock(tag);
+	wait_ns = binder_mutex_lock(&binder_main_lock, &binder_main_lock_stats);
+	trace_binder_locked(tag, wait_ns);
+}
+
+static inline void binder_unlock(const char *tag)
+{
+	trace_binder_unlock(tag);
+	mutex_unlock(&binder_main_lock);
+}
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
+static void binder_free_proc(struct binder_proc *proc);
+static int binder_drain_cached_bufs(struct binder_proc *proc);
+
+static inline void binder_proc_alloc_lock(struct binder_proc *proc,
+					  const char *tag)
+{
+	u64 wait_ns;
+
+	trace_binder_alloc_lock(tag);
+	wait_ns = binder_mutex_lock(&proc->alloc_lock,
+				    &proc->alloc_lock_stats);
+	trace_binder_alloc_locked(tag, wait_ns);
+}
+
+static inline void binder_proc_alloc_unlock(struct binder_proc *proc,
+					    const char *tag)
+{
+	trace_binder_alloc_unlock(tag);
+	mutex_unlock(&proc->alloc_lock);
+}
+
+/*
+ * A temporary reference keeps a proc, and its buffer area, alive while a
+ * transaction is copying into it without holding binder_main_lock. Both
+ * functions must be called with binder_main_lock held.
+ */
+static inline void binder_get_proc(struct binder_proc *proc)
+{
+	proc->tmp_ref++;
+}
+
+static void binder_put_proc(struct binder_proc *proc)
+{
+	BUG_ON(proc->tmp_ref <= 0);
+	if (--proc->tmp_ref == 0 && proc->is_dead)
+		binder_free_proc(proc);
+}
 
 /*
  * copied from get_unused_fd_flags
@@ -515,6 +709,68 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static inline int binder_is_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+/*
+ * Switch current to the given scheduling class. Unlike nice values the
+ * real-time class is inherited without checking RLIMIT_RTPRIO: the caller
+ * already runs at this priority and is blocked until we reply.
+ */
+static void binder_set_priority(int policy, unsigned int rt_priority,
+				long nice)
+{
+	struct sched_param param;
+	int ret;
+
+	if (!binder_is_rt_policy(policy))
+		rt_priority = 0;
+	if (current->policy != policy ||
+	    current->rt_priority != rt_priority) {
+		param.sched_priority = rt_priority;
+		ret = sched_setscheduler_nocheck(current, policy, &param);
+		if (ret) {
+			binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+				     "binder: %d: policy %d prio %u not "
+				     "allowed, ret %d\n", current->pid,
+				     policy, rt_priority, ret);
+			return;
+		}
+	}
+	if (!binder_is_rt_policy(policy))
+		binder_set_nice(nice);
+}
+
+/*
+ * Called on BR_TRANSACTION delivery. Remembers the priority of the
+ * serving thread and raises it to the caller's when the caller runs in a
+ * real-time class and is waiting for the reply; otherwise only the nice
+ * value is propagated, as before.
+ */
+static void binder_transaction_priority(struct binder_transaction *t,
+					struct binder_node *target_node)
+{
+	t->saved_priority = task_nice(current);
+	t->saved_sched_policy = current->policy;
+	t->saved_rt_priority = current->rt_priority;
+
+	if (!(t->flags & TF_ONE_WAY) && binder_is_rt_policy(t->sched_policy) &&
+	    (!binder_is_rt_policy(current->policy) ||
+	     current->rt_priority < t->rt_priority)) {
+		binder_set_priority(t->sched_policy, t->rt_priority,
+				    t->priority);
+		return;
+	}
+	if (t->priority < target_node->min_priority &&
+	    !(t->flags & TF_ONE_WAY))
+		binder_set_nice(t->priority);
+	else if (!(t->flags & TF_ONE_WAY) ||
+		 t->saved_priority > target_node->min_priority)
+		binder_set_nice(target_node->min_priority);
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -607,6 +863,24 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static void binder_lru_add_page(struct binder_lru_page *page)
+{
+	spin_lock(&binder_lru_lock);
+	BUG_ON(!list_empty(&page->lru));
+	list_add_tail(&page->lru, &binder_lru);
+	binder_lru_count++;
+	spin_unlock(&binder_lru_lock);
+}
+
+static void binder_lru_del_page(struct binder_lru_page *page)
+{
+	spin_lock(&binder_lru_lock);
+	BUG_ON(list_empty(&page->lru));
+	list_del_init(&page->lru);
+	binder_lru_count--;
+	spin_unlock(&binder_lru_lock);
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -614,7 +888,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct binder_lru_page *page;
 	struct mm_struct *mm;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
@@ -624,6 +898,9 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate == 0)
+		goto free_range;
+
 	if (vma)
 		mm = NULL;
 	else
@@ -634,9 +911,6 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		vma = proc->vma;
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
@@ -648,16 +922,20 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+		if (page->page_ptr) {
+			/* still mapped since it was last freed */
+			binder_lru_del_page(page);
+			continue;
+		}
+		page->page_ptr = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (page->page_ptr == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		page_array_ptr = &page->page_ptr;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -667,7 +945,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
@@ -683,20 +961,25 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	return 0;
 
 free_range:
+	/* the pages stay mapped until binder_shrink() wants them back */
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		BUG_ON(page->page_ptr == NULL);
+		binder_lru_add_page(page);
+	}
+	return 0;
+
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
 err_alloc_page_failed:
-		;
-	}
+	for (page_addr -= PAGE_SIZE; page_addr >= start;
+	     page_addr -= PAGE_SIZE)
+		binder_lru_add_page(&proc->pages[
+			(page_addr - proc->buffer) / PAGE_SIZE]);
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -705,6 +988,114 @@ err_no_vma:
 	return -ENOMEM;
 }
 
+static int binder_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
+	struct binder_lru_page *page;
+	struct binder_proc *proc;
+	struct mm_struct *mm;
+	void *page_addr;
+	int count;
+
+	for (count = 0; count < nr_to_scan; count++) {
+		spin_lock(&binder_lru_lock);
+		if (list_empty(&binder_lru)) {
+			spin_unlock(&binder_lru_lock);
+			break;
+		}
+		page = list_first_entry(&binder_lru, struct binder_lru_page,
+					lru);
+		proc = page->proc;
+		/* we may be called from an allocation under alloc_lock */
+		if (!mutex_trylock(&proc->alloc_lock)) {
+			list_move_tail(&page->lru, &binder_lru);
+			spin_unlock(&binder_lru_lock);
+			continue;
+		}
+		list_del_init(&page->lru);
+		binder_lru_count--;
+		spin_unlock(&binder_lru_lock);
+
+		page_addr = proc->buffer +
+			(page - proc->pages) * PAGE_SIZE;
+		mm = get_task_mm(proc->tsk);
+		if (mm && !down_read_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			binder_lru_add_page(page);
+			mutex_unlock(&proc->alloc_lock);
+			continue;
+		}
+		if (mm) {
+			if (proc->vma)
+				zap_page_range(proc->vma, (uintptr_t)page_addr +
+					proc->user_buffer_offset, PAGE_SIZE,
+					NULL);
+			up_read(&mm->mmap_sem);
+			mmput(mm);
+		}
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(page->page_ptr);
+		page->page_ptr = NULL;
+		mutex_unlock(&proc->alloc_lock);
+	}
+	return binder_lru_count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int binder_cached_buf_class(size_t size)
+{
+	return size ? (size - 1) / BINDER_CACHED_BUF_GRANULE : 0;
+}
+
+static struct binder_buffer *binder_get_cached_buf(struct binder_proc *proc,
+						   size_t size)
+{
+	struct binder_buffer *buffer;
+	int class;
+
+	if (size > BINDER_CACHED_BUF_MAX)
+		return NULL;
+
+	for (class = binder_cached_buf_class(size);
+	     class < BINDER_CACHED_BUF_CLASSES; class++) {
+		if (list_empty(&proc->cached_buffers[class]))
+			continue;
+		buffer = list_first_entry(&proc->cached_buffers[class],
+					  struct binder_buffer, cache_entry);
+		list_del(&buffer->cache_entry);
+		proc->cached_buffer_count[class]--;
+		proc->cached_buffer_hits++;
+		buffer->cached = 0;
+		binder_insert_allocated_buffer(proc, buffer);
+		return buffer;
+	}
+	return NULL;
+}
+
+static int binder_put_cached_buf(struct binder_proc *proc,
+				 struct binder_buffer *buffer,
+				 size_t buffer_size)
+{
+	int class;
+
+	if (buffer_size < BINDER_CACHED_BUF_GRANULE || proc->is_dead)
+		return 0;
+	if (buffer_size > BINDER_CACHED_BUF_MAX)
+		buffer_size = BINDER_CACHED_BUF_MAX;
+	/* every buffer on a class list holds at least (class + 1) granules */
+	class = buffer_size / BINDER_CACHED_BUF_GRANULE - 1;
+	if (proc->cached_buffer_count[class] >= BINDER_CACHED_BUF_PER_CLASS)
+		return 0;
+
+	buffer->cached = 1;
+	list_add(&buffer->cache_entry, &proc->cached_buffers[class]);
+	proc->cached_buffer_count[class]++;
+	return 1;
+}
+
 static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 					      size_t data_size,
 					      size_t offsets_size, int is_async)
@@ -716,6 +1107,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	void *has_page_addr;
 	void *end_page_addr;
 	size_t size;
+	int cached = 0;
 
 	if (proc->vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
@@ -740,6 +1132,13 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
+	buffer = binder_get_cached_buf(proc, size);
+	if (buffer) {
+		cached = 1;
+		goto found;
+	}
+
+retry:
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
@@ -756,6 +1155,10 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		}
 	}
 	if (best_fit == NULL) {
+		if (binder_drain_cached_bufs(proc)) {
+			n = proc->free_buffers.rb_node;
+			goto retry;
+		}
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
 		       "no address space\n", proc->pid, size);
 		return NULL;
@@ -794,6 +1197,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		new_buffer->free = 1;
 		binder_insert_free_buffer(proc, new_buffer);
 	}
+found:
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got "
 		     "%p\n", proc->pid, size, buffer);
@@ -807,6 +1211,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 			     "async free %zd\n", proc->pid, size,
 			     proc->free_async_space);
 	}
+	trace_binder_alloc_buf(proc, buffer, cached);
 
 	return buffer;
 }
@@ -868,6 +1273,35 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
+static void binder_merge_free_buf(struct binder_proc *proc,
+				  struct binder_buffer *buffer,
+				  size_t buffer_size)
+{
+	binder_update_page_range(proc, 0,
+		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
+		NULL);
+	buffer->free = 1;
+	if (!list_is_last(&buffer->entry, &proc->buffers)) {
+		struct binder_buffer *next = list_entry(buffer->entry.next,
+						struct binder_buffer, entry);
+		if (next->free) {
+			rb_erase(&next->rb_node, &proc->free_buffers);
+			binder_delete_free_buffer(proc, next);
+		}
+	}
+	if (proc->buffers.next != &buffer->entry) {
+		struct binder_buffer *prev = list_entry(buffer->entry.prev,
+						struct binder_buffer, entry);
+		if (prev->free) {
+			binder_delete_free_buffer(proc, buffer);
+			rb_erase(&prev->rb_node, &proc->free_buffers);
+			buffer = prev;
+		}
+	}
+	binder_insert_free_buffer(proc, buffer);
+}
+
 static void binder_free_buf(struct binder_proc *proc,
 			    struct binder_buffer *buffer)
 {
@@ -883,6 +1317,7 @@ static void binder_free_buf(struct binder_proc *proc,
 		     "_size %zd\n", proc->pid, buffer, size, buffer_size);
 
 	BUG_ON(buffer->free);
+	BUG_ON(buffer->cached);
 	BUG_ON(size > buffer_size);
 	BUG_ON(buffer->transaction != NULL);
 	BUG_ON((void *)buffer < proc->buffer);
@@ -897,30 +1332,31 @@ static void binder_free_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
-	binder_update_page_range(proc, 0,
-		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
-		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
-		NULL);
 	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
-	buffer->free = 1;
-	if (!list_is_last(&buffer->entry, &proc->buffers)) {
-		struct binder_buffer *next = list_entry(buffer->entry.next,
-						struct binder_buffer, entry);
-		if (next->free) {
-			rb_erase(&next->rb_node, &proc->free_buffers);
-			binder_delete_free_buffer(proc, next);
-		}
-	}
-	if (proc->buffers.next != &buffer->entry) {
-		struct binder_buffer *prev = list_entry(buffer->entry.prev,
-						struct binder_buffer, entry);
-		if (prev->free) {
-			binder_delete_free_buffer(proc, buffer);
-			rb_erase(&prev->rb_node, &proc->free_buffers);
-			buffer = prev;
+	if (binder_put_cached_buf(proc, buffer, buffer_size))
+		return;
+	binder_merge_free_buf(proc, buffer, buffer_size);
+}
+
+static int binder_drain_cached_bufs(struct binder_proc *proc)
+{
+	struct binder_buffer *buffer;
+	int class, count = 0;
+
+	for (class = 0; class < BINDER_CACHED_BUF_CLASSES; class++) {
+		while (!list_empty(&proc->cached_buffers[class])) {
+			buffer = list_first_entry(&proc->cached_buffers[class],
+						  struct binder_buffer,
+						  cache_entry);
+			list_del(&buffer->cache_entry);
+			buffer->cached = 0;
+			binder_merge_free_buf(proc, buffer,
+					      binder_buffer_size(proc, buffer));
+			count++;
 		}
+		proc->cached_buffer_count[class] = 0;
 	}
-	binder_insert_free_buffer(proc, buffer);
+	return count;
 }
 
 static struct binder_node *binder_get_node(struct binder_proc *proc,
@@ -1375,9 +1811,31 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+static int binder_copy_sg(void *dst, const struct binder_sg_entry __user *sg,
+			  size_t sg_count, size_t data_size)
+{
+	struct binder_sg_entry entry;
+	size_t copied = 0;
+
+	if (sg_count > UIO_MAXIOV)
+		return -EINVAL;
+
+	for (; sg_count; sg_count--, sg++) {
+		if (copy_from_user(&entry, sg, sizeof(entry)))
+			return -EFAULT;
+		if (entry.size > data_size - copied)
+			return -EINVAL;
+		if (copy_from_user(dst + copied, entry.buffer, entry.size))
+			return -EFAULT;
+		copied += entry.size;
+	}
+	return copied == data_size ? 0 : -EINVAL;
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
-			       struct binder_transaction_data *tr, int reply)
+			       struct binder_transaction_data *tr, int reply,
+			       size_t sg_count)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
@@ -1390,6 +1848,9 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
 	uint32_t return_error;
+	ktime_t copy_start;
+	u64 copy_ns;
+	int ret;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
@@ -1398,6 +1859,7 @@ static void binder_transaction(struct binder_proc *proc,
 	e->target_handle = tr->target.handle;
 	e->data_size = tr->data_size;
 	e->offsets_size = tr->offsets_size;
+	e->sg_count = sg_count;
 
 	if (reply) {
 		in_reply_to = thread->transaction_stack;
@@ -1408,7 +1870,9 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_set_priority(in_reply_to->saved_sched_policy,
+				    in_reply_to->saved_rt_priority,
+				    in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1481,21 +1945,8 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1514,6 +1965,9 @@ static void binder_transaction(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
 	t->debug_id = ++binder_last_id;
+	t->start_time = ktime_get();
+	if (reply)
+		t->call_time = in_reply_to->start_time;
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1539,37 +1993,111 @@ static void binder_transaction(struct binder_proc *proc,
 		t->from = NULL;
 	t->sender_euid = proc->tsk->cred->euid;
 	t->to_proc = target_proc;
-	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
+	t->sched_policy = current->policy;
+	t->rt_priority = current->rt_priority;
+
+	/*
+	 * Allocating the target buffer may map pages and copying the payload
+	 * may fault, so both are done without binder_main_lock. The target
+	 * node and proc are pinned until the lock is taken again.
+	 */
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+	binder_get_proc(target_proc);
+	binder_unlock(__func__);
+
+	binder_proc_alloc_lock(target_proc, __func__);
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+	if (t->buffer) {
+		t->buffer->allow_user_free = 0;
+		t->buffer->debug_id = t->debug_id;
+		t->buffer->transaction = t;
+		t->buffer->target_node = target_node;
+	}
+	binder_proc_alloc_unlock(target_proc, __func__);
 	if (t->buffer == NULL) {
+		binder_lock(__func__);
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
+	copy_start = ktime_get();
+	if (sg_count)
+		ret = binder_copy_sg(t->buffer->data, tr->data.ptr.buffer,
+				     sg_count, tr->data_size);
+	else if (copy_from_user(t->buffer->data, tr->data.ptr.buffer,
+				tr->data_size))
+		ret = -EFAULT;
+	else
+		ret = 0;
+	if (ret) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+			"data %s\n", proc->pid, thread->pid,
+			sg_count ? "segments" : "ptr");
+		binder_lock(__func__);
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
 	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
 			"offsets ptr\n", proc->pid, thread->pid);
+		binder_lock(__func__);
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
+	copy_ns = ktime_to_ns(ktime_sub(ktime_get(), copy_start));
+	binder_lock(__func__);
+
+	binder_copy_stats.transactions++;
+	if (sg_count) {
+		binder_copy_stats.sg_transactions++;
+		binder_copy_stats.sg_segments += sg_count;
+	}
+	binder_copy_stats.bytes += tr->data_size + tr->offsets_size;
+	binder_copy_stats.copy_ns += copy_ns;
+	if (copy_ns > binder_copy_stats.max_copy_ns)
+		binder_copy_stats.max_copy_ns = copy_ns;
+	/* the log entry may have been recycled while we were unlocked */
+	if (e->debug_id == t->debug_id)
+		e->copy_usecs = div_u64(copy_ns, NSEC_PER_USEC);
+
+	if (target_proc->is_dead) {
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_target;
+	}
+	if (reply) {
+		/* the thread waiting for this reply may have exited */
+		target_thread = in_reply_to->from;
+		if (target_thread == NULL) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_target;
+		}
+	} else if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		struct binder_transaction *tmp;
+
+		for (tmp = thread->transaction_stack; tmp;
+		     tmp = tmp->from_parent) {
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+		}
+	}
+	if (target_thread) {
+		if (e->debug_id == t->debug_id)
+			e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
+	}
+	t->to_thread = target_thread;
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1733,12 +2261,14 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	trace_binder_transaction(reply, t, target_node);
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	binder_put_proc(target_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1750,10 +2280,18 @@ err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
 err_copy_data_failed:
+err_dead_target:
+	/* releasing the buffer also drops the reference on target_node */
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
+	binder_proc_alloc_lock(target_proc, __func__);
 	binder_free_buf(target_proc, t->buffer);
+	binder_proc_alloc_unlock(target_proc, __func__);
+	target_node = NULL;
 err_binder_alloc_buf_failed:
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
+	binder_put_proc(target_proc);
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1934,7 +2472,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			binder_proc_alloc_lock(proc, __func__);
 			buffer = binder_buffer_lookup(proc, data_ptr);
+			binder_proc_alloc_unlock(proc, __func__);
 			if (buffer == NULL) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
@@ -1965,7 +2505,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
+			binder_proc_alloc_lock(proc, __func__);
 			binder_free_buf(proc, buffer);
+			binder_proc_alloc_unlock(proc, __func__);
 			break;
 		}
 
@@ -1976,7 +2518,26 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
 				return -EFAULT;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			binder_transaction(proc, thread, &tr, cmd == BC_REPLY, 0);
+			break;
+		}
+
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				return -EFAULT;
+			ptr += sizeof(tr);
+			if (tr.sg_count == 0) {
+				binder_user_error("binder: %d:%d %s with no "
+					"segments\n", proc->pid, thread->pid,
+					cmd == BC_REPLY_SG ? "BC_REPLY_SG" :
+					"BC_TRANSACTION_SG");
+				return -EINVAL;
+			}
+			binder_transaction(proc, thread, &tr.transaction_data,
+					   cmd == BC_REPLY_SG, tr.sg_count);
 			break;
 		}
 
@@ -2179,6 +2740,29 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 	}
 }
 
+#define BINDER_QUEUE_EWMA_SHIFT	3
+#define BINDER_QUEUE_DEPTH_MAX	16
+
+/*
+ * Fold the number of transactions waiting on proc->todo into a moving
+ * average (weight 1/8) each time a looper takes work from it. The walk
+ * stops at BINDER_QUEUE_DEPTH_MAX so a flooded queue stays cheap.
+ */
+static void binder_sample_queue_depth(struct binder_proc *proc)
+{
+	struct binder_work *w;
+	unsigned int depth = 0;
+
+	list_for_each_entry(w, &proc->todo, entry) {
+		if (w->type != BINDER_WORK_TRANSACTION)
+			continue;
+		if (++depth == BINDER_QUEUE_DEPTH_MAX)
+			break;
+	}
+	proc->queue_depth_ewma += depth -
+		(proc->queue_depth_ewma >> BINDER_QUEUE_EWMA_SHIFT);
+}
+
 static int binder_has_proc_work(struct binder_proc *proc,
 				struct binder_thread *thread)
 {
@@ -2233,7 +2817,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	binder_unlock(__func__);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2257,7 +2841,7 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	binder_lock(__func__);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2270,12 +2854,14 @@ retry:
 		struct binder_transaction_data tr;
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
+		u64 latency_ns;
 
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
-		else if (!list_empty(&proc->todo) && wait_for_proc_work)
+		else if (!list_empty(&proc->todo) && wait_for_proc_work) {
 			w = list_first_entry(&proc->todo, struct binder_work, entry);
-		else {
+			binder_sample_queue_depth(proc);
+		} else {
 			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
 				goto retry;
 			break;
@@ -2407,13 +2993,7 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			binder_transaction_priority(t, target_node);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2424,6 +3004,18 @@ retry:
 		tr.flags = t->flags;
 		tr.sender_euid = t->sender_euid;
 
+		if (cmd == BR_REPLY) {
+			latency_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							   t->call_time));
+			binder_latency_add(&proc->reply_latency, latency_ns);
+		} else {
+			latency_ns = ktime_to_ns(ktime_sub(ktime_get(),
+							   t->start_time));
+			binder_latency_add(&proc->transaction_latency,
+					   latency_ns);
+		}
+		trace_binder_transaction_received(t, cmd, latency_ns);
+
 		if (t->from) {
 			struct task_struct *sender = t->from->proc->tsk;
 			tr.sender_pid = task_tgid_nr_ns(sender,
@@ -2476,7 +3068,11 @@ retry:
 done:
 
 	*consumed = ptr - buffer;
-	if (proc->requested_threads + proc->ready_threads == 0 &&
+	if (proc->requested_threads == 0 &&
+	    (proc->ready_threads == 0 ||
+	     (binder_looper_prespawn &&
+	      (proc->queue_depth_ewma >> BINDER_QUEUE_EWMA_SHIFT) >
+	      proc->ready_threads)) &&
 	    proc->requested_threads_started < proc->max_threads &&
 	    (thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 	     BINDER_LOOPER_STATE_ENTERED)) /* the user-space code fails to */
@@ -2599,12 +3195,12 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	binder_lock(__func__);
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	binder_unlock(__func__);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2636,7 +3232,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	binder_lock(__func__);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2745,7 +3341,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	binder_unlock(__func__);
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2782,7 +3378,7 @@ static struct vm_operations_struct binder_vm_ops = {
 
 static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	int ret;
+	int ret, i;
 	struct vm_struct *area;
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
@@ -2834,6 +3430,10 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->pages[i].lru);
+		proc->pages[i].proc = proc;
+	}
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
@@ -2874,6 +3474,7 @@ err_bad_arg:
 static int binder_open(struct inode *nodp, struct file *filp)
 {
 	struct binder_proc *proc;
+	int i;
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE, "binder_open: %d:%d\n",
 		     current->group_leader->pid, current->pid);
@@ -2885,14 +3486,17 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->alloc_lock);
+	for (i = 0; i < BINDER_CACHED_BUF_CLASSES; i++)
+		INIT_LIST_HEAD(&proc->cached_buffers[i]);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	binder_lock(__func__);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_unlock(__func__);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2944,14 +3548,14 @@ static int binder_release(struct inode *nodp, struct file *filp)
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
 	hlist_del(&proc->proc_node);
+	proc->is_dead = 1;
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder_release: %d context_mgr_node gone\n",
@@ -3012,8 +3616,33 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
 
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d threads %d, nodes %d (ref %d), "
+		     "refs %d, active transactions %d\n",
+		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
+		     active_transactions);
+
+	/*
+	 * A sender may still be copying into our buffer area. In that case
+	 * the last binder_put_proc() frees it.
+	 */
+	if (proc->tmp_ref == 0)
+		binder_free_proc(proc);
+}
+
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	BUG_ON(!proc->is_dead);
+	BUG_ON(proc->tmp_ref);
+
+	buffers = 0;
+	binder_proc_alloc_lock(proc, __func__);
+	binder_drain_cached_bufs(proc);
 	while ((n = rb_first(&proc->allocated_buffers))) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
 							rb_node);
@@ -3032,35 +3661,36 @@ static void binder_deferred_release(struct binder_proc *proc)
 
 	binder_stats_deleted(BINDER_STAT_PROC);
 
+	/* holding alloc_lock keeps binder_shrink() away from our pages */
 	page_count = 0;
 	if (proc->pages) {
 		int i;
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
+			if (proc->pages[i].page_ptr) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
 				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 					     "binder_release: %d: "
 					     "page %d at %p not freed\n",
 					     proc->pid, i,
 					     page_addr);
+				if (!list_empty(&proc->pages[i].lru))
+					binder_lru_del_page(&proc->pages[i]);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
-				__free_page(proc->pages[i]);
+				__free_page(proc->pages[i].page_ptr);
 				page_count++;
 			}
 		}
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
+	binder_proc_alloc_unlock(proc, __func__);
 
 	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
-		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
-		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
 
 	kfree(proc);
 }
@@ -3072,7 +3702,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3099,7 +3729,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3280,9 +3910,11 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	binder_proc_alloc_lock(proc, __func__);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	binder_proc_alloc_unlock(proc, __func__);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3331,7 +3963,9 @@ static const char *binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG"
 };
 
 static const char *binder_objstat_strings[] = {
@@ -3378,12 +4012,22 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	}
 }
 
+static void print_binder_lock_stats(struct seq_file *m, const char *prefix,
+				    struct binder_lock_stats *stats)
+{
+	seq_printf(m, "%s: acquired %lu contended %lu wait %llu us max %llu us\n",
+		   prefix, stats->acquired, stats->contended,
+		   (unsigned long long)div_u64(stats->wait_ns, NSEC_PER_USEC),
+		   (unsigned long long)div_u64(stats->max_wait_ns,
+					       NSEC_PER_USEC));
+}
+
 static void print_binder_proc_stats(struct seq_file *m,
 				    struct binder_proc *proc)
 {
 	struct binder_work *w;
 	struct rb_node *n;
-	int count, strong, weak;
+	int count, strong, weak, i;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
@@ -3392,9 +4036,15 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  threads: %d\n", count);
 	seq_printf(m, "  requested threads: %d+%d/%d\n"
 			"  ready threads %d\n"
+			"  queue depth avg %u.%u\n"
 			"  free async space %zd\n", proc->requested_threads,
 			proc->requested_threads_started, proc->max_threads,
-			proc->ready_threads, proc->free_async_space);
+			proc->ready_threads,
+			proc->queue_depth_ewma >> BINDER_QUEUE_EWMA_SHIFT,
+			((proc->queue_depth_ewma &
+			  ((1U << BINDER_QUEUE_EWMA_SHIFT) - 1)) * 10) >>
+			BINDER_QUEUE_EWMA_SHIFT,
+			proc->free_async_space);
 	count = 0;
 	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n))
 		count++;
@@ -3412,9 +4062,16 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	binder_proc_alloc_lock(proc, __func__);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	binder_proc_alloc_unlock(proc, __func__);
 	seq_printf(m, "  buffers: %d\n", count);
+	count = 0;
+	for (i = 0; i < BINDER_CACHED_BUF_CLASSES; i++)
+		count += proc->cached_buffer_count[i];
+	seq_printf(m, "  cached buffers: %d hits %lu\n", count,
+		   proc->cached_buffer_hits);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3427,6 +4084,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 		}
 	}
 	seq_printf(m, "  pending transactions: %d\n", count);
+	print_binder_lock_stats(m, "  alloc lock", &proc->alloc_lock_stats);
 
 	print_binder_stats(m, "  ", &proc->stats);
 }
@@ -3440,7 +4098,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 
 	seq_puts(m, "binder state:\n");
 
@@ -3452,7 +4110,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
 	return 0;
 }
 
@@ -3463,16 +4121,28 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 
 	seq_puts(m, "binder stats:\n");
 
+	print_binder_lock_stats(m, "main lock", &binder_main_lock_stats);
+	seq_printf(m, "lru pages: %d\n", binder_lru_count);
+	seq_printf(m, "copy: transactions %lu sg %lu segments %lu "
+		   "bytes %llu time %llu us max %llu us\n",
+		   binder_copy_stats.transactions,
+		   binder_copy_stats.sg_transactions,
+		   binder_copy_stats.sg_segments,
+		   (unsigned long long)binder_copy_stats.bytes,
+		   (unsigned long long)div_u64(binder_copy_stats.copy_ns,
+					       NSEC_PER_USEC),
+		   (unsigned long long)div_u64(binder_copy_stats.max_copy_ns,
+					       NSEC_PER_USEC));
 	print_binder_stats(m, "", &binder_stats);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
 	return 0;
 }
 
@@ -3483,13 +4153,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
 	return 0;
 }
 
@@ -3499,11 +4169,53 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
+	return 0;
+}
+
+static void print_binder_latency_hist(struct seq_file *m, const char *name,
+				      struct binder_latency_hist *hist)
+{
+	int i;
+
+	seq_printf(m, "  %s latency:\n", name);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		if (!hist->count[i])
+			continue;
+		if (i == 0)
+			seq_printf(m, "    %8s %8d us: %lu\n", "<", 1,
+				   hist->count[i]);
+		else if (i == BINDER_LATENCY_BUCKETS - 1)
+			seq_printf(m, "    %8s %8lu us: %lu\n", ">=",
+				   1UL << (i - 1), hist->count[i]);
+		else
+			seq_printf(m, "    %8lu-%8lu us: %lu\n",
+				   1UL << (i - 1), 1UL << i, hist->count[i]);
+	}
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		binder_lock(__func__);
+
+	seq_puts(m, "binder latency:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency_hist(m, "transaction",
+					  &proc->transaction_latency);
+		print_binder_latency_hist(m, "reply", &proc->reply_latency);
+	}
+	if (do_lock)
+		binder_unlock(__func__);
 	return 0;
 }
 
@@ -3511,11 +4223,13 @@ static void print_binder_transaction_log_entry(struct seq_file *m,
 					struct binder_transaction_log_entry *e)
 {
 	seq_printf(m,
-		   "%d: %s from %d:%d to %d:%d node %d handle %d size %d:%d\n",
+		   "%d: %s from %d:%d to %d:%d node %d handle %d size %d:%d "
+		   "sg %d copy %dus\n",
 		   e->debug_id, (e->call_type == 2) ? "reply" :
 		   ((e->call_type == 1) ? "async" : "call "), e->from_proc,
 		   e->from_thread, e->to_proc, e->to_thread, e->to_node,
-		   e->target_handle, e->data_size, e->offsets_size);
+		   e->target_handle, e->data_size, e->offsets_size,
+		   e->sg_count, e->copy_usecs);
 }
 
 static int binder_transaction_log_show(struct seq_file *m, void *unused)
@@ -3552,6 +4266,7 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(latency);
 
 static int __init binder_init(void)
 {
@@ -3560,6 +4275,7 @@ static int __init binder_init(void)
 	binder_deferred_workqueue = create_singlethread_workqueue("binder");
 	if (!binder_deferred_workqueue)
 		return -ENOMEM;
+	register_shrinker(&binder_shrinker);
 
 	binder_debugfs_dir_entry_root = debugfs_create_dir("binder", NULL);
 	if (binder_debugfs_dir_entry_root)
@@ -3592,6 +4308,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 	}
 	return ret;
 }
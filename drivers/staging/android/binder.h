@@ -147,6 +147,23 @@ struct binder_transaction_data {
 	} data;
 };
 
+/*
+ * For BC_TRANSACTION_SG and BC_REPLY_SG the data of the transaction is
+ * not one contiguous buffer: transaction_data.data.ptr.buffer points to
+ * an array of sg_count segments that the driver gathers, in order, into
+ * the target's buffer. transaction_data.data_size must be the sum of the
+ * segment sizes, and the offsets are relative to the gathered data.
+ */
+struct binder_sg_entry {
+	const void	*buffer;
+	size_t		size;
+};
+
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	size_t		sg_count;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +341,13 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, with its data
+	 * described by a list of segments.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */
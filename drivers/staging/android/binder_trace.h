@@ -0,0 +1,154 @@
+/* binder_trace.h
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Only binder.c includes this file, after the binder structures are
+ * defined.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+struct binder_buffer;
+struct binder_node;
+struct binder_proc;
+struct binder_thread;
+struct binder_transaction;
+
+DECLARE_EVENT_CLASS(binder_lock_class,
+	TP_PROTO(const char *tag),
+	TP_ARGS(tag),
+	TP_STRUCT__entry(
+		__field(const char *, tag)
+	),
+	TP_fast_assign(
+		__entry->tag = tag;
+	),
+	TP_printk("tag=%s", __entry->tag)
+);
+
+#define DEFINE_BINDER_LOCK_EVENT(name)	\
+DEFINE_EVENT(binder_lock_class, name,	\
+	TP_PROTO(const char *func), \
+	TP_ARGS(func))
+
+DEFINE_BINDER_LOCK_EVENT(binder_lock);
+DEFINE_BINDER_LOCK_EVENT(binder_unlock);
+DEFINE_BINDER_LOCK_EVENT(binder_alloc_lock);
+DEFINE_BINDER_LOCK_EVENT(binder_alloc_unlock);
+
+DECLARE_EVENT_CLASS(binder_locked_class,
+	TP_PROTO(const char *tag, u64 wait_ns),
+	TP_ARGS(tag, wait_ns),
+	TP_STRUCT__entry(
+		__field(const char *, tag)
+		__field(u64, wait_ns)
+	),
+	TP_fast_assign(
+		__entry->tag = tag;
+		__entry->wait_ns = wait_ns;
+	),
+	TP_printk("tag=%s wait_ns=%llu", __entry->tag,
+		  (unsigned long long)__entry->wait_ns)
+);
+
+DEFINE_EVENT(binder_locked_class, binder_locked,
+	TP_PROTO(const char *tag, u64 wait_ns),
+	TP_ARGS(tag, wait_ns));
+
+DEFINE_EVENT(binder_locked_class, binder_alloc_locked,
+	TP_PROTO(const char *tag, u64 wait_ns),
+	TP_ARGS(tag, wait_ns));
+
+TRACE_EVENT(binder_transaction,
+	TP_PROTO(bool reply, struct binder_transaction *t,
+		 struct binder_node *target_node),
+	TP_ARGS(reply, t, target_node),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, target_node)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(int, reply)
+		__field(unsigned int, code)
+		__field(unsigned int, flags)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->target_node = target_node ? target_node->debug_id : 0;
+		__entry->to_proc = t->to_proc->pid;
+		__entry->to_thread = t->to_thread ? t->to_thread->pid : 0;
+		__entry->reply = reply;
+		__entry->code = t->code;
+		__entry->flags = t->flags;
+	),
+	TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d "
+		  "reply=%d flags=0x%x code=0x%x",
+		  __entry->debug_id, __entry->target_node,
+		  __entry->to_proc, __entry->to_thread,
+		  __entry->reply, __entry->flags, __entry->code)
+);
+
+TRACE_EVENT(binder_transaction_received,
+	TP_PROTO(struct binder_transaction *t, uint32_t cmd, u64 latency_ns),
+	TP_ARGS(t, cmd, latency_ns),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, reply)
+		__field(u64, latency_ns)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->reply = cmd == BR_REPLY;
+		__entry->latency_ns = latency_ns;
+	),
+	TP_printk("transaction=%d reply=%d latency_ns=%llu",
+		  __entry->debug_id, __entry->reply,
+		  (unsigned long long)__entry->latency_ns)
+);
+
+TRACE_EVENT(binder_alloc_buf,
+	TP_PROTO(struct binder_proc *proc, struct binder_buffer *buf,
+		 int cached),
+	TP_ARGS(proc, buf, cached),
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(size_t, data_size)
+		__field(size_t, offsets_size)
+		__field(int, async)
+		__field(int, cached)
+	),
+	TP_fast_assign(
+		__entry->proc = proc->pid;
+		__entry->data_size = buf->data_size;
+		__entry->offsets_size = buf->offsets_size;
+		__entry->async = buf->async_transaction;
+		__entry->cached = cached;
+	),
+	TP_printk("proc=%d data_size=%zd offsets_size=%zd async=%d cached=%d",
+		  __entry->proc, __entry->data_size, __entry->offsets_size,
+		  __entry->async, __entry->cached)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE binder_trace
+#include <trace/define_trace.h>
@@ -25,38 +25,145 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/timer.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+#include <linux/lzo.h>
+#endif
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * Readers are woken once 'wakeup_bytes' have been committed to a log, or
+ * 'wakeup_ms' after the first unwoken entry, whichever comes first. A
+ * wakeup_ms of zero wakes the readers on every entry.
+ */
+static unsigned int logger_wakeup_bytes = 2048;
+module_param_named(wakeup_bytes, logger_wakeup_bytes, uint, S_IWUSR | S_IRUGO);
+static unsigned int logger_wakeup_ms = 20;
+module_param_named(wakeup_ms, logger_wakeup_ms, uint, S_IWUSR | S_IRUGO);
+
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+/*
+ * Extra history: with 'compress' set at boot, the oldest quarter of each
+ * log is LZO compressed into an archive of up to 'archive_kb' per log
+ * before the writers wrap over it. New readers replay the archive before
+ * the ring. The ring keeps its full size, so this is memory on top of it:
+ * the archive itself, a quarter of the log per log to decompress into,
+ * and the scratch space of the compressor; about 1.3MB all told with the
+ * default sizes.
+ */
+static int logger_compress;
+module_param_named(compress, logger_compress, bool, S_IRUGO);
+static unsigned int logger_archive_kb = 256;
+module_param_named(archive_kb, logger_archive_kb, uint, S_IWUSR | S_IRUGO);
+#endif
+
+/* the archive is made of segments of a quarter of the log each */
+#define LOGGER_SEGMENTS_PER_LOG	4
+
+/*
+ * struct logger_stats - per log counters, shown in debugfs under logger/
+ *
+ * Protected by log->lock.
+ */
+struct logger_stats {
+	u64	writes;		/* entries committed */
+	u64	bytes;		/* bytes committed, headers included */
+	u64	dropped;	/* entries refused or lost to a fault */
+	u64	wakeups;	/* reader wakeups issued */
+	u64	lat_total_ns;	/* sum of write latencies */
+	u64	lat_max_ns;	/* worst write latency */
+	u64	archive_raw;	/* bytes archived */
+	u64	archive_packed;	/* those bytes once compressed */
+	u64	archive_lost;	/* bytes wrapped over before archiving */
+	u64	compress_ns;	/* time spent compressing */
+	u64	decompressions;	/* segments decompressed for readers */
+	u64	decompress_ns;	/* time spent decompressing */
+};
+
+/*
+ * struct logger_segment - a compressed run of whole entries of a log
+ *
+ * Segments are kept in log order on log->segments, protected by log->mutex.
+ */
+struct logger_segment {
+	struct list_head	list;	/* entry in logger_log's segments */
+	u64			pos;	/* log position of the first entry */
+	size_t			len;	/* bytes of entries */
+	size_t			clen;	/* bytes of compressed data */
+	unsigned char		data[0]; /* the compressed entries */
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting. The offsets, the readers and the
+ * entry headers are protected by the spinlock 'lock', which writers only hold
+ * to reserve and to commit an entry; payloads are copied in from user space
+ * without it. The mutex 'mutex' serializes readers on 'rbuf' and 'abuf',
+ * and protects the archive.
+ *
+ * Log positions count the bytes committed since boot; a position p is
+ * found at logger_offset(p) in the ring as long as it is not below head_pos.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
+	unsigned char		*rbuf;	/* bounce buffer for one read entry */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
+	wait_queue_head_t	commit_wq; /* writers waiting to commit */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	struct list_head	pending; /* reserved entries, in log order */
+	struct mutex		mutex;	/* mutex protecting rbuf */
+	spinlock_t		lock;	/* lock protecting the offsets, _bh */
 	size_t			w_off;	/* current write head offset */
+	size_t			c_off;	/* readers may read up to here */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	size_t			unwoken; /* bytes committed since last wakeup */
+	struct timer_list	wake_timer; /* deferred reader wakeup */
+	u64			c_pos;	/* log position of c_off */
+	u64			head_pos; /* log position of head */
+	u64			arch_pos; /* archived up to here */
+	struct list_head	segments; /* the archive, oldest first */
+	size_t			arch_bytes; /* compressed bytes in archive */
+	unsigned char		*abuf;	/* a decompressed segment, or NULL */
+	struct logger_segment	*abuf_seg; /* the segment in abuf */
+	struct logger_stats	stats;
+};
+
+/*
+ * struct logger_write - an entry reserved in the log by a writer
+ *
+ * Lives on the writer's stack from reservation until the entry and all the
+ * entries before it have been committed. Protected by log->lock.
+ */
+struct logger_write {
+	struct list_head	list;	/* entry in logger_log's pending list */
+	size_t			end;	/* offset just past the entry */
+	int			done;	/* payload has been copied in */
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by log->lock.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	int			in_archive; /* reading the archive, not r_off */
+	u64			a_pos;	/* archive read position (log->mutex) */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -89,7 +196,7 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -108,15 +215,13 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log - reads exactly 'count' bytes from 'log' into log->rbuf and
+ * advances the reader past them.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->mutex and log->lock.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static void do_read_log(struct logger_log *log, struct logger_reader *reader,
+			size_t count)
 {
 	size_t len;
 
@@ -126,20 +231,101 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the log, whichever comes first.
 	 */
 	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
-		return -EFAULT;
+	memcpy(log->rbuf, log->buffer + reader->r_off, len);
 
 	/*
 	 * Second, we read any remaining bytes, starting back at the head of
 	 * the log.
 	 */
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+		memcpy(log->rbuf + len, log->buffer, count - len);
 
 	reader->r_off = logger_offset(reader->r_off + count);
+}
 
-	return count;
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+/*
+ * logger_archive_entry - finds the next entry of a reader that is replaying
+ * the archive, decompressing its segment into log->abuf if need be. Returns
+ * the entry, or NULL if the reader has caught up with the ring and was
+ * moved over to it.
+ *
+ * Caller must hold log->mutex.
+ */
+static unsigned char *logger_archive_entry(struct logger_log *log,
+					   struct logger_reader *reader)
+{
+	struct logger_segment *seg;
+	size_t len;
+	ktime_t start;
+	int ret;
+
+again:
+	spin_lock_bh(&log->lock);
+	list_for_each_entry(seg, &log->segments, list) {
+		/* segments we were still to read may have been dropped */
+		if (reader->a_pos < seg->pos)
+			reader->a_pos = seg->pos;
+		if (reader->a_pos >= log->head_pos)
+			break;
+		if (reader->a_pos < seg->pos + seg->len)
+			goto found;
+	}
+
+	/* the rest is in the ring, or was lost if the ring wrapped past it */
+	if (reader->a_pos < log->head_pos)
+		reader->a_pos = log->head_pos;
+	reader->r_off = logger_offset(reader->a_pos);
+	reader->in_archive = 0;
+	spin_unlock_bh(&log->lock);
+
+	return NULL;
+
+found:
+	spin_unlock_bh(&log->lock);
+
+	if (log->abuf_seg != seg) {
+		start = ktime_get();
+		len = seg->len;
+		ret = lzo1x_decompress_safe(seg->data, seg->clen, log->abuf,
+					    &len);
+
+		spin_lock_bh(&log->lock);
+		log->stats.decompressions++;
+		log->stats.decompress_ns +=
+			ktime_to_ns(ktime_sub(ktime_get(), start));
+		spin_unlock_bh(&log->lock);
+
+		if (unlikely(ret != LZO_E_OK || len != seg->len)) {
+			printk(KERN_ERR "logger: bad archive segment in "
+			       "log '%s'\n", log->misc.name);
+			log->abuf_seg = NULL;
+			reader->a_pos = seg->pos + seg->len;
+			goto again;
+		}
+		log->abuf_seg = seg;
+	}
+
+	return log->abuf + (reader->a_pos - seg->pos);
+}
+#else
+/* without an archive there is never anything to replay */
+static unsigned char *logger_archive_entry(struct logger_log *log,
+					   struct logger_reader *reader)
+{
+	reader->in_archive = 0;
+	return NULL;
+}
+#endif
+
+/* logger_archive_entry_len - the length of an entry returned by the above */
+static __u32 logger_archive_entry_len(const unsigned char *entry)
+{
+	__u16 val;
+
+	memcpy(&val, entry, 2);
+
+	return sizeof(struct logger_entry) + val;
 }
 
 /*
@@ -166,9 +352,9 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_lock_bh(&log->lock);
+		ret = !reader->in_archive && (log->c_off == reader->r_off);
+		spin_unlock_bh(&log->lock);
 		if (!ret)
 			break;
 
@@ -191,8 +377,27 @@ start:
 
 	mutex_lock(&log->mutex);
 
+	/* replay the archive first, an entry straight out of abuf */
+	if (reader->in_archive) {
+		unsigned char *entry = logger_archive_entry(log, reader);
+
+		if (entry) {
+			ret = logger_archive_entry_len(entry);
+			if (count < ret)
+				ret = -EINVAL;
+			else if (copy_to_user(buf, entry, ret))
+				ret = -EFAULT;
+			else
+				reader->a_pos += ret;
+			goto out;
+		}
+	}
+
+	spin_lock_bh(&log->lock);
+
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
+	if (unlikely(log->c_off == reader->r_off)) {
+		spin_unlock_bh(&log->lock);
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
@@ -200,12 +405,20 @@ start:
 	/* get the size of the next entry */
 	ret = get_entry_len(log, reader->r_off);
 	if (count < ret) {
+		spin_unlock_bh(&log->lock);
 		ret = -EINVAL;
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/*
+	 * get exactly one entry from the log; it is copied out while the
+	 * writers are held off, and to user space once they no longer are
+	 */
+	do_read_log(log, reader, ret);
+	spin_unlock_bh(&log->lock);
+
+	if (copy_to_user(buf, log->rbuf, ret))
+		ret = -EFAULT;
 
 out:
 	mutex_unlock(&log->mutex);
@@ -217,7 +430,7 @@ out:
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -255,7 +468,7 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
@@ -263,73 +476,195 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	size_t new = logger_offset(old + len);
 	struct logger_reader *reader;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	if (clock_interval(old, new, log->head)) {
+		size_t head = get_next_entry(log, log->head, len);
+
+		log->head_pos += logger_offset(head - log->head);
+		log->head = head;
+	}
 
 	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
+		if (!reader->in_archive &&
+		    clock_interval(old, new, reader->r_off))
 			reader->r_off = get_next_entry(log, reader->r_off, len);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at offset 'off'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, size_t off, const void *buf,
+			 size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
+}
 
-	log->w_off = logger_offset(log->w_off + count);
+/*
+ * do_clear_log - zeroes 'count' bytes of 'log' at offset 'off', which the
+ * caller has reserved
+ */
+static void do_clear_log(struct logger_log *log, size_t off, size_t count)
+{
+	size_t len;
+
+	len = min(count, log->size - off);
+	memset(log->buffer + off, 0, len);
 
+	if (count != len)
+		memset(log->buffer, 0, count - len);
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_write_log_user - writes 'count' bytes from the user-space buffer 'buf'
+ * to the log 'log' at offset 'off', which the caller has reserved
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
 	return count;
 }
 
+/*
+ * logger_wake_timer - wakes the readers of a log once wakeup_ms have passed
+ * since the first entry they have not been woken for
+ *
+ * Runs in softirq context, which is why log->lock is taken with bottom
+ * halves disabled everywhere else.
+ */
+static void logger_wake_timer(unsigned long data)
+{
+	struct logger_log *log = (struct logger_log *) data;
+
+	spin_lock(&log->lock);
+	log->unwoken = 0;
+	log->stats.wakeups++;
+	spin_unlock(&log->lock);
+
+	wake_up_interruptible(&log->wq);
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+static struct workqueue_struct *logger_wq;
+static void logger_archive_worker(struct work_struct *work);
+static DECLARE_WORK(logger_archive_work, logger_archive_worker);
+#endif
+
+/*
+ * logger_commit - marks the entry 'w' as written and moves the readable end
+ * of the log past every leading entry that is. Returns nonzero when 'w'
+ * itself was made readable, and tells in 'wake' whether the readers should
+ * be woken now.
+ *
+ * The caller needs to hold log->lock.
+ */
+static int logger_commit(struct logger_log *log, struct logger_write *w,
+			 int *wake)
+{
+	struct logger_write *first;
+	size_t old = log->c_off;
+	int others = 0;
+
+	w->done = 1;
+
+	while (!list_empty(&log->pending)) {
+		first = list_first_entry(&log->pending, struct logger_write,
+					 list);
+		if (!first->done)
+			break;
+		log->c_off = first->end;
+		list_del_init(&first->list);
+		if (first != w)
+			others = 1;
+	}
+
+	/* writers ahead of us in the log were waiting on our entry */
+	if (others)
+		wake_up(&log->commit_wq);
+
+	*wake = 0;
+	if (log->c_off != old) {
+		log->c_pos += logger_offset(log->c_off - old);
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+		if (log->abuf && log->c_pos - max(log->arch_pos, log->head_pos) >=
+				 log->size / 2)
+			queue_work(logger_wq, &logger_archive_work);
+#endif
+
+		log->unwoken += logger_offset(log->c_off - old);
+		if (!logger_wakeup_ms ||
+		    log->unwoken >= logger_wakeup_bytes) {
+			log->unwoken = 0;
+			log->stats.wakeups++;
+			del_timer(&log->wake_timer);
+			*wake = 1;
+		} else if (!timer_pending(&log->wake_timer)) {
+			mod_timer(&log->wake_timer,
+				  jiffies + msecs_to_jiffies(logger_wakeup_ms));
+		}
+	}
+
+	return list_empty(&w->list);
+}
+
+/*
+ * logger_write_committed - has the entry 'w' been made readable? Used to
+ * wait for the writers of the entries before it.
+ */
+static int logger_write_committed(struct logger_log *log,
+				  struct logger_write *w)
+{
+	int ret;
+
+	spin_lock_bh(&log->lock);
+	ret = list_empty(&w->list);
+	spin_unlock_bh(&log->lock);
+
+	return ret;
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * A writer holds log->lock only to reserve room for its entry, which also
+ * writes the entry header, and to commit it once the payload has been copied
+ * in. Entries become readable in log order, so a writer that finishes before
+ * the writers ahead of it waits for them before returning.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
+	struct logger_write w;
 	struct timespec now;
+	ktime_t start;
+	size_t off, count;
 	ssize_t ret = 0;
+	u64 lat;
+	int wake;
 
+	start = ktime_get();
 	now = current_kernel_time();
 
 	header.pid = current->tgid;
@@ -342,7 +677,21 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	count = sizeof(struct logger_entry) + header.len;
+
+	spin_lock_bh(&log->lock);
+
+	/*
+	 * Entries still being copied in can't be overwritten, and lapped
+	 * readers must not be pulled forward into them. Writers stuck that
+	 * far behind are rare enough that we just drop the entry.
+	 */
+	if (unlikely(logger_offset(log->w_off - log->c_off) + count +
+		     LOGGER_ENTRY_MAX_LEN > log->size)) {
+		log->stats.dropped++;
+		spin_unlock_bh(&log->lock);
+		return -EAGAIN;
+	}
 
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
@@ -350,9 +699,18 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	 * because if we partially fail, we can end up with clobbered log
 	 * entries that encroach on readable buffer.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	fix_up_readers(log, count);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	off = log->w_off;
+	do_write_log(log, off, &header, sizeof(struct logger_entry));
+	off = logger_offset(off + sizeof(struct logger_entry));
+
+	log->w_off = logger_offset(log->w_off + count);
+	w.end = log->w_off;
+	w.done = 0;
+	list_add_tail(&w.list, &log->pending);
+
+	spin_unlock_bh(&log->lock);
 
 	while (nr_segs-- > 0) {
 		size_t len;
@@ -362,21 +720,42 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, off, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			/*
+			 * The header is already in the log and readers will
+			 * see the entry, so blank what is left of it.
+			 */
+			do_clear_log(log, off, header.len - ret);
+			ret = nr;
+			break;
 		}
 
+		off = logger_offset(off + nr);
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
+	lat = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock_bh(&log->lock);
+	if (likely(ret >= 0)) {
+		log->stats.writes++;
+		log->stats.bytes += count;
+		log->stats.lat_total_ns += lat;
+		if (lat > log->stats.lat_max_ns)
+			log->stats.lat_max_ns = lat;
+	} else
+		log->stats.dropped++;
+	if (!logger_commit(log, &w, &wake)) {
+		spin_unlock_bh(&log->lock);
+		wait_event(log->commit_wq, logger_write_committed(log, &w));
+	} else
+		spin_unlock_bh(&log->lock);
 
 	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	if (wake)
+		wake_up_interruptible(&log->wq);
 
 	return ret;
 }
@@ -411,9 +790,14 @@ static int logger_open(struct inode *inode, struct file *file)
 		reader->log = log;
 		INIT_LIST_HEAD(&reader->list);
 
+		reader->a_pos = 0;
+
 		mutex_lock(&log->mutex);
+		spin_lock_bh(&log->lock);
 		reader->r_off = log->head;
+		reader->in_archive = !list_empty(&log->segments);
 		list_add_tail(&reader->list, &log->readers);
+		spin_unlock_bh(&log->lock);
 		mutex_unlock(&log->mutex);
 
 		file->private_data = reader;
@@ -432,7 +816,11 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
+		struct logger_log *log = reader->log;
+
+		spin_lock_bh(&log->lock);
 		list_del(&reader->list);
+		spin_unlock_bh(&log->lock);
 		kfree(reader);
 	}
 
@@ -462,22 +850,49 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	spin_lock_bh(&log->lock);
+	if (reader->in_archive || log->c_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock_bh(&log->lock);
 
 	return ret;
 }
 
+/*
+ * logger_archive_flush - drops the whole archive of 'log'
+ *
+ * The caller needs to hold log->mutex and log->lock.
+ */
+static void logger_archive_flush(struct logger_log *log)
+{
+	struct logger_segment *seg, *tmp;
+
+	list_for_each_entry_safe(seg, tmp, &log->segments, list) {
+		list_del(&seg->list);
+		kfree(seg);
+	}
+	log->arch_bytes = 0;
+	log->abuf_seg = NULL;
+	log->arch_pos = log->c_pos;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	unsigned char *entry = NULL;
 	long ret = -ENOTTY;
 
 	mutex_lock(&log->mutex);
 
+	if (cmd == LOGGER_GET_NEXT_ENTRY_LEN && (file->f_mode & FMODE_READ)) {
+		reader = file->private_data;
+		if (reader->in_archive)
+			entry = logger_archive_entry(log, reader);
+	}
+
+	spin_lock_bh(&log->lock);
+
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -488,10 +903,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		if (reader->in_archive)
+			ret = log->c_pos - reader->a_pos;
+		else if (log->c_off >= reader->r_off)
+			ret = log->c_off - reader->r_off;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret = (log->size - reader->r_off) + log->c_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -499,7 +916,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
+		if (entry)
+			ret = logger_archive_entry_len(entry);
+		else if (log->c_off != reader->r_off)
 			ret = get_entry_len(log, reader->r_off);
 		else
 			ret = 0;
@@ -509,13 +928,18 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		list_for_each_entry(reader, &log->readers, list) {
+			reader->r_off = log->c_off;
+			reader->in_archive = 0;
+		}
+		log->head = log->c_off;
+		log->head_pos = log->c_pos;
+		logger_archive_flush(log);
 		ret = 0;
 		break;
 	}
 
+	spin_unlock_bh(&log->lock);
 	mutex_unlock(&log->mutex);
 
 	return ret;
@@ -539,8 +963,10 @@ static const struct file_operations logger_fops = {
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
 static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _rbuf_ ## VAR[LOGGER_ENTRY_MAX_LEN]; \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
+	.rbuf = _rbuf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -548,9 +974,14 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
+	.commit_wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .commit_wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
+	.pending = LIST_HEAD_INIT(VAR .pending), \
+	.segments = LIST_HEAD_INIT(VAR .segments), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.c_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -573,10 +1004,228 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+static struct logger_log *logger_logs[] = {
+	&log_main, &log_events, &log_radio, &log_system,
+};
+
+/* scratch space of the archive worker */
+static unsigned char *logger_archive_src;
+static unsigned char *logger_archive_dst;
+static void *logger_archive_wrkmem;
+
+/*
+ * logger_archive_log - compresses a segment of whole entries at a time into
+ * the archive of 'log', until less than half the log is left unarchived
+ *
+ * Entries are copied out of the ring without log->lock; the copy is thrown
+ * away if a writer wrapped over them meanwhile, which shows in head_pos.
+ */
+static void logger_archive_log(struct logger_log *log)
+{
+	size_t seg_max = log->size / LOGGER_SEGMENTS_PER_LOG;
+	struct logger_segment *seg;
+	size_t off, len, n, clen;
+	ktime_t start;
+	u64 pos;
+	int torn;
+
+	mutex_lock(&log->mutex);
+
+	for (;;) {
+		spin_lock_bh(&log->lock);
+		if (log->arch_pos < log->head_pos) {
+			log->stats.archive_lost += log->head_pos - log->arch_pos;
+			log->arch_pos = log->head_pos;
+		}
+		if (log->c_pos - log->arch_pos < log->size / 2) {
+			spin_unlock_bh(&log->lock);
+			break;
+		}
+
+		pos = log->arch_pos;
+		off = logger_offset(pos);
+		len = 0;
+		for (;;) {
+			n = get_entry_len(log, logger_offset(off + len));
+			if (len + n > seg_max)
+				break;
+			len += n;
+		}
+		spin_unlock_bh(&log->lock);
+
+		n = min(len, log->size - off);
+		memcpy(logger_archive_src, log->buffer + off, n);
+		if (len != n)
+			memcpy(logger_archive_src + n, log->buffer, len - n);
+
+		smp_rmb();
+		spin_lock_bh(&log->lock);
+		torn = log->head_pos > pos;
+		if (!torn)
+			log->arch_pos = pos + len;
+		spin_unlock_bh(&log->lock);
+		if (torn)
+			continue;
+
+		start = ktime_get();
+		lzo1x_1_compress(logger_archive_src, len, logger_archive_dst,
+				 &clen, logger_archive_wrkmem);
+
+		seg = kmalloc(sizeof(*seg) + clen, GFP_KERNEL);
+		if (seg) {
+			seg->pos = pos;
+			seg->len = len;
+			seg->clen = clen;
+			memcpy(seg->data, logger_archive_dst, clen);
+			list_add_tail(&seg->list, &log->segments);
+			log->arch_bytes += clen;
+		}
+
+		spin_lock_bh(&log->lock);
+		log->stats.compress_ns +=
+			ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (seg) {
+			log->stats.archive_raw += len;
+			log->stats.archive_packed += clen;
+		} else
+			log->stats.archive_lost += len;
+		spin_unlock_bh(&log->lock);
+
+		/* drop the oldest segments; their readers skip ahead */
+		while (log->arch_bytes > logger_archive_kb << 10) {
+			seg = list_first_entry(&log->segments,
+					       struct logger_segment, list);
+			list_del(&seg->list);
+			log->arch_bytes -= seg->clen;
+			if (log->abuf_seg == seg)
+				log->abuf_seg = NULL;
+			kfree(seg);
+		}
+	}
+
+	mutex_unlock(&log->mutex);
+}
+
+static void logger_archive_worker(struct work_struct *work)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(logger_logs); i++)
+		if (logger_logs[i]->abuf)
+			logger_archive_log(logger_logs[i]);
+}
+
+/*
+ * logger_archive_init - sets up the archives if they were asked for; the
+ * logs just go without one if memory can't be found for it
+ */
+static void __init logger_archive_init(void)
+{
+	size_t seg_max = 0;
+	int i;
+
+	if (!logger_compress)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(logger_logs); i++)
+		seg_max = max(seg_max,
+			      logger_logs[i]->size / LOGGER_SEGMENTS_PER_LOG);
+
+	logger_wq = create_singlethread_workqueue("logger");
+	logger_archive_src = vmalloc(seg_max);
+	logger_archive_dst = vmalloc(lzo1x_worst_compress(seg_max));
+	logger_archive_wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (!logger_wq || !logger_archive_src || !logger_archive_dst ||
+	    !logger_archive_wrkmem)
+		goto fail;
+
+	for (i = 0; i < ARRAY_SIZE(logger_logs); i++) {
+		struct logger_log *log = logger_logs[i];
+
+		log->abuf = vmalloc(log->size / LOGGER_SEGMENTS_PER_LOG);
+		if (!log->abuf)
+			printk(KERN_ERR "logger: no memory to archive log "
+			       "'%s'\n", log->misc.name);
+	}
+
+	return;
+
+fail:
+	printk(KERN_ERR "logger: no memory for the log archives\n");
+	vfree(logger_archive_wrkmem);
+	vfree(logger_archive_dst);
+	vfree(logger_archive_src);
+	if (logger_wq)
+		destroy_workqueue(logger_wq);
+}
+#else
+static inline void logger_archive_init(void)
+{
+}
+#endif
+
+static struct dentry *logger_debugfs_dir;
+
+static int logger_stats_show(struct seq_file *m, void *unused)
+{
+	struct logger_log *log = m->private;
+	struct logger_stats stats;
+	size_t in_flight, arch_bytes;
+
+	mutex_lock(&log->mutex);
+	spin_lock_bh(&log->lock);
+	stats = log->stats;
+	in_flight = logger_offset(log->w_off - log->c_off);
+	arch_bytes = log->arch_bytes;
+	spin_unlock_bh(&log->lock);
+	mutex_unlock(&log->mutex);
+
+	seq_printf(m, "writes: %llu\n", stats.writes);
+	seq_printf(m, "bytes: %llu\n", stats.bytes);
+	seq_printf(m, "dropped: %llu\n", stats.dropped);
+	seq_printf(m, "wakeups: %llu\n", stats.wakeups);
+	seq_printf(m, "in_flight: %zu\n", in_flight);
+	seq_printf(m, "write_latency_avg_ns: %llu\n", stats.writes ?
+		   div64_u64(stats.lat_total_ns, stats.writes) : 0ULL);
+	seq_printf(m, "write_latency_max_ns: %llu\n", stats.lat_max_ns);
+
+	if (!log->abuf)
+		return 0;
+
+	seq_printf(m, "archive_bytes: %zu\n", arch_bytes);
+	seq_printf(m, "archive_raw: %llu\n", stats.archive_raw);
+	seq_printf(m, "archive_packed: %llu\n", stats.archive_packed);
+	seq_printf(m, "archive_ratio_pct: %llu\n", stats.archive_packed ?
+		   div64_u64(stats.archive_raw * 100, stats.archive_packed) :
+		   0ULL);
+	seq_printf(m, "archive_lost: %llu\n", stats.archive_lost);
+	seq_printf(m, "compress_ns: %llu\n", stats.compress_ns);
+	seq_printf(m, "decompressions: %llu\n", stats.decompressions);
+	seq_printf(m, "decompress_ns: %llu\n", stats.decompress_ns);
+
+	return 0;
+}
+
+static int logger_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, logger_stats_show, inode->i_private);
+}
+
+static const struct file_operations logger_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = logger_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	setup_timer(&log->wake_timer, logger_wake_timer, (unsigned long) log);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -587,6 +1236,11 @@ static int __init init_log(struct logger_log *log)
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
 
+	if (logger_debugfs_dir)
+		debugfs_create_file(log->misc.name, S_IRUGO,
+				    logger_debugfs_dir, log,
+				    &logger_stats_fops);
+
 	return 0;
 }
 
@@ -594,6 +1248,9 @@ static int __init logger_init(void)
 {
 	int ret;
 
+	logger_debugfs_dir = debugfs_create_dir("logger", NULL);
+	logger_archive_init();
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
 		goto out;
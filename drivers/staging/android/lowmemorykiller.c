@@ -16,6 +16,17 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes whose /proc/<pid>/oom_adj has been written are kept in per
+ * oom_adj buckets, so picking a victim only looks at the highest populated
+ * bucket instead of walking every task. The full task list is only walked
+ * when no indexed process qualifies. Kill and scan statistics are exported
+ * in /sys/module/lowmemorykiller/parameters as well.
+ *
+ * Before anything is killed, /dev/mem_pressure reports graded pressure
+ * levels computed from the share of scanned pages reclaim failed to free
+ * and from how close free memory is to the largest minfree threshold. The
+ * device can be polled and read, or an eventfd can be attached to it.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +46,18 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/miscdevice.h>
+#include <linux/eventfd.h>
+#include <linux/uaccess.h>
+#include <linux/vmstat.h>
+
+#include "lowmemorykiller.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,6 +78,32 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+static unsigned int lowmem_kill_count;
+static unsigned int lowmem_scan_count;
+static unsigned int lowmem_fallback_scan_count;
+static unsigned long lowmem_scan_usecs;
+static unsigned long lowmem_max_scan_usecs;
+
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define LOWMEM_TASK_HASH_BITS	6
+
+struct lowmem_task {
+	struct list_head adj_entry;
+	struct hlist_node hash_entry;
+	struct task_struct *task;	/* thread group leader */
+	int oom_adj;
+	int tasksize;			/* rss when last scanned */
+};
+
+/*
+ * Protects the buckets and the hash. Taken from the task free notifier,
+ * which runs from an rcu callback, so interrupts are disabled.
+ */
+static DEFINE_SPINLOCK(lowmem_task_lock);
+static struct list_head lowmem_adj_bucket[LOWMEM_ADJ_BUCKETS];
+static DECLARE_BITMAP(lowmem_adj_map, LOWMEM_ADJ_BUCKETS);
+static struct hlist_head lowmem_task_hash[1 << LOWMEM_TASK_HASH_BITS];
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -68,17 +117,430 @@ static struct notifier_block task_nb = {
 	.notifier_call	= task_notify_func,
 };
 
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val,
+		    void *data);
+
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+static struct hlist_head *lowmem_task_bucket(struct task_struct *task)
+{
+	return &lowmem_task_hash[hash_ptr(task, LOWMEM_TASK_HASH_BITS)];
+}
+
+static struct lowmem_task *lowmem_task_find(struct task_struct *task)
+{
+	struct lowmem_task *lt;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(lt, pos, lowmem_task_bucket(task), hash_entry)
+		if (lt->task == task)
+			return lt;
+	return NULL;
+}
+
+static void lowmem_task_link(struct lowmem_task *lt, int oom_adj)
+{
+	int i = oom_adj - OOM_DISABLE;
+
+	lt->oom_adj = oom_adj;
+	list_add_tail(&lt->adj_entry, &lowmem_adj_bucket[i]);
+	__set_bit(i, lowmem_adj_map);
+}
+
+static void lowmem_task_unlink(struct lowmem_task *lt)
+{
+	int i = lt->oom_adj - OOM_DISABLE;
+
+	list_del(&lt->adj_entry);
+	if (list_empty(&lowmem_adj_bucket[i]))
+		__clear_bit(i, lowmem_adj_map);
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
 	struct task_struct *task = data;
+	struct lowmem_task *lt;
+	unsigned long flags;
 
 	if (task == lowmem_deathpending)
 		lowmem_deathpending = NULL;
 
+	spin_lock_irqsave(&lowmem_task_lock, flags);
+	lt = lowmem_task_find(task);
+	if (lt) {
+		lowmem_task_unlink(lt);
+		hlist_del(&lt->hash_entry);
+	}
+	spin_unlock_irqrestore(&lowmem_task_lock, flags);
+	kfree(lt);
+
+	return NOTIFY_OK;
+}
+
+/*
+ * Only thread group leaders are indexed; they are what the tasklist walk
+ * below would pick and they stay around until the whole group is reaped.
+ * oom_adj is shared by the whole group, so a write through
+ * /proc/<pid>/task/<tid>/oom_adj moves the leader. do_fork() reports a
+ * non-zero oom_adj inherited by a new process, so only processes left at
+ * the default of 0 are missing from the index.
+ */
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val,
+		    void *data)
+{
+	struct task_struct *task = ((struct task_struct *)data)->group_leader;
+	struct lowmem_task *lt, *new;
+	unsigned long flags;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+
+	spin_lock_irqsave(&lowmem_task_lock, flags);
+	lt = lowmem_task_find(task);
+	if (lt) {
+		lowmem_task_unlink(lt);
+	} else if (new && pid_alive(task)) {
+		lt = new;
+		new = NULL;
+		lt->task = task;
+		hlist_add_head(&lt->hash_entry, lowmem_task_bucket(task));
+	}
+	if (lt)
+		lowmem_task_link(lt, (int)val);
+	spin_unlock_irqrestore(&lowmem_task_lock, flags);
+	kfree(new);
+
 	return NOTIFY_OK;
 }
 
+static void lowmem_kill(struct task_struct *selected, int oom_adj,
+			int tasksize)
+{
+	lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
+		     selected->pid, selected->comm, oom_adj, tasksize);
+	lowmem_deathpending = selected;
+	lowmem_deathpending_timeout = jiffies + HZ;
+	lowmem_kill_count++;
+	force_sig(SIGKILL, selected);
+}
+
+/*
+ * Pick the largest process in the highest populated oom_adj bucket at or
+ * above min_adj. Returns the rss of the killed process, or 0 if no
+ * indexed process qualified.
+ */
+static int lowmem_shrink_indexed(int min_adj)
+{
+	struct lowmem_task *lt;
+	struct task_struct *selected = NULL;
+	int selected_tasksize = 0;
+	int selected_oom_adj = 0;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&lowmem_task_lock, flags);
+	i = find_last_bit(lowmem_adj_map, LOWMEM_ADJ_BUCKETS);
+	if (i == LOWMEM_ADJ_BUCKETS)
+		i = -1;
+	for (; i >= min_adj - OOM_DISABLE && !selected; i--) {
+		if (!test_bit(i, lowmem_adj_map))
+			continue;
+		list_for_each_entry(lt, &lowmem_adj_bucket[i], adj_entry) {
+			struct task_struct *p = lt->task;
+
+			task_lock(p);
+			lt->tasksize = p->mm ? get_mm_rss(p->mm) : 0;
+			task_unlock(p);
+			if (lt->tasksize <= 0 ||
+			    lt->tasksize <= selected_tasksize)
+				continue;
+			selected = p;
+			selected_tasksize = lt->tasksize;
+			selected_oom_adj = lt->oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm,
+				     selected_oom_adj, selected_tasksize);
+		}
+	}
+	if (selected)
+		lowmem_kill(selected, selected_oom_adj, selected_tasksize);
+	spin_unlock_irqrestore(&lowmem_task_lock, flags);
+	return selected_tasksize;
+}
+
+/* Percent of scanned pages left unreclaimed for each pressure level */
+static unsigned int lowmem_pressure_medium = 60;
+static unsigned int lowmem_pressure_critical = 95;
+/* Report medium pressure this many percent above the largest minfree */
+static unsigned int lowmem_pressure_margin = 50;
+/* Pages that must be scanned before the reclaim ratio is evaluated */
+static unsigned long lowmem_pressure_window = 512;
+
+struct lowmem_pressure_client {
+	struct list_head entry;
+	int level;			/* minimum level reported */
+	unsigned int seen_seq;
+	struct eventfd_ctx *eventfd;
+};
+
+/* Protects everything below and the client list */
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+static LIST_HEAD(lowmem_pressure_clients);
+static unsigned long lowmem_pressure_scanned;
+static unsigned long lowmem_pressure_reclaimed;
+static unsigned int lowmem_pressure_level;
+static unsigned int lowmem_pressure_value;
+/* Bumped for every window evaluated at or above the level */
+static unsigned int lowmem_pressure_seq[LMK_PRESSURE_LEVELS];
+
+/*
+ * Sum the reclaim scan and steal event counters without
+ * get_online_cpus(), which may sleep. The result is only used as a ratio
+ * so a racing cpu hotplug does not matter.
+ */
+static void lowmem_reclaim_stat(unsigned long *scanned,
+				unsigned long *reclaimed)
+{
+	*scanned = 0;
+	*reclaimed = 0;
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	{
+		int cpu, zone;
+
+		for_each_online_cpu(cpu) {
+			struct vm_event_state *this =
+				&per_cpu(vm_event_states, cpu);
+
+			for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+				int i = zone - ZONE_NORMAL;
+
+				*scanned += this->event[PGSCAN_KSWAPD_NORMAL + i] +
+					    this->event[PGSCAN_DIRECT_NORMAL + i];
+				*reclaimed += this->event[PGSTEAL_NORMAL + i];
+			}
+		}
+	}
+#endif
+}
+
+static void lowmem_update_pressure(int other_free, int other_file,
+				   int array_size)
+{
+	struct lowmem_pressure_client *client;
+	unsigned long scanned, reclaimed;
+	unsigned int pressure;
+	int level;
+	int minfree;
+	int i;
+
+	if (!spin_trylock(&lowmem_pressure_lock))
+		return;
+	lowmem_reclaim_stat(&scanned, &reclaimed);
+	scanned -= lowmem_pressure_scanned;
+	reclaimed -= lowmem_pressure_reclaimed;
+	if (scanned < lowmem_pressure_window) {
+		spin_unlock(&lowmem_pressure_lock);
+		return;
+	}
+	lowmem_pressure_scanned += scanned;
+	lowmem_pressure_reclaimed += reclaimed;
+
+	pressure = reclaimed >= scanned ? 0 :
+		(scanned - reclaimed) * 100 / scanned;
+	if (pressure >= lowmem_pressure_critical)
+		level = LMK_PRESSURE_CRITICAL;
+	else if (pressure >= lowmem_pressure_medium)
+		level = LMK_PRESSURE_MEDIUM;
+	else
+		level = LMK_PRESSURE_LOW;
+
+	if (array_size > 0) {
+		minfree = lowmem_minfree[array_size - 1];
+		if (other_free < minfree && other_file < minfree)
+			level = LMK_PRESSURE_CRITICAL;
+		minfree += minfree / 100 * lowmem_pressure_margin;
+		if (other_free < minfree && other_file < minfree &&
+		    level < LMK_PRESSURE_MEDIUM)
+			level = LMK_PRESSURE_MEDIUM;
+	}
+
+	lowmem_pressure_level = level;
+	lowmem_pressure_value = pressure;
+	for (i = LMK_PRESSURE_LOW; i <= level; i++)
+		lowmem_pressure_seq[i]++;
+	list_for_each_entry(client, &lowmem_pressure_clients, entry)
+		if (client->eventfd && client->level <= level)
+			eventfd_signal(client->eventfd, 1);
+	spin_unlock(&lowmem_pressure_lock);
+
+	lowmem_print(3, "lowmem pressure %u, level %d, scanned %lu\n",
+		     pressure, level, scanned);
+	wake_up_interruptible(&lowmem_pressure_wait);
+}
+
+static int lowmem_pressure_pending(struct lowmem_pressure_client *client)
+{
+	int ret;
+
+	spin_lock(&lowmem_pressure_lock);
+	ret = lowmem_pressure_seq[client->level] != client->seen_seq;
+	spin_unlock(&lowmem_pressure_lock);
+	return ret;
+}
+
+static void lowmem_pressure_get(struct lowmem_pressure_client *client,
+				struct lmk_pressure *lp)
+{
+	lp->level = lowmem_pressure_level;
+	lp->pressure = lowmem_pressure_value;
+	lp->seq = lowmem_pressure_seq[client->level];
+	lp->__pad = 0;
+}
+
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	struct lowmem_pressure_client *client;
+	int ret;
+
+	ret = nonseekable_open(inode, file);
+	if (ret)
+		return ret;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+	client->level = LMK_PRESSURE_LOW;
+
+	spin_lock(&lowmem_pressure_lock);
+	client->seen_seq = lowmem_pressure_seq[client->level];
+	list_add_tail(&client->entry, &lowmem_pressure_clients);
+	spin_unlock(&lowmem_pressure_lock);
+
+	file->private_data = client;
+	return 0;
+}
+
+static int lowmem_pressure_release(struct inode *inode, struct file *file)
+{
+	struct lowmem_pressure_client *client = file->private_data;
+
+	spin_lock(&lowmem_pressure_lock);
+	list_del(&client->entry);
+	spin_unlock(&lowmem_pressure_lock);
+	if (client->eventfd)
+		eventfd_ctx_put(client->eventfd);
+	kfree(client);
+	return 0;
+}
+
+/*
+ * Blocks until pressure at or above the level of this file has been
+ * reported since the previous read, then returns a struct lmk_pressure.
+ */
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *pos)
+{
+	struct lowmem_pressure_client *client = file->private_data;
+	struct lmk_pressure lp;
+	int ret;
+
+	if (count < sizeof(lp))
+		return -EINVAL;
+
+	if (!lowmem_pressure_pending(client)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(lowmem_pressure_wait,
+					lowmem_pressure_pending(client));
+		if (ret)
+			return ret;
+	}
+
+	spin_lock(&lowmem_pressure_lock);
+	lowmem_pressure_get(client, &lp);
+	client->seen_seq = lp.seq;
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (copy_to_user(buf, &lp, sizeof(lp)))
+		return -EFAULT;
+	return sizeof(lp);
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	struct lowmem_pressure_client *client = file->private_data;
+
+	poll_wait(file, &lowmem_pressure_wait, wait);
+	if (lowmem_pressure_pending(client))
+		return POLLIN | POLLRDNORM | POLLPRI;
+	return 0;
+}
+
+static long lowmem_pressure_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct lowmem_pressure_client *client = file->private_data;
+	struct eventfd_ctx *eventfd = NULL;
+	struct lmk_pressure lp;
+	int val;
+
+	switch (cmd) {
+	case LMK_SET_PRESSURE_LEVEL:
+		if (get_user(val, (int __user *)arg))
+			return -EFAULT;
+		if (val < LMK_PRESSURE_LOW || val >= LMK_PRESSURE_LEVELS)
+			return -EINVAL;
+		spin_lock(&lowmem_pressure_lock);
+		client->level = val;
+		client->seen_seq = lowmem_pressure_seq[val];
+		spin_unlock(&lowmem_pressure_lock);
+		return 0;
+	case LMK_SET_PRESSURE_EVENTFD:
+		if (get_user(val, (int __user *)arg))
+			return -EFAULT;
+		if (val >= 0) {
+			eventfd = eventfd_ctx_fdget(val);
+			if (IS_ERR(eventfd))
+				return PTR_ERR(eventfd);
+		}
+		spin_lock(&lowmem_pressure_lock);
+		swap(client->eventfd, eventfd);
+		spin_unlock(&lowmem_pressure_lock);
+		if (eventfd)
+			eventfd_ctx_put(eventfd);
+		return 0;
+	case LMK_GET_PRESSURE:
+		spin_lock(&lowmem_pressure_lock);
+		lowmem_pressure_get(client, &lp);
+		spin_unlock(&lowmem_pressure_lock);
+		if (copy_to_user((void __user *)arg, &lp, sizeof(lp)))
+			return -EFAULT;
+		return 0;
+	}
+	return -ENOTTY;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.release = lowmem_pressure_release,
+	.read = lowmem_pressure_read,
+	.poll = lowmem_pressure_poll,
+	.unlocked_ioctl = lowmem_pressure_ioctl,
+	.compat_ioctl = lowmem_pressure_ioctl,
+};
+
+static struct miscdevice lowmem_pressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = LMK_PRESSURE_DEVICE,
+	.fops = &lowmem_pressure_fops,
+};
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
@@ -89,11 +551,20 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
+	ktime_t scan_start;
+	unsigned long scan_usecs;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
 
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	if (nr_to_scan > 0)
+		lowmem_update_pressure(other_free, other_file, array_size);
+
 	/*
 	 * If we already have a death outstanding, then
 	 * bail out right away; indicating to vmscan
@@ -105,10 +576,6 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
@@ -131,6 +598,15 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	}
 	selected_oom_adj = min_adj;
 
+	scan_start = ktime_get();
+	lowmem_scan_count++;
+	selected_tasksize = lowmem_shrink_indexed(min_adj);
+	if (selected_tasksize) {
+		rem -= selected_tasksize;
+		goto out;
+	}
+
+	lowmem_fallback_scan_count++;
 	read_lock(&tasklist_lock);
 	for_each_process(p) {
 		struct mm_struct *mm;
@@ -167,17 +643,17 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     p->pid, p->comm, oom_adj, tasksize);
 	}
 	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
+		lowmem_kill(selected, selected_oom_adj, selected_tasksize);
 		rem -= selected_tasksize;
 	}
+	read_unlock(&tasklist_lock);
+out:
+	scan_usecs = ktime_to_us(ktime_sub(ktime_get(), scan_start));
+	lowmem_scan_usecs += scan_usecs;
+	if (scan_usecs > lowmem_max_scan_usecs)
+		lowmem_max_scan_usecs = scan_usecs;
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -188,15 +664,36 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	int i;
+	int ret;
+
+	for (i = 0; i < LOWMEM_ADJ_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_adj_bucket[i]);
+	lowmem_reclaim_stat(&lowmem_pressure_scanned,
+			    &lowmem_pressure_reclaimed);
+	ret = misc_register(&lowmem_pressure_misc);
+	if (ret)
+		return ret;
 	task_free_register(&task_nb);
+	register_oom_adj_notifier(&oom_adj_nb);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct lowmem_task *lt, *tmp;
+	int i;
+
 	unregister_shrinker(&lowmem_shrinker);
+	misc_deregister(&lowmem_pressure_misc);
+	unregister_oom_adj_notifier(&oom_adj_nb);
 	task_free_unregister(&task_nb);
+	for (i = 0; i < LOWMEM_ADJ_BUCKETS; i++) {
+		list_for_each_entry_safe(lt, tmp, &lowmem_adj_bucket[i],
+					 adj_entry)
+			kfree(lt);
+	}
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -205,6 +702,20 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(kill_count, lowmem_kill_count, uint, S_IRUGO);
+module_param_named(scan_count, lowmem_scan_count, uint, S_IRUGO);
+module_param_named(fallback_scan_count, lowmem_fallback_scan_count, uint,
+		   S_IRUGO);
+module_param_named(scan_usecs, lowmem_scan_usecs, ulong, S_IRUGO);
+module_param_named(max_scan_usecs, lowmem_max_scan_usecs, ulong, S_IRUGO);
+module_param_named(pressure_medium, lowmem_pressure_medium, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_margin, lowmem_pressure_margin, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_window, lowmem_pressure_window, ulong,
+		   S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
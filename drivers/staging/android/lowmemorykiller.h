@@ -0,0 +1,44 @@
+/* drivers/staging/android/lowmemorykiller.h
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _LINUX_LOWMEMORYKILLER_H
+#define _LINUX_LOWMEMORYKILLER_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define LMK_PRESSURE_DEVICE	"mem_pressure"
+
+enum {
+	LMK_PRESSURE_NONE,
+	LMK_PRESSURE_LOW,	/* reclaim is running */
+	LMK_PRESSURE_MEDIUM,	/* reclaim is struggling, trim caches */
+	LMK_PRESSURE_CRITICAL,	/* processes are about to be killed */
+	LMK_PRESSURE_LEVELS
+};
+
+/* Returned by read() and LMK_GET_PRESSURE */
+struct lmk_pressure {
+	__u32	level;		/* LMK_PRESSURE_* */
+	__u32	pressure;	/* 0-100, unreclaimed share of scanned pages */
+	__u32	seq;		/* events at or above the level of this file */
+	__u32	__pad;
+};
+
+#define __LMKIO	0xAF
+
+#define LMK_SET_PRESSURE_LEVEL		_IOW(__LMKIO, 1, int) /* min level */
+#define LMK_SET_PRESSURE_EVENTFD	_IOW(__LMKIO, 2, int) /* eventfd */
+#define LMK_GET_PRESSURE		_IOR(__LMKIO, 3, struct lmk_pressure)
+
+#endif /* _LINUX_LOWMEMORYKILLER_H */
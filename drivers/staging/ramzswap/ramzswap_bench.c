@@ -0,0 +1,270 @@
+/*
+ * ramzswap concurrency test and throughput benchmark
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Writes and then reads back pages of an initialized, unused ramzswap
+ * device from 1, 2, ... N threads, each bound to its own CPU, and prints
+ * the swap-out and swap-in throughput for every thread count. Each page
+ * read back is compared with the page written to that slot; a mismatch
+ * fails the load with -EILSEQ, and a clean run loads normally and leaves
+ * the device empty again:
+ *
+ *	rzscontrol /dev/ramzswap0 --init
+ *	modprobe ramzswap_bench dev=/dev/ramzswap0 pages=16384
+ *	dmesg | grep ramzswap_bench
+ *	rmmod ramzswap_bench
+ */
+
+#define KMSG_COMPONENT "ramzswap_bench"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+
+/* Module params (documentation at end) */
+static char *dev = "/dev/ramzswap0";
+static unsigned int pages = 8192;
+static unsigned int max_threads;
+
+struct bench_thread {
+	struct block_device *bdev;
+	unsigned long first;		/* first swap slot used */
+	unsigned long count;		/* number of slots used */
+	s64 write_ns;
+	s64 read_ns;
+	int err;
+	struct completion done;
+};
+
+static void bench_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int bench_rw(struct block_device *bdev, int rw, struct page *page,
+		    unsigned long index)
+{
+	DECLARE_COMPLETION_ONSTACK(wait);
+	struct bio *bio;
+	int ret = 0;
+
+	bio = bio_alloc(GFP_KERNEL, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = bdev;
+	bio->bi_sector = index << (PAGE_SHIFT - 9);
+	bio->bi_end_io = bench_end_io;
+	bio->bi_private = &wait;
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+
+	submit_bio(rw, bio);
+	wait_for_completion(&wait);
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ret = -EIO;
+	bio_put(bio);
+	return ret;
+}
+
+/*
+ * Roughly 2:1 compressible content: the first half of the page is random,
+ * the second half repeats a pattern. The first word is overwritten with
+ * the slot number before each write, see bench_slot().
+ */
+static void bench_fill(struct page *page, unsigned long index)
+{
+	u32 *p = kmap(page);
+	int i;
+
+	get_random_bytes(p, PAGE_SIZE / 2);
+	for (i = PAGE_SIZE / 2 / sizeof(*p); i < PAGE_SIZE / sizeof(*p); i++)
+		p[i] = index + (i & 0xf);
+	kunmap(page);
+}
+
+/* Make @page the content written to, and expected back from, @index */
+static void bench_slot(struct page *page, unsigned long index)
+{
+	*(u32 *)page_address(page) = index;
+}
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_thread *bt = data;
+	struct page *src, *dst;
+	unsigned long i;
+	ktime_t start;
+	int ret = 0;
+
+	src = alloc_page(GFP_KERNEL);
+	dst = alloc_page(GFP_KERNEL);
+	if (!src || !dst) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	bench_fill(src, bt->first);
+
+	start = ktime_get();
+	for (i = 0; i < bt->count && !ret; i++) {
+		bench_slot(src, bt->first + i);
+		ret = bench_rw(bt->bdev, WRITE, src, bt->first + i);
+	}
+	bt->write_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret)
+		goto out;
+
+	start = ktime_get();
+	for (i = 0; i < bt->count && !ret; i++) {
+		ret = bench_rw(bt->bdev, READ, dst, bt->first + i);
+		if (ret)
+			break;
+		bench_slot(src, bt->first + i);
+		if (memcmp(page_address(src), page_address(dst), PAGE_SIZE)) {
+			pr_err("slot %lu: data read back differs\n",
+				bt->first + i);
+			ret = -EILSEQ;
+		}
+	}
+	bt->read_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+out:
+	if (bt->bdev->bd_disk->fops->swap_slot_free_notify)
+		for (i = 0; i < bt->count; i++)
+			bt->bdev->bd_disk->fops->swap_slot_free_notify(
+				bt->bdev, bt->first + i);
+	if (src)
+		__free_page(src);
+	if (dst)
+		__free_page(dst);
+	bt->err = ret;
+	complete(&bt->done);
+	return 0;
+}
+
+static unsigned long bench_kbps(unsigned long nr_pages, s64 ns)
+{
+	if (ns <= 0)
+		return 0;
+	return div64_u64((u64)nr_pages * (PAGE_SIZE >> 10) * NSEC_PER_SEC, ns);
+}
+
+static int bench_run(struct block_device *bdev, int nr_threads)
+{
+	struct bench_thread *bt;
+	unsigned long per_thread;
+	s64 write_ns = 0, read_ns = 0;
+	int cpu, i, ret = 0;
+
+	bt = kcalloc(nr_threads, sizeof(*bt), GFP_KERNEL);
+	if (!bt)
+		return -ENOMEM;
+
+	/* slot 0 holds the swap header */
+	per_thread = pages / nr_threads;
+	i = 0;
+	for_each_online_cpu(cpu) {
+		struct task_struct *tsk;
+
+		if (i == nr_threads)
+			break;
+		bt[i].bdev = bdev;
+		bt[i].first = 1 + i * per_thread;
+		bt[i].count = per_thread;
+		init_completion(&bt[i].done);
+
+		tsk = kthread_create(bench_thread_fn, &bt[i],
+				     "rzs_bench/%d", cpu);
+		if (IS_ERR(tsk)) {
+			ret = PTR_ERR(tsk);
+			break;
+		}
+		kthread_bind(tsk, cpu);
+		wake_up_process(tsk);
+		i++;
+	}
+
+	while (i--) {
+		wait_for_completion(&bt[i].done);
+		if (bt[i].err && !ret)
+			ret = bt[i].err;
+		write_ns = max(write_ns, bt[i].write_ns);
+		read_ns = max(read_ns, bt[i].read_ns);
+	}
+
+	if (!ret)
+		pr_info("%d thread(s): swap-out %lu kB/s, swap-in %lu kB/s\n",
+			nr_threads,
+			bench_kbps(per_thread * nr_threads, write_ns),
+			bench_kbps(per_thread * nr_threads, read_ns));
+	else
+		pr_err("%d thread(s): failed, err=%d\n", nr_threads, ret);
+
+	kfree(bt);
+	return ret;
+}
+
+static int __init ramzswap_bench_init(void)
+{
+	struct block_device *bdev;
+	fmode_t mode = FMODE_READ | FMODE_WRITE;
+	int nr_threads, threads;
+	int ret = 0;
+
+	bdev = open_bdev_exclusive(dev, mode, ramzswap_bench_init);
+	if (IS_ERR(bdev)) {
+		pr_err("cannot open %s: %ld\n", dev, PTR_ERR(bdev));
+		return PTR_ERR(bdev);
+	}
+
+	if (((u64)pages + 1) << PAGE_SHIFT > i_size_read(bdev->bd_inode)) {
+		pr_err("%s is not initialized or smaller than %u pages\n",
+			dev, pages + 1);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	threads = num_online_cpus();
+	if (max_threads && max_threads < threads)
+		threads = max_threads;
+
+	for (nr_threads = 1; nr_threads <= threads && !ret; nr_threads++)
+		ret = bench_run(bdev, nr_threads);
+
+out:
+	close_bdev_exclusive(bdev, mode);
+	return ret;
+}
+
+static void __exit ramzswap_bench_exit(void)
+{
+}
+
+module_param(dev, charp, 0);
+MODULE_PARM_DESC(dev, "ramzswap device to benchmark (must not be swapped on)");
+module_param(pages, uint, 0);
+MODULE_PARM_DESC(pages, "Pages written and read back per run");
+module_param(max_threads, uint, 0);
+MODULE_PARM_DESC(max_threads, "Largest thread count (default: online CPUs)");
+
+module_init(ramzswap_bench_init);
+module_exit(ramzswap_bench_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("ramzswap concurrency test and throughput benchmark");
@@ -24,7 +24,10 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/crypto.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/sched.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
@@ -38,6 +41,7 @@ static struct ramzswap *devices;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
+static unsigned int dedup = 1;
 
 static int rzs_test_flag(struct ramzswap *rzs, u32 index,
 			enum rzs_pageflags flag)
@@ -119,23 +123,25 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 			struct ramzswap_ioctl_stats *s)
 {
 	s->disksize = rzs->disksize;
+	memcpy(s->compressor, rzs->compressor, sizeof(s->compressor));
 
 #if defined(CONFIG_RAMZSWAP_STATS)
 	{
 	struct ramzswap_stats *rs = &rzs->stats;
 	size_t succ_writes, mem_used;
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
+	u32 pages_stored = atomic_read(&rs->pages_stored);
+	u32 pages_expand = atomic_read(&rs->pages_expand);
 
 	mem_used = xv_get_total_size_bytes(rzs->mem_pool)
-			+ (rs->pages_expand << PAGE_SHIFT);
+			+ ((size_t)pages_expand << PAGE_SHIFT);
 	succ_writes = rzs_stat64_read(rzs, &rs->num_writes) -
 			rzs_stat64_read(rzs, &rs->failed_writes);
 
-	if (succ_writes && rs->pages_stored) {
-		good_compress_perc = rs->good_compress * 100
-					/ rs->pages_stored;
-		no_compress_perc = rs->pages_expand * 100
-					/ rs->pages_stored;
+	if (succ_writes && pages_stored) {
+		good_compress_perc = atomic_read(&rs->good_compress) * 100
+					/ pages_stored;
+		no_compress_perc = pages_expand * 100 / pages_stored;
 	}
 
 	s->num_reads = rzs_stat64_read(rzs, &rs->num_reads);
@@ -144,24 +150,118 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	s->failed_writes = rzs_stat64_read(rzs, &rs->failed_writes);
 	s->invalid_io = rzs_stat64_read(rzs, &rs->invalid_io);
 	s->notify_free = rzs_stat64_read(rzs, &rs->notify_free);
-	s->pages_zero = rs->pages_zero;
+	s->pages_zero = atomic_read(&rs->pages_zero);
 
 	s->good_compress_pct = good_compress_perc;
 	s->pages_expand_pct = no_compress_perc;
 
-	s->pages_stored = rs->pages_stored;
+	s->pages_stored = pages_stored;
 	s->pages_used = mem_used >> PAGE_SHIFT;
-	s->orig_data_size = rs->pages_stored << PAGE_SHIFT;
-	s->compr_data_size = rs->compr_size;
+	s->orig_data_size = (u64)pages_stored << PAGE_SHIFT;
+	s->compr_data_size = atomic64_read(&rs->compr_size);
 	s->mem_used_total = mem_used;
+
+	s->dedup_hits = rzs_stat64_read(rzs, &rs->dedup_hits);
+	s->pages_shared = atomic_read(&rs->pages_shared);
+	if (s->orig_data_size)
+		s->compr_ratio_pct = div64_u64(s->compr_data_size * 100,
+					       s->orig_data_size);
+	s->compress_ns = rzs_stat64_read(rzs, &rs->compress_ns);
+	s->decompress_ns = rzs_stat64_read(rzs, &rs->decompress_ns);
 	}
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
 
+static struct hlist_head *dedup_bucket(struct ramzswap *rzs, u32 checksum)
+{
+	return &rzs->dedup_hash[hash_32(checksum, RZS_DEDUP_HASH_BITS)];
+}
+
+/*
+ * Look for a stored object with the same compressed data as 'src' and
+ * take a reference on it. Returns NULL if there is none.
+ *
+ * Identical pages compress identically, so comparing the compressed
+ * bytes is both cheaper than comparing pages and exact.
+ */
+static struct rzs_dedup_entry *dedup_get(struct ramzswap *rzs, u32 checksum,
+					 const void *src, size_t clen)
+{
+	struct rzs_dedup_entry *de;
+	struct hlist_node *pos;
+	unsigned char *cmem;
+	int match;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_for_each_entry(de, pos, dedup_bucket(rzs, checksum), node) {
+		if (de->checksum != checksum)
+			continue;
+
+		cmem = kmap_atomic(de->page, KM_USER1) + de->offset;
+		match = xv_get_object_size(cmem) ==
+				clen + sizeof(struct zobj_header) &&
+			!memcmp(cmem + sizeof(struct zobj_header), src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+
+		if (match) {
+			de->refcount++;
+			spin_unlock(&rzs->dedup_lock);
+			return de;
+		}
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	return NULL;
+}
+
+static void dedup_add(struct ramzswap *rzs, struct rzs_dedup_entry *de,
+		      u32 checksum, struct page *page, u16 offset)
+{
+	de->checksum = checksum;
+	de->page = page;
+	de->offset = offset;
+	de->refcount = 1;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_add_head(&de->node, dedup_bucket(rzs, checksum));
+	spin_unlock(&rzs->dedup_lock);
+}
+
+/*
+ * Drop a reference on the object at page/offset. Returns non-zero if
+ * other slots still use it, in which case it must not be freed.
+ */
+static int dedup_put(struct ramzswap *rzs, u32 checksum, struct page *page,
+		     u16 offset)
+{
+	struct rzs_dedup_entry *de;
+	struct hlist_node *pos;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_for_each_entry(de, pos, dedup_bucket(rzs, checksum), node) {
+		if (de->page != page || de->offset != offset)
+			continue;
+
+		if (--de->refcount) {
+			spin_unlock(&rzs->dedup_lock);
+			rzs_stat_dec(&rzs->stats.pages_shared);
+			return 1;
+		}
+		hlist_del(&de->node);
+		spin_unlock(&rzs->dedup_lock);
+		kfree(de);
+		return 0;
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	return 0;
+}
+
 static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
-	u32 clen;
+	u32 clen, checksum;
 	void *obj;
+	int shared = 0;
 
 	struct page *page = rzs->table[index].page;
 	u32 offset = rzs->table[index].offset;
@@ -188,14 +288,19 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 
 	obj = kmap_atomic(page, KM_USER0) + offset;
 	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
+	checksum = ((struct zobj_header *)obj)->checksum;
 	kunmap_atomic(obj, KM_USER0);
 
-	xv_free(rzs->mem_pool, page, offset);
+	if (rzs->dedup_hash)
+		shared = dedup_put(rzs, checksum, page, offset);
+	if (!shared)
+		xv_free(rzs->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_dec(&rzs->stats.good_compress);
 
 out:
-	rzs->stats.compr_size -= clen;
+	if (!shared)
+		atomic64_sub(clen, &rzs->stats.compr_size);
 	rzs_stat_dec(&rzs->stats.pages_stored);
 
 	rzs->table[index].page = NULL;
@@ -265,9 +370,11 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
 	u32 index;
-	size_t clen;
+	unsigned int clen;
+	u64 start;
 	struct page *page;
 	struct zobj_header *zheader;
+	struct rzs_stream *stream;
 	unsigned char *user_mem, *cmem;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
@@ -292,16 +399,20 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
 			rzs->table[index].offset;
 
-	ret = lzo1x_decompress_safe(
+	/* kmap_atomic() disabled preemption, so the stream stays ours */
+	stream = per_cpu_ptr(rzs->streams, smp_processor_id());
+	start = sched_clock();
+	ret = crypto_comp_decompress(stream->dtfm,
 		cmem + sizeof(*zheader),
 		xv_get_object_size(cmem) - sizeof(*zheader),
 		user_mem, &clen);
+	rzs_stat64_add(rzs, &rzs->stats.decompress_ns, sched_clock() - start);
 
 	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret || clen != PAGE_SIZE)) {
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
@@ -319,13 +430,21 @@ out:
 	return 0;
 }
 
+/*
+ * Writes to different slots run in parallel, each compressing into the
+ * stream of its CPU. The swap layer never reads, writes or frees the same
+ * slot concurrently, so table entries need no locking either.
+ */
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
-	u32 offset, index;
-	size_t clen;
+	u32 offset, index, checksum = 0;
+	unsigned int clen;
+	u64 start;
 	struct zobj_header *zheader;
 	struct page *page, *page_store;
+	struct rzs_stream *stream;
+	struct rzs_dedup_entry *de = NULL;
 	unsigned char *user_mem, *cmem, *src;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
@@ -333,14 +452,9 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
-
-	mutex_lock(&rzs->lock);
-
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (page_zero_filled(user_mem)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs->lock);
 		rzs_stat_inc(&rzs->stats.pages_zero);
 		rzs_set_flag(rzs, index, RZS_ZERO);
 
@@ -348,14 +462,22 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		bio_endio(bio, 0);
 		return 0;
 	}
+	kunmap_atomic(user_mem, KM_USER0);
+
+	stream = per_cpu_ptr(rzs->streams, raw_smp_processor_id());
+	mutex_lock(&stream->lock);
+	src = stream->buffer;
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = 2 * PAGE_SIZE;
+	start = sched_clock();
+	ret = crypto_comp_compress(stream->tfm, user_mem, PAGE_SIZE, src, &clen);
+	rzs_stat64_add(rzs, &rzs->stats.compress_ns, sched_clock() - start);
 
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	if (unlikely(ret)) {
+		mutex_unlock(&stream->lock);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
@@ -370,7 +492,7 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs->lock);
+			mutex_unlock(&stream->lock);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
@@ -385,12 +507,29 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		goto memstore;
 	}
 
+	checksum = jhash(src, clen, 0);
+	if (rzs->dedup_hash) {
+		de = dedup_get(rzs, checksum, src, clen);
+		if (de) {
+			mutex_unlock(&stream->lock);
+			rzs->table[index].page = de->page;
+			rzs->table[index].offset = de->offset;
+			rzs_stat64_inc(rzs, &rzs->stats.dedup_hits);
+			rzs_stat_inc(&rzs->stats.pages_shared);
+			goto stats;
+		}
+
+		/* failing this only means the page cannot be shared */
+		de = kmalloc(sizeof(*de), GFP_NOIO);
+	}
+
 	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
 			&rzs->table[index].page, &offset,
 			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs->lock);
+		mutex_unlock(&stream->lock);
+		kfree(de);
 		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
+			"page: %u, size=%u\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
@@ -401,14 +540,15 @@ memstore:
 	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
 			rzs->table[index].offset;
 
-#if 0
-	/* Back-reference needed for memory defragmentation */
 	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
 		zheader = (struct zobj_header *)cmem;
+#if 0
+		/* Back-reference needed for memory defragmentation */
 		zheader->table_idx = index;
+#endif
+		zheader->checksum = checksum;
 		cmem += sizeof(*zheader);
 	}
-#endif
 
 	memcpy(cmem, src, clen);
 
@@ -416,14 +556,19 @@ memstore:
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
 		kunmap_atomic(src, KM_USER0);
 
+	mutex_unlock(&stream->lock);
+
+	/* Published only once the data is in place */
+	if (de)
+		dedup_add(rzs, de, checksum, rzs->table[index].page, offset);
+
 	/* Update stats */
-	rzs->stats.compr_size += clen;
+	atomic64_add(clen, &rzs->stats.compr_size);
+stats:
 	rzs_stat_inc(&rzs->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_inc(&rzs->stats.good_compress);
 
-	mutex_unlock(&rzs->lock);
-
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return 0;
@@ -484,40 +629,95 @@ static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
 	return ret;
 }
 
-static void reset_device(struct ramzswap *rzs)
+static void free_streams(struct ramzswap *rzs)
 {
-	size_t index;
+	int cpu;
 
-	/* Do not accept any new I/O request */
-	rzs->init_done = 0;
+	if (!rzs->streams)
+		return;
 
-	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
+	for_each_possible_cpu(cpu) {
+		struct rzs_stream *stream = per_cpu_ptr(rzs->streams, cpu);
 
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
+		if (stream->tfm)
+			crypto_free_comp(stream->tfm);
+		if (stream->dtfm)
+			crypto_free_comp(stream->dtfm);
+		free_pages((unsigned long)stream->buffer, 1);
+	}
+	free_percpu(rzs->streams);
+	rzs->streams = NULL;
+}
 
-	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+static int alloc_streams(struct ramzswap *rzs)
+{
+	int cpu;
+
+	if (!rzs->compressor[0])
+		strlcpy(rzs->compressor, default_compressor,
+			sizeof(rzs->compressor));
+	if (!crypto_has_comp(rzs->compressor, 0, 0)) {
+		pr_err("Compressor %s not available\n", rzs->compressor);
+		return -EINVAL;
+	}
 
-		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
+	rzs->streams = alloc_percpu(struct rzs_stream);
+	if (!rzs->streams) {
+		pr_err("Error allocating compression streams\n");
+		return -ENOMEM;
+	}
 
-		if (!page)
-			continue;
+	for_each_possible_cpu(cpu) {
+		struct rzs_stream *stream = per_cpu_ptr(rzs->streams, cpu);
+
+		mutex_init(&stream->lock);
+		stream->tfm = crypto_alloc_comp(rzs->compressor, 0, 0);
+		stream->dtfm = crypto_alloc_comp(rzs->compressor, 0, 0);
+		if (IS_ERR(stream->tfm) || IS_ERR(stream->dtfm)) {
+			if (IS_ERR(stream->tfm))
+				stream->tfm = NULL;
+			if (IS_ERR(stream->dtfm))
+				stream->dtfm = NULL;
+			pr_err("Error allocating %s compressor\n",
+				rzs->compressor);
+			return -ENOMEM;
+		}
 
-		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
+		stream->buffer = (void *)__get_free_pages(GFP_KERNEL |
+							  __GFP_ZERO, 1);
+		if (!stream->buffer) {
+			pr_err("Error allocating compressor buffer space\n");
+			return -ENOMEM;
+		}
 	}
 
+	return 0;
+}
+
+static void reset_device(struct ramzswap *rzs)
+{
+	size_t index;
+
+	/* Do not accept any new I/O request */
+	rzs->init_done = 0;
+
+	/* Free various per-device buffers */
+	free_streams(rzs);
+
+	/*
+	 * Free all pages that are still in this ramzswap device. Objects
+	 * shared by several slots are only freed with their last slot.
+	 */
+	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++)
+		ramzswap_free_page(rzs, index);
+
 	vfree(rzs->table);
 	rzs->table = NULL;
 
+	/* the last dedup_put() of each object has freed its entry */
+	kfree(rzs->dedup_hash);
+	rzs->dedup_hash = NULL;
+
 	xv_destroy_pool(rzs->mem_pool);
 	rzs->mem_pool = NULL;
 
@@ -541,18 +741,18 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
+	ret = alloc_streams(rzs);
+	if (ret)
 		goto fail;
-	}
 
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
-		goto fail;
+	if (dedup) {
+		rzs->dedup_hash = kcalloc(1 << RZS_DEDUP_HASH_BITS,
+					  sizeof(*rzs->dedup_hash), GFP_KERNEL);
+		if (!rzs->dedup_hash) {
+			pr_err("Error allocating deduplication index\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
 	}
 
 	num_pages = rzs->disksize >> PAGE_SHIFT;
@@ -634,6 +834,20 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		pr_info("Disk size set to %zu kB\n", disksize_kb);
 		break;
 
+	case RZSIO_SET_COMPRESSOR:
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(rzs->compressor, (void *)arg,
+						sizeof(rzs->compressor))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		rzs->compressor[sizeof(rzs->compressor) - 1] = '\0';
+		pr_info("Compressor set to %s\n", rzs->compressor);
+		break;
+
 	case RZSIO_GET_STATS:
 	{
 		struct ramzswap_ioctl_stats *stats;
@@ -703,8 +917,7 @@ static int create_device(struct ramzswap *rzs, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&rzs->lock);
-	spin_lock_init(&rzs->stat64_lock);
+	spin_lock_init(&rzs->dedup_lock);
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!rzs->queue) {
@@ -828,6 +1041,8 @@ static void __exit ramzswap_exit(void)
 
 module_param(num_devices, uint, 0);
 MODULE_PARM_DESC(num_devices, "Number of ramzswap devices");
+module_param(dedup, uint, 0);
+MODULE_PARM_DESC(dedup, "Share identical pages (applies at device init)");
 
 module_init(ramzswap_init);
 module_exit(ramzswap_exit);
@@ -15,8 +15,11 @@
 #ifndef _RAMZSWAP_DRV_H_
 #define _RAMZSWAP_DRV_H_
 
-#include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/crypto.h>
+#include <asm/atomic.h>
 
 #include "ramzswap_ioctl.h"
 #include "xvmalloc.h"
@@ -37,6 +40,7 @@ struct zobj_header {
 #if 0
 	u32 table_idx;
 #endif
+	u32 checksum;	/* of the compressed data, for deduplication */
 };
 
 /*-- Configurable parameters */
@@ -44,6 +48,9 @@ struct zobj_header {
 /* Default ramzswap disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Used when no compressor is set with RZSIO_SET_COMPRESSOR */
+static const char default_compressor[] = "lzo";
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -76,6 +83,21 @@ enum rzs_pageflags {
 
 /*-- Data structures */
 
+#define RZS_DEDUP_HASH_BITS	12
+
+/*
+ * Deduplication index entry, one per compressed object while
+ * deduplication is enabled. Swap slots holding identical data point at
+ * the same object; the last one freed releases it.
+ */
+struct rzs_dedup_entry {
+	struct hlist_node node;
+	struct page *page;
+	u16 offset;
+	u32 checksum;
+	u32 refcount;
+};
+
 /*
  * Allocated for each swap slot, indexed by page no.
  * These table entries must fit exactly in a page.
@@ -87,32 +109,54 @@ struct table {
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/*
+ * Stats are updated without any lock held: writes on different CPUs
+ * and slot free notifications all run concurrently.
+ */
 struct ramzswap_stats {
 	/* basic stats */
-	size_t compr_size;	/* compressed size of pages stored -
+	atomic64_t compr_size;	/* compressed size of pages stored -
 				 * needed to enforce memlimit */
 	/* more stats */
 #if defined(CONFIG_RAMZSWAP_STATS)
-	u64 num_reads;		/* failed + successful */
-	u64 num_writes;		/* --do-- */
-	u64 failed_reads;	/* should NEVER! happen */
-	u64 failed_writes;	/* can happen when memory is too low */
-	u64 invalid_io;		/* non-swap I/O requests */
-	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	atomic64_t num_reads;	/* failed + successful */
+	atomic64_t num_writes;	/* --do-- */
+	atomic64_t failed_reads;	/* should NEVER! happen */
+	atomic64_t failed_writes;	/* can happen when memory is too low */
+	atomic64_t invalid_io;	/* non-swap I/O requests */
+	atomic64_t notify_free;	/* no. of swap slot free notifications */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t pages_shared;	/* pages sharing another page's object */
+	atomic64_t dedup_hits;	/* writes that matched a stored page */
+	atomic64_t compress_ns;	/* time spent compressing */
+	atomic64_t decompress_ns;	/* time spent decompressing */
 #endif
 };
 
+/*
+ * Compression scratch space, one per CPU. A writer uses the stream of
+ * the CPU it starts on; the mutex only matters if it is preempted and
+ * another writer lands on the same CPU, since allocating the compressed
+ * object may sleep. Readers decompress with preemption disabled and use
+ * a separate transform, so they never take the mutex.
+ */
+struct rzs_stream {
+	struct mutex lock;
+	struct crypto_comp *tfm;
+	struct crypto_comp *dtfm;
+	void *buffer;
+};
+
 struct ramzswap {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct rzs_stream __percpu *streams;
+	char compressor[RZS_COMPRESSOR_NAME_LEN];
+	struct hlist_head *dedup_hash;	/* NULL if deduplication is off */
+	spinlock_t dedup_lock;
 	struct table *table;
-	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -130,37 +174,35 @@ struct ramzswap {
 
 /* Debugging and Stats */
 #if defined(CONFIG_RAMZSWAP_STATS)
-static void rzs_stat_inc(u32 *v)
+static void rzs_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void rzs_stat_dec(u32 *v)
+static void rzs_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
-static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
+static void rzs_stat64_inc(struct ramzswap *rzs, atomic64_t *v)
 {
-	spin_lock(&rzs->stat64_lock);
-	*v = *v + 1;
-	spin_unlock(&rzs->stat64_lock);
+	atomic64_inc(v);
 }
 
-static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
+static void rzs_stat64_add(struct ramzswap *rzs, atomic64_t *v, u64 val)
 {
-	u64 val;
-
-	spin_lock(&rzs->stat64_lock);
-	val = *v;
-	spin_unlock(&rzs->stat64_lock);
+	atomic64_add(val, v);
+}
 
-	return val;
+static u64 rzs_stat64_read(struct ramzswap *rzs, atomic64_t *v)
+{
+	return atomic64_read(v);
 }
 #else
 #define rzs_stat_inc(v)
 #define rzs_stat_dec(v)
 #define rzs_stat64_inc(r, v)
+#define rzs_stat64_add(r, v, val)
 #define rzs_stat64_read(r, v)
 #endif /* CONFIG_RAMZSWAP_STATS */
 
@@ -15,6 +15,8 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+#define RZS_COMPRESSOR_NAME_LEN	16
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -32,11 +34,19 @@ struct ramzswap_ioctl_stats {
 	u64 orig_data_size;
 	u64 compr_data_size;
 	u64 mem_used_total;
+	u64 dedup_hits;		/* writes that matched a stored page */
+	u32 pages_shared;	/* pages sharing another page's object */
+	u32 compr_ratio_pct;	/* compr_data_size * 100 / orig_data_size */
+	u64 compress_ns;	/* time spent compressing */
+	u64 decompress_ns;	/* time spent decompressing */
+	char compressor[RZS_COMPRESSOR_NAME_LEN];
 } __attribute__ ((packed, aligned(4)));
 
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+/* Crypto API compressor ("lzo", "deflate", ...) used by RZSIO_INIT */
+#define RZSIO_SET_COMPRESSOR	_IOW('z', 4, char[RZS_COMPRESSOR_NAME_LEN])
 
 #endif
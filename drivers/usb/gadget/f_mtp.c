@@ -27,6 +27,11 @@
 #include <linux/interrupt.h>
 #include <linux/kthread.h>
 #include <linux/freezer.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
 
 #include <linux/types.h>
 #include <linux/file.h>
@@ -52,10 +57,21 @@
 #define STATE_CANCELED              3   /* transaction canceled by host */
 #define STATE_ERROR                 4   /* error from completion routine */
 
-/* number of tx and rx requests to allocate */
+/* number of tx and rx requests to fall back to if the ones asked for
+ * by the module parameters below can't be allocated
+ */
 #define TX_REQ_MAX 4
 #define RX_REQ_MAX 2
 
+/* upper bound for the number of requests in either direction */
+#define MTP_REQS_LIMIT 64
+
+/* upper bound for the number of page sized zero copy requests */
+#define MTP_ZC_REQS_LIMIT 256
+
+/* number of file transfers kept in the debugfs history */
+#define MTP_XFER_HISTORY 16
+
 /* IO Thread commands */
 #define ANDROID_THREAD_QUIT				1
 #define ANDROID_THREAD_SEND_FILE		2
@@ -76,6 +92,34 @@
 
 static const char shortname[] = "mtp_usb";
 
+/* bulk request depth and size, read when the function is bound */
+static unsigned int mtp_tx_reqs = 16;
+module_param(mtp_tx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_tx_reqs, "number of bulk IN requests");
+static unsigned int mtp_rx_reqs = 16;
+module_param(mtp_rx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_rx_reqs, "number of bulk OUT requests");
+static unsigned int mtp_tx_req_len = 65536;
+module_param(mtp_tx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_tx_req_len, "size of bulk IN requests");
+static unsigned int mtp_rx_req_len = 65536;
+module_param(mtp_rx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_rx_req_len, "size of bulk OUT requests");
+static int mtp_zero_copy;
+module_param(mtp_zero_copy, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(mtp_zero_copy, "send files straight from the page cache");
+
+/* one MTP_SEND_FILE or MTP_RECEIVE_FILE, for debugfs */
+struct mtp_xfer_stat {
+	int	send;		/* 1 for MTP_SEND_FILE */
+	int	result;
+	size_t	bytes;
+	size_t	zc_bytes;	/* sent straight from the page cache */
+	s64	ns;		/* whole transfer */
+	s64	file_ns;	/* in vfs_read or vfs_write */
+	s64	usb_wait_ns;	/* waiting for the host */
+};
+
 struct mtp_dev {
 	struct usb_function function;
 	struct usb_composite_dev *cdev;
@@ -94,13 +138,24 @@ struct mtp_dev {
 	atomic_t open_excl;
 
 	struct list_head tx_idle;
+	/* bufferless tx requests for sending page cache pages */
+	struct list_head tx_zc_idle;
+	unsigned tx_zc_reqs;
+	/* tx requests queued to the hardware */
+	atomic_t tx_queued;
 
 	wait_queue_head_t read_wq;
 	wait_queue_head_t write_wq;
 	wait_queue_head_t intr_wq;
-	struct usb_request *rx_req[RX_REQ_MAX];
+	struct usb_request *rx_req[MTP_REQS_LIMIT];
 	struct usb_request *intr_req;
 	int rx_done;
+	/* rx requests completed, for keeping several queued in order */
+	atomic_t rx_completed;
+
+	/* request depth and size in use, see the module parameters */
+	unsigned tx_reqs, tx_req_len;
+	unsigned rx_reqs, rx_req_len;
 
 	/* synchronize access to interrupt endpoint */
 	struct mutex intr_mutex;
@@ -118,6 +173,13 @@ struct mtp_dev {
 	struct completion			thread_wait;
 	/* result from current command */
 	int							thread_result;
+
+	/* recent file transfers and totals */
+	struct mtp_xfer_stat	xfer_stats[MTP_XFER_HISTORY];
+	unsigned		xfer_count;
+	u64			xfer_bytes;
+	s64			xfer_ns;
+	struct dentry		*debugfs;
 };
 
 static struct usb_interface_descriptor mtp_interface_desc = {
@@ -363,6 +425,22 @@ static void mtp_complete_in(struct usb_ep *ep, struct usb_request *req)
 		dev->state = STATE_ERROR;
 
 	req_put(dev, &dev->tx_idle, req);
+	atomic_dec(&dev->tx_queued);
+
+	wake_up(&dev->write_wq);
+}
+
+static void mtp_complete_in_zc(struct usb_ep *ep, struct usb_request *req)
+{
+	struct mtp_dev *dev = _mtp_dev;
+
+	if (req->status != 0)
+		dev->state = STATE_ERROR;
+
+	page_cache_release(req->context);
+	req->context = NULL;
+	req_put(dev, &dev->tx_zc_idle, req);
+	atomic_dec(&dev->tx_queued);
 
 	wake_up(&dev->write_wq);
 }
@@ -372,9 +450,11 @@ static void mtp_complete_out(struct usb_ep *ep, struct usb_request *req)
 	struct mtp_dev *dev = _mtp_dev;
 
 	dev->rx_done = 1;
-	if (req->status != 0)
+	/* requests we dequeued ourselves are not an error */
+	if (req->status != 0 && req->status != -ECONNRESET)
 		dev->state = STATE_ERROR;
 
+	atomic_inc(&dev->rx_completed);
 	wake_up(&dev->read_wq);
 }
 
@@ -439,20 +519,61 @@ static int __init create_bulk_endpoints(struct mtp_dev *dev,
 	dev->ep_intr = ep;
 
 	/* now allocate requests for our endpoints */
-	for (i = 0; i < TX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_in, BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+	dev->tx_reqs = clamp_t(unsigned, mtp_tx_reqs, 1, MTP_REQS_LIMIT);
+	dev->tx_req_len = max_t(unsigned, mtp_tx_req_len, BULK_BUFFER_SIZE);
+retry_tx_alloc:
+	for (i = 0; i < dev->tx_reqs; i++) {
+		req = mtp_request_new(dev->ep_in, dev->tx_req_len);
+		if (!req) {
+			if (dev->tx_req_len == BULK_BUFFER_SIZE &&
+			    dev->tx_reqs <= TX_REQ_MAX)
+				goto fail;
+			/* large buffers are hard to come by, go back to
+			 * what we always had
+			 */
+			while ((req = req_get(dev, &dev->tx_idle)))
+				mtp_request_free(req, dev->ep_in);
+			dev->tx_req_len = BULK_BUFFER_SIZE;
+			dev->tx_reqs = TX_REQ_MAX;
+			goto retry_tx_alloc;
+		}
 		req->complete = mtp_complete_in;
 		req_put(dev, &dev->tx_idle, req);
 	}
-	for (i = 0; i < RX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_out, BULK_BUFFER_SIZE);
+	/* as many page requests as fit in the copying pipeline; doing
+	 * without some or all of them only costs the copy
+	 */
+	for (i = 0; i < min_t(unsigned, dev->tx_reqs * dev->tx_req_len /
+				PAGE_SIZE, MTP_ZC_REQS_LIMIT); i++) {
+		req = usb_ep_alloc_request(dev->ep_in, GFP_KERNEL);
 		if (!req)
-			goto fail;
+			break;
+		req->complete = mtp_complete_in_zc;
+		req_put(dev, &dev->tx_zc_idle, req);
+	}
+	dev->tx_zc_reqs = i;
+	dev->rx_reqs = clamp_t(unsigned, mtp_rx_reqs, 1, MTP_REQS_LIMIT);
+	dev->rx_req_len = max_t(unsigned, mtp_rx_req_len, BULK_BUFFER_SIZE);
+retry_rx_alloc:
+	for (i = 0; i < dev->rx_reqs; i++) {
+		req = mtp_request_new(dev->ep_out, dev->rx_req_len);
+		if (!req) {
+			if (dev->rx_req_len == BULK_BUFFER_SIZE &&
+			    dev->rx_reqs <= RX_REQ_MAX)
+				goto fail;
+			while (i--) {
+				mtp_request_free(dev->rx_req[i], dev->ep_out);
+				dev->rx_req[i] = NULL;
+			}
+			dev->rx_req_len = BULK_BUFFER_SIZE;
+			dev->rx_reqs = RX_REQ_MAX;
+			goto retry_rx_alloc;
+		}
 		req->complete = mtp_complete_out;
 		dev->rx_req[i] = req;
 	}
+	DBG(cdev, "%u x %u tx, %u x %u rx requests\n",
+		dev->tx_reqs, dev->tx_req_len, dev->rx_reqs, dev->rx_req_len);
 	req = mtp_request_new(dev->ep_intr, INTR_BUFFER_SIZE);
 	if (!req)
 		goto fail;
@@ -477,7 +598,7 @@ static ssize_t mtp_read(struct file *fp, char __user *buf,
 
 	DBG(cdev, "mtp_read(%d)\n", count);
 
-	if (count > BULK_BUFFER_SIZE)
+	if (count > dev->rx_req_len)
 		return -EINVAL;
 
 	/* we will block until we're online */
@@ -584,8 +705,8 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 			break;
 		}
 
-		if (count > BULK_BUFFER_SIZE)
-			xfer = BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
 		if (copy_from_user(req->buf, buf, xfer)) {
@@ -594,8 +715,10 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 		}
 
 		req->length = xfer;
+		atomic_inc(&dev->tx_queued);
 		ret = usb_ep_queue(dev->ep_in, req, GFP_KERNEL);
 		if (ret < 0) {
+			atomic_dec(&dev->tx_queued);
 			DBG(cdev, "mtp_write: xfer error %d\n", ret);
 			r = -EIO;
 			break;
@@ -622,40 +745,195 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 	return r;
 }
 
+static void mtp_xfer_done(struct mtp_dev *dev, struct mtp_xfer_stat *st,
+	ktime_t start)
+{
+	st->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	dev->xfer_stats[dev->xfer_count++ % MTP_XFER_HISTORY] = *st;
+	if (st->result >= 0) {
+		dev->xfer_bytes += st->bytes;
+		dev->xfer_ns += st->ns;
+	}
+}
+
+/*
+ * Returns the page cache page at 'index' of 'filp', read in and with a
+ * reference held, keeping readahead going the way vfs_read() would.
+ */
+static struct page *mtp_get_file_page(struct file *filp, pgoff_t index,
+	pgoff_t last)
+{
+	struct address_space *mapping = filp->f_mapping;
+	struct page *page;
+
+	page = find_get_page(mapping, index);
+	if (!page) {
+		page_cache_sync_readahead(mapping, &filp->f_ra, filp,
+					  index, last - index + 1);
+	} else {
+		if (PageReadahead(page))
+			page_cache_async_readahead(mapping, &filp->f_ra, filp,
+						   page, index,
+						   last - index + 1);
+		if (PageUptodate(page))
+			return page;
+		page_cache_release(page);
+	}
+	return read_mapping_page(mapping, index, filp);
+}
+
+/*
+ * Queues the page cache page holding 'offset' itself, saving the copy into
+ * a request buffer. Returns the number of bytes queued, 0 if the page
+ * can't be sent this way, or a negative error.
+ */
+static int mtp_send_file_page(struct mtp_dev *dev, struct file *filp,
+	loff_t offset, size_t count, struct mtp_xfer_stat *st)
+{
+	struct inode *inode = filp->f_mapping->host;
+	loff_t isize = i_size_read(inode);
+	pgoff_t index = offset >> PAGE_CACHE_SHIFT;
+	unsigned off = offset & ~PAGE_CACHE_MASK;
+	struct usb_request *req = 0;
+	struct page *page;
+	ktime_t t;
+	int xfer, ret;
+
+	if (offset >= isize)
+		return 0;
+	xfer = min_t(loff_t, min_t(size_t, PAGE_CACHE_SIZE - off, count),
+		     isize - offset);
+
+	t = ktime_get();
+	ret = wait_event_interruptible(dev->write_wq,
+		(req = req_get(dev, &dev->tx_zc_idle))
+		|| dev->state != STATE_BUSY);
+	st->usb_wait_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+	if (!req)
+		return ret ? ret : -EIO;
+
+	t = ktime_get();
+	page = mtp_get_file_page(filp, index,
+		(min_t(loff_t, offset + count, isize) - 1) >> PAGE_CACHE_SHIFT);
+	st->file_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+	if (IS_ERR(page)) {
+		req_put(dev, &dev->tx_zc_idle, req);
+		return PTR_ERR(page);
+	}
+	/* the controller needs a buffer in the kernel's linear map */
+	if (PageHighMem(page)) {
+		page_cache_release(page);
+		req_put(dev, &dev->tx_zc_idle, req);
+		return 0;
+	}
+
+	req->buf = page_address(page) + off;
+	req->length = xfer;
+	req->context = page;
+	atomic_inc(&dev->tx_queued);
+	ret = usb_ep_queue(dev->ep_in, req, GFP_KERNEL);
+	if (ret < 0) {
+		atomic_dec(&dev->tx_queued);
+		req->context = NULL;
+		page_cache_release(page);
+		req_put(dev, &dev->tx_zc_idle, req);
+		DBG(dev->cdev, "mtp_send_file_page: xfer error %d\n", ret);
+		dev->state = STATE_ERROR;
+		return -EIO;
+	}
+
+	st->zc_bytes += xfer;
+	return xfer;
+}
+
+/*
+ * Queues the file a page at a time straight from the page cache where it
+ * can, and otherwise reads it into idle tx requests and queues them as they
+ * fill. Either way up to a pipeline worth of requests is on the wire while
+ * the next one is prepared.
+ */
 static int mtp_send_file(struct mtp_dev *dev, struct file *filp,
 	loff_t offset, size_t count)
 {
 	struct usb_composite_dev *cdev = dev->cdev;
 	struct usb_request *req = 0;
+	struct mtp_xfer_stat st = { .send = 1 };
+	ktime_t start, t;
 	int r = count, xfer, ret;
+	int zero_copy;
+	unsigned head;
 
 	DBG(cdev, "mtp_send_file(%lld %d)\n", offset, count);
 
+	zero_copy = mtp_zero_copy && dev->tx_zc_reqs &&
+		S_ISREG(filp->f_mapping->host->i_mode) &&
+		filp->f_mapping->a_ops->readpage;
+
+	/*
+	 * Anything but a whole number of packets ends the transfer early on
+	 * the host, so page requests have to start on a page boundary. Copy
+	 * up to it if that is a whole number of packets, otherwise copy the
+	 * lot.
+	 */
+	head = offset & ~PAGE_CACHE_MASK;
+	if (head % dev->ep_in->maxpacket)
+		zero_copy = 0;
+	else if (head)
+		head = PAGE_CACHE_SIZE - head;
+
+	start = ktime_get();
+
 	while (count > 0) {
+		if (zero_copy && !head) {
+			ret = mtp_send_file_page(dev, filp, offset, count, &st);
+			if (ret < 0) {
+				r = ret;
+				break;
+			}
+			if (ret > 0) {
+				offset += ret;
+				count -= ret;
+				st.bytes += ret;
+				continue;
+			}
+			/* past EOF or in highmem, copy from here on */
+			zero_copy = 0;
+		}
+
 		/* get an idle tx request to use */
 		req = 0;
+		t = ktime_get();
 		ret = wait_event_interruptible(dev->write_wq,
 			(req = req_get(dev, &dev->tx_idle))
 			|| dev->state != STATE_BUSY);
+		st.usb_wait_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
 		if (!req) {
 			r = ret;
 			break;
 		}
 
-		if (count > BULK_BUFFER_SIZE)
-			xfer = BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
+		if (zero_copy && xfer > head)
+			xfer = head;
+		t = ktime_get();
 		ret = vfs_read(filp, req->buf, xfer, &offset);
+		st.file_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
 		if (ret < 0) {
 			r = ret;
 			break;
 		}
 		xfer = ret;
+		if (zero_copy)
+			head -= xfer;
 
 		req->length = xfer;
+		atomic_inc(&dev->tx_queued);
 		ret = usb_ep_queue(dev->ep_in, req, GFP_KERNEL);
 		if (ret < 0) {
+			atomic_dec(&dev->tx_queued);
 			DBG(cdev, "mtp_write: xfer error %d\n", ret);
 			dev->state = STATE_ERROR;
 			r = -EIO;
@@ -663,6 +941,7 @@ static int mtp_send_file(struct mtp_dev *dev, struct file *filp,
 		}
 
 		count -= xfer;
+		st.bytes += xfer;
 
 		/* zero this so we don't try to free it on error exit */
 		req = 0;
@@ -671,66 +950,118 @@ static int mtp_send_file(struct mtp_dev *dev, struct file *filp,
 	if (req)
 		req_put(dev, &dev->tx_idle, req);
 
+	if (st.zc_bytes)
+		file_accessed(filp);
+
+	/* let the pipeline drain so the transfer time is what the host saw */
+	if (r >= 0) {
+		t = ktime_get();
+		wait_event_interruptible(dev->write_wq,
+			atomic_read(&dev->tx_queued) == 0
+			|| dev->state != STATE_BUSY);
+		st.usb_wait_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+	}
+
+	st.result = r;
+	mtp_xfer_done(dev, &st, start);
+
 	DBG(cdev, "mtp_write returning %d\n", r);
 	return r;
 }
 
+/*
+ * Keeps up to rx_reqs requests queued for the data still to come from the
+ * host and writes each one out to the file as it completes, while the host
+ * goes on filling the others. An endpoint completes its requests in the
+ * order they were queued, so counting completions is enough to know which
+ * are done.
+ */
 static int mtp_receive_file(struct mtp_dev *dev, struct file *filp,
 	loff_t offset, size_t count)
 {
 	struct usb_composite_dev *cdev = dev->cdev;
-	struct usb_request *read_req = NULL, *write_req = NULL;
+	struct usb_request *req;
+	struct mtp_xfer_stat st = { .send = 0 };
+	size_t to_queue = count;
+	unsigned queued = 0, written = 0;
+	unsigned base = atomic_read(&dev->rx_completed);
+	ktime_t start, t;
 	int r = count;
 	int ret;
-	int cur_buf = 0;
 
 	DBG(cdev, "mtp_receive_file(%d)\n", count);
 
-	while (count > 0 || write_req) {
-		if (count > 0) {
-			/* queue a request */
-			read_req = dev->rx_req[cur_buf];
-			cur_buf = (cur_buf + 1) % RX_REQ_MAX;
+	start = ktime_get();
 
-			read_req->length = (count > BULK_BUFFER_SIZE
-					? BULK_BUFFER_SIZE : count);
-			dev->rx_done = 0;
-			ret = usb_ep_queue(dev->ep_out, read_req, GFP_KERNEL);
+	while (count > 0) {
+		/* keep every idle request queued while there is more to ask for */
+		while (to_queue > 0 && queued - written < dev->rx_reqs) {
+			req = dev->rx_req[queued % dev->rx_reqs];
+			req->length = (to_queue > dev->rx_req_len
+					? dev->rx_req_len : to_queue);
+			ret = usb_ep_queue(dev->ep_out, req, GFP_KERNEL);
 			if (ret < 0) {
 				r = -EIO;
 				dev->state = STATE_ERROR;
-				break;
+				goto out;
 			}
-			count -= ret;
+			to_queue -= req->length;
+			queued++;
 		}
 
-		if (write_req) {
-			DBG(cdev, "rx %p %d\n", write_req, write_req->actual);
-			ret = vfs_write(filp, write_req->buf, write_req->actual,
-				&offset);
-			DBG(cdev, "vfs_write %d\n", ret);
-			if (ret != write_req->actual) {
-				r = -EIO;
-				dev->state = STATE_ERROR;
-				break;
-			}
-			write_req = NULL;
+		/* wait for the oldest one to complete */
+		t = ktime_get();
+		ret = wait_event_interruptible(dev->read_wq,
+			atomic_read(&dev->rx_completed) - base > written
+			|| dev->state != STATE_BUSY);
+		st.usb_wait_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+		if (ret < 0 || dev->state != STATE_BUSY) {
+			r = ret;
+			goto out;
 		}
 
-		if (read_req) {
-			/* wait for our last read to complete */
-			ret = wait_event_interruptible(dev->read_wq,
-				dev->rx_done || dev->state != STATE_BUSY);
-			if (ret < 0 || dev->state != STATE_BUSY) {
-				r = ret;
-				break;
-			}
-			count -= read_req->actual;
-			write_req = read_req;
-			read_req = NULL;
+		req = dev->rx_req[written % dev->rx_reqs];
+		DBG(cdev, "rx %p %d\n", req, req->actual);
+		t = ktime_get();
+		ret = vfs_write(filp, req->buf, req->actual, &offset);
+		st.file_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+		DBG(cdev, "vfs_write %d\n", ret);
+		if (ret != req->actual) {
+			r = -EIO;
+			dev->state = STATE_ERROR;
+			goto out;
 		}
+		written++;
+		st.bytes += req->actual;
+
+		/* a short packet ends the data phase early */
+		if (req->actual < req->length && req->actual < count) {
+			r = -EIO;
+			dev->state = STATE_ERROR;
+			goto out;
+		}
+		count -= min_t(size_t, req->actual, count);
+	}
+
+out:
+	/*
+	 * take back whatever is still queued before anyone else reads;
+	 * usb_ep_dequeue() always gives the request back through its
+	 * completion, so this can't wait forever
+	 */
+	if (queued != written) {
+		unsigned i;
+
+		for (i = written; i != queued; i++)
+			usb_ep_dequeue(dev->ep_out,
+				dev->rx_req[i % dev->rx_reqs]);
+		wait_event(dev->read_wq,
+			atomic_read(&dev->rx_completed) - base == queued);
 	}
 
+	st.result = r;
+	mtp_xfer_done(dev, &st, start);
+
 	DBG(cdev, "mtp_read returning %d\n", r);
 	return r;
 }
@@ -1020,13 +1351,16 @@ mtp_function_unbind(struct usb_configuration *c, struct usb_function *f)
 	spin_lock_irq(&dev->lock);
 	while ((req = req_get(dev, &dev->tx_idle)))
 		mtp_request_free(req, dev->ep_in);
-	for (i = 0; i < RX_REQ_MAX; i++)
+	while ((req = req_get(dev, &dev->tx_zc_idle)))
+		usb_ep_free_request(dev->ep_in, req);
+	for (i = 0; i < dev->rx_reqs; i++)
 		mtp_request_free(dev->rx_req[i], dev->ep_out);
 	mtp_request_free(dev->intr_req, dev->ep_intr);
 	dev->state = STATE_OFFLINE;
 	spin_unlock_irq(&dev->lock);
 	wake_up(&dev->intr_wq);
 
+	debugfs_remove(dev->debugfs);
 	misc_deregister(&mtp_device);
 	kfree(_mtp_dev);
 	_mtp_dev = NULL;
@@ -1195,6 +1529,54 @@ static void mtp_function_disable(struct usb_function *f)
 	VDBG(cdev, "%s disabled\n", dev->function.name);
 }
 
+/* scaled down to KiB and us first so that large totals don't overflow */
+static u64 mtp_kbps(u64 bytes, s64 ns)
+{
+	s64 us = div_s64(ns, NSEC_PER_USEC);
+
+	return us > 0 ? div64_u64((bytes >> 10) * USEC_PER_SEC, us) : 0;
+}
+
+static int mtp_debugfs_show(struct seq_file *m, void *unused)
+{
+	struct mtp_dev *dev = m->private;
+	struct mtp_xfer_stat *st;
+	unsigned i, n;
+
+	seq_printf(m, "requests: %u x %u tx, %u x %u rx, %u zero copy\n",
+		dev->tx_reqs, dev->tx_req_len, dev->rx_reqs, dev->rx_req_len,
+		dev->tx_zc_reqs);
+	seq_printf(m, "transfers: %u, %llu bytes, %llu KB/s\n",
+		dev->xfer_count, dev->xfer_bytes,
+		mtp_kbps(dev->xfer_bytes, dev->xfer_ns));
+
+	n = min_t(unsigned, dev->xfer_count, MTP_XFER_HISTORY);
+	for (i = dev->xfer_count - n; i != dev->xfer_count; i++) {
+		st = &dev->xfer_stats[i % MTP_XFER_HISTORY];
+		seq_printf(m, "%s %zu bytes (%zu zero copy) in %lld us, "
+			"%llu KB/s, file %lld us, usb wait %lld us, result %d\n",
+			st->send ? "send" : "receive", st->bytes, st->zc_bytes,
+			div_s64(st->ns, NSEC_PER_USEC),
+			mtp_kbps(st->bytes, st->ns),
+			div_s64(st->file_ns, NSEC_PER_USEC),
+			div_s64(st->usb_wait_ns, NSEC_PER_USEC), st->result);
+	}
+	return 0;
+}
+
+static int mtp_debugfs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mtp_debugfs_show, inode->i_private);
+}
+
+static const struct file_operations mtp_debugfs_fops = {
+	.owner = THIS_MODULE,
+	.open = mtp_debugfs_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int mtp_bind_config(struct usb_configuration *c)
 {
 	struct mtp_dev *dev;
@@ -1221,7 +1603,10 @@ static int mtp_bind_config(struct usb_configuration *c)
 	init_waitqueue_head(&dev->write_wq);
 	init_waitqueue_head(&dev->intr_wq);
 	atomic_set(&dev->open_excl, 0);
+	atomic_set(&dev->tx_queued, 0);
+	atomic_set(&dev->rx_completed, 0);
 	INIT_LIST_HEAD(&dev->tx_idle);
+	INIT_LIST_HEAD(&dev->tx_zc_idle);
 	mutex_init(&dev->intr_mutex);
 
 	dev->cdev = c->cdev;
@@ -1249,6 +1634,9 @@ static int mtp_bind_config(struct usb_configuration *c)
 	if (ret)
 		goto err2;
 
+	dev->debugfs = debugfs_create_file(shortname, S_IRUGO, NULL, dev,
+					   &mtp_debugfs_fops);
+
 	return 0;
 
 err2:
@@ -0,0 +1,181 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "yaffs_gcindex.h"
+#include "yaffs_getblockinfo.h"
+#include "yaffs_yaffs2.h"
+
+/*
+ * GC victim index.
+ *
+ * FULL blocks are kept on doubly linked lists bucketed by the number of
+ * live chunks (pagesInUse - softDeletions), so the dirtiest block is found
+ * by walking up from bucket 0 instead of scanning the block array.
+ * Lists are threaded through per-block links holding block numbers, -1
+ * ends a list. Code that changes a block's state or live chunk count calls
+ * yaffs_GCIndexUpdate(); anything that slips through is refiled when
+ * yaffs_GCIndexFind() walks over it.
+ */
+
+static Y_INLINE yaffs_GCIndexLink *yaffs_GCIndexLinkOf(yaffs_Device *dev,
+							int blk)
+{
+	return &dev->gcIndexLinks[blk - dev->internalStartBlock];
+}
+
+static void yaffs_GCIndexUnlink(yaffs_Device *dev, int blk)
+{
+	yaffs_GCIndexLink *link = yaffs_GCIndexLinkOf(dev, blk);
+
+	if (link->bucket < 0)
+		return;
+
+	if (link->prev >= 0)
+		yaffs_GCIndexLinkOf(dev, link->prev)->next = link->next;
+	else
+		dev->gcIndexBuckets[link->bucket] = link->next;
+
+	if (link->next >= 0)
+		yaffs_GCIndexLinkOf(dev, link->next)->prev = link->prev;
+
+	link->bucket = -1;
+}
+
+void yaffs_GCIndexUpdate(yaffs_Device *dev, int blk)
+{
+	yaffs_BlockInfo *bi;
+	yaffs_GCIndexLink *link;
+	int bucket = -1;
+
+	if (!dev->gcIndexLinks)
+		return;
+
+	bi = yaffs_GetBlockInfo(dev, blk);
+	link = yaffs_GCIndexLinkOf(dev, blk);
+
+	if (bi->blockState == YAFFS_BLOCK_STATE_FULL) {
+		bucket = bi->pagesInUse - bi->softDeletions;
+		if (bucket < 0)
+			bucket = 0;
+		if (bucket > dev->param.nChunksPerBlock)
+			bucket = dev->param.nChunksPerBlock;
+	}
+
+	if (link->bucket == bucket)
+		return;
+
+	yaffs_GCIndexUnlink(dev, blk);
+
+	if (bucket < 0)
+		return;
+
+	link->prev = -1;
+	link->next = dev->gcIndexBuckets[bucket];
+	if (link->next >= 0)
+		yaffs_GCIndexLinkOf(dev, link->next)->prev = blk;
+	dev->gcIndexBuckets[bucket] = blk;
+	link->bucket = bucket;
+}
+
+void yaffs_GCIndexRebuild(yaffs_Device *dev)
+{
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int i;
+
+	for (i = 0; i <= dev->param.nChunksPerBlock; i++)
+		dev->gcIndexBuckets[i] = -1;
+	for (i = 0; i < nBlocks; i++)
+		dev->gcIndexLinks[i].bucket = -1;
+
+	for (i = dev->internalStartBlock; i <= dev->internalEndBlock; i++)
+		yaffs_GCIndexUpdate(dev, i);
+}
+
+/*
+ * Return the FULL block with the fewest live chunks, no more than maxLive,
+ * that is allowed to be collected. At most maxTries blocks are looked at.
+ */
+int yaffs_GCIndexFind(yaffs_Device *dev, int maxLive, int maxTries,
+			int *liveChunks)
+{
+	yaffs_BlockInfo *bi;
+	int bucket;
+	int blk;
+	int next;
+	int tries = 0;
+
+	if (maxLive > dev->param.nChunksPerBlock)
+		maxLive = dev->param.nChunksPerBlock;
+
+	for (bucket = 0; bucket <= maxLive && tries < maxTries; bucket++) {
+		for (blk = dev->gcIndexBuckets[bucket];
+			blk >= 0 && tries < maxTries;
+			blk = next) {
+			next = yaffs_GCIndexLinkOf(dev, blk)->next;
+			bi = yaffs_GetBlockInfo(dev, blk);
+			tries++;
+
+			if (bi->blockState != YAFFS_BLOCK_STATE_FULL ||
+				bi->pagesInUse - bi->softDeletions != bucket) {
+				/* Stale, put it where it belongs */
+				yaffs_GCIndexUpdate(dev, blk);
+				continue;
+			}
+
+			if (yaffs2_BlockNotDisqualifiedFromGC(dev, bi)) {
+				*liveChunks = bucket;
+				return blk;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int yaffs_GCIndexInitialise(yaffs_Device *dev)
+{
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+
+	dev->gcIndexBuckets =
+		YMALLOC((dev->param.nChunksPerBlock + 1) * sizeof(int));
+
+	dev->gcIndexLinks = YMALLOC(nBlocks * sizeof(yaffs_GCIndexLink));
+	if (!dev->gcIndexLinks) {
+		dev->gcIndexLinks =
+			YMALLOC_ALT(nBlocks * sizeof(yaffs_GCIndexLink));
+		dev->gcIndexLinksAlt = 1;
+	} else
+		dev->gcIndexLinksAlt = 0;
+
+	if (dev->gcIndexBuckets && dev->gcIndexLinks) {
+		yaffs_GCIndexRebuild(dev);
+		return YAFFS_OK;
+	}
+
+	yaffs_GCIndexDeinitialise(dev);
+	return YAFFS_FAIL;
+}
+
+void yaffs_GCIndexDeinitialise(yaffs_Device *dev)
+{
+	if (dev->gcIndexBuckets)
+		YFREE(dev->gcIndexBuckets);
+	dev->gcIndexBuckets = NULL;
+
+	if (dev->gcIndexLinksAlt && dev->gcIndexLinks)
+		YFREE_ALT(dev->gcIndexLinks);
+	else if (dev->gcIndexLinks)
+		YFREE(dev->gcIndexLinks);
+	dev->gcIndexLinksAlt = 0;
+	dev->gcIndexLinks = NULL;
+}
@@ -0,0 +1,30 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * GC victim index
+ */
+
+#ifndef __YAFFS_GCINDEX_H__
+#define __YAFFS_GCINDEX_H__
+
+#include "yaffs_guts.h"
+
+int yaffs_GCIndexInitialise(yaffs_Device *dev);
+void yaffs_GCIndexDeinitialise(yaffs_Device *dev);
+void yaffs_GCIndexUpdate(yaffs_Device *dev, int blk);
+void yaffs_GCIndexRebuild(yaffs_Device *dev);
+int yaffs_GCIndexFind(yaffs_Device *dev, int maxLive, int maxTries,
+			int *liveChunks);
+
+#endif
@@ -26,6 +26,7 @@
 #include "yaffs_yaffs2.h"
 #include "yaffs_bitmap.h"
 #include "yaffs_verify.h"
+#include "yaffs_gcindex.h"
 
 #include "yaffs_nand.h"
 #include "yaffs_packedtags2.h"
@@ -33,8 +34,12 @@
 #include "yaffs_nameval.h"
 #include "yaffs_allocator.h"
 
-/* Note YAFFS_GC_GOOD_ENOUGH must be <= YAFFS_GC_PASSIVE_THRESHOLD */
-#define YAFFS_GC_GOOD_ENOUGH 2
+/* Memory barriers for flags read without the reader lock */
+#ifndef Y_SMP_WMB
+#define Y_SMP_WMB() do { } while (0)
+#define Y_SMP_RMB() do { } while (0)
+#endif
+
 #define YAFFS_GC_PASSIVE_THRESHOLD 4
 
 #include "yaffs_ecc.h"
@@ -177,6 +182,23 @@ static __u32 Shifts(__u32 x)
 
 
 
+/*
+ * Reader lock, taken around the state that readers running under a
+ * shared OS lock still modify. See readerLock in yaffs_DeviceParam.
+ */
+
+void yaffs_ReaderLock(yaffs_Device *dev)
+{
+	if (dev->param.readerLock)
+		dev->param.readerLock(dev);
+}
+
+void yaffs_ReaderUnlock(yaffs_Device *dev)
+{
+	if (dev->param.readerUnlock)
+		dev->param.readerUnlock(dev);
+}
+
 /*
  * Temporary buffer manipulations.
  */
@@ -197,7 +219,7 @@ static int yaffs_InitialiseTempBuffers(yaffs_Device *dev)
 	return buf ? YAFFS_OK : YAFFS_FAIL;
 }
 
-__u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
+static __u8 *yaffs_GetTempBufferWorker(yaffs_Device *dev, int lineNo)
 {
 	int i, j;
 
@@ -237,7 +259,18 @@ __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 
 }
 
-void yaffs_ReleaseTempBuffer(yaffs_Device *dev, __u8 *buffer,
+__u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
+{
+	__u8 *buffer;
+
+	yaffs_ReaderLock(dev);
+	buffer = yaffs_GetTempBufferWorker(dev, lineNo);
+	yaffs_ReaderUnlock(dev);
+
+	return buffer;
+}
+
+static void yaffs_ReleaseTempBufferWorker(yaffs_Device *dev, __u8 *buffer,
 				    int lineNo)
 {
 	int i;
@@ -262,6 +295,14 @@ void yaffs_ReleaseTempBuffer(yaffs_Device *dev, __u8 *buffer,
 
 }
 
+void yaffs_ReleaseTempBuffer(yaffs_Device *dev, __u8 *buffer,
+				    int lineNo)
+{
+	yaffs_ReaderLock(dev);
+	yaffs_ReleaseTempBufferWorker(dev, buffer, lineNo);
+	yaffs_ReaderUnlock(dev);
+}
+
 /*
  * Determine if we have a managed buffer.
  */
@@ -526,6 +567,7 @@ static void yaffs_RetireBlock(yaffs_Device *dev, int blockInNAND)
 	bi->blockState = YAFFS_BLOCK_STATE_DEAD;
 	bi->gcPrioritise = 0;
 	bi->needsRetiring = 0;
+	yaffs_GCIndexUpdate(dev, blockInNAND);
 
 	dev->nRetiredBlocks++;
 }
@@ -1025,6 +1067,7 @@ static void yaffs_SoftDeleteChunk(yaffs_Device *dev, int chunk)
 	if (theBlock) {
 		theBlock->softDeletions++;
 		dev->nFreeChunks++;
+		yaffs_GCIndexUpdate(dev, blockNo);
 		yaffs2_UpdateOldestDirtySequence(dev, blockNo, theBlock);
 	}
 }
@@ -1847,7 +1890,7 @@ static int yaffs_InitialiseBlocks(yaffs_Device *dev)
 	if (dev->blockInfo && dev->chunkBits) {
 		memset(dev->blockInfo, 0, nBlocks * sizeof(yaffs_BlockInfo));
 		memset(dev->chunkBits, 0, dev->chunkBitmapStride * nBlocks);
-		return YAFFS_OK;
+		return yaffs_GCIndexInitialise(dev);
 	}
 
 	return YAFFS_FAIL;
@@ -1870,6 +1913,8 @@ static void yaffs_DeinitialiseBlocks(yaffs_Device *dev)
 		YFREE(dev->chunkBits);
 	dev->chunkBitsAlt = 0;
 	dev->chunkBits = NULL;
+
+	yaffs_GCIndexDeinitialise(dev);
 }
 
 void yaffs_BlockBecameDirty(yaffs_Device *dev, int blockNo)
@@ -1889,6 +1934,7 @@ void yaffs_BlockBecameDirty(yaffs_Device *dev, int blockNo)
 	yaffs2_ClearOldestDirtySequence(dev,bi);
 
 	bi->blockState = YAFFS_BLOCK_STATE_DIRTY;
+	yaffs_GCIndexUpdate(dev, blockNo);
 
 	/* If this is the block being garbage collected then stop gc'ing this block */
 	if(blockNo == dev->gcBlock)
@@ -2052,6 +2098,7 @@ static int yaffs_AllocateChunk(yaffs_Device *dev, int useReserve,
 		/* If the block is full set the state to full */
 		if (dev->allocationPage >= dev->param.nChunksPerBlock) {
 			bi->blockState = YAFFS_BLOCK_STATE_FULL;
+			yaffs_GCIndexUpdate(dev, dev->allocationBlock);
 			dev->allocationBlock = -1;
 		}
 
@@ -2090,6 +2137,7 @@ void yaffs_SkipRestOfBlock(yaffs_Device *dev)
 		yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, dev->allocationBlock);
 		if(bi->blockState == YAFFS_BLOCK_STATE_ALLOCATING){
 			bi->blockState = YAFFS_BLOCK_STATE_FULL;
+			yaffs_GCIndexUpdate(dev, dev->allocationBlock);
 			dev->allocationBlock = -1;
 		}
 	}
@@ -2131,6 +2179,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 
 	if(bi->blockState == YAFFS_BLOCK_STATE_FULL)
 		bi->blockState = YAFFS_BLOCK_STATE_COLLECTING;
+	yaffs_GCIndexUpdate(dev, block);
 	
 	bi->hasShrinkHeader = 0;	/* clear the flag so that the block can erase */
 
@@ -2327,6 +2376,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 		 * because checkpointing does not restore gc.
 		 */
 		bi->blockState = YAFFS_BLOCK_STATE_FULL;
+		yaffs_GCIndexUpdate(dev, block);
 	} else {
 		/* The gc completed. */
 		/* Do any required cleanups */
@@ -2370,7 +2420,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 
 /*
  * FindBlockForgarbageCollection is used to select the dirtiest block (or close enough)
- * for garbage collection.
+ * for garbage collection. Candidates come from the GC index, dirtiest first.
  */
 
 static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
@@ -2426,7 +2476,7 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 	 */
 
 	if (!selected){
-		int pagesUsed;
+		int pagesUsed = 0;
 		int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
 		if (aggressive){
 			threshold = dev->param.nChunksPerBlock;
@@ -2454,31 +2504,16 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 				iterations = 100;
 		}
 
-		for (i = 0;
-			i < iterations &&
-			(dev->gcDirtiest < 1 ||
-				dev->gcPagesInUse > YAFFS_GC_GOOD_ENOUGH);
-			i++) {
-			dev->gcBlockFinder++;
-			if (dev->gcBlockFinder < dev->internalStartBlock ||
-				dev->gcBlockFinder > dev->internalEndBlock)
-				dev->gcBlockFinder = dev->internalStartBlock;
-
-			bi = yaffs_GetBlockInfo(dev, dev->gcBlockFinder);
-
-			pagesUsed = bi->pagesInUse - bi->softDeletions;
+		/* A block with no free chunks is never worth collecting */
+		if (threshold > dev->param.nChunksPerBlock - 1)
+			threshold = dev->param.nChunksPerBlock - 1;
 
-			if (bi->blockState == YAFFS_BLOCK_STATE_FULL &&
-				pagesUsed < dev->param.nChunksPerBlock &&
-				(dev->gcDirtiest < 1 || pagesUsed < dev->gcPagesInUse) &&
-				yaffs2_BlockNotDisqualifiedFromGC(dev, bi)) {
-				dev->gcDirtiest = dev->gcBlockFinder;
-				dev->gcPagesInUse = pagesUsed;
-			}
+		selected = yaffs_GCIndexFind(dev, threshold, iterations,
+						&pagesUsed);
+		if (selected) {
+			dev->gcDirtiest = selected;
+			dev->gcPagesInUse = pagesUsed;
 		}
-
-		if(dev->gcDirtiest > 0 && dev->gcPagesInUse <= threshold)
-			selected = dev->gcDirtiest;
 	}
 
 	/*
@@ -2518,8 +2553,8 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 	} else{
 		dev->gcNotDone++;
 		T(YAFFS_TRACE_GC,
-		  (TSTR("GC none: finder %d skip %d threshold %d dirtiest %d using %d oldest %d%s" TENDSTR),
-		  dev->gcBlockFinder, dev->gcNotDone,
+		  (TSTR("GC none: skip %d threshold %d dirtiest %d using %d oldest %d%s" TENDSTR),
+		  dev->gcNotDone,
 		  threshold,
 		  dev->gcDirtiest, dev->gcPagesInUse,
 		  dev->oldestDirtyBlock,
@@ -2546,6 +2581,7 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 	int minErased;
 	int erasedChunks;
 	int checkpointBlockAdjust;
+	__u32 erasures;
 
 	if(dev->param.gcControl &&
 		(dev->param.gcControl(dev) & 1) == 0)
@@ -2612,7 +2648,9 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 			   ("yaffs: GC erasedBlocks %d aggressive %d" TENDSTR),
 			   dev->nErasedBlocks, aggressive));
 
+			erasures = dev->nBlockErasures;
 			gcOk = yaffs_GarbageCollectBlock(dev, dev->gcBlock, aggressive);
+			dev->nGCErasures += dev->nBlockErasures - erasures;
 		}
 
 		if (dev->nErasedBlocks < (dev->param.nReservedBlocks) && dev->gcBlock > 0) {
@@ -2635,11 +2673,15 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
  */
 int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, unsigned urgency)
 {
-	int erasedChunks = dev->nErasedBlocks * dev->param.nChunksPerBlock;
+	int erasedChunks;
+	__u32 copies = dev->nGCCopies;
 
 	T(YAFFS_TRACE_BACKGROUND, (TSTR("Background gc %u" TENDSTR),urgency));
 
 	yaffs_CheckGarbageCollection(dev, 1);
+	dev->bgGCCopies += dev->nGCCopies - copies;
+
+	erasedChunks = dev->nErasedBlocks * dev->param.nChunksPerBlock;
 	return erasedChunks > dev->nFreeChunks/2;
 }
 
@@ -2918,6 +2960,7 @@ void yaffs_DeleteChunk(yaffs_Device *dev, int chunkId, int markNAND, int lyn)
 		yaffs_ClearChunkBit(dev, block, page);
 
 		bi->pagesInUse--;
+		yaffs_GCIndexUpdate(dev, block);
 
 		if (bi->pagesInUse == 0 &&
 		    !bi->hasShrinkHeader &&
@@ -3176,22 +3219,55 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   Entries are hashed by object and chunk id and kept on an LRU list, so
+ *   the cache can be made large. Clean entries are reused before dirty ones
+ *   get written out, and dirty entries are also kept on their own list so
+ *   that flushing doesn't have to look at the whole cache.
  */
 
+static Y_INLINE struct ylist_head *yaffs_ChunkCacheBucket(yaffs_Device *dev,
+						const yaffs_Object *obj,
+						int chunkId)
+{
+	return &dev->srHash[(obj->objectId * 31 + chunkId) & dev->srHashMask];
+}
+
+static void yaffs_SetChunkCacheDirty(yaffs_Device *dev,
+					yaffs_ChunkCache *cache, int dirty)
+{
+	if (dirty && !cache->dirty)
+		ylist_add_tail(&cache->dirtyLink, &dev->srDirty);
+	else if (!dirty && cache->dirty)
+		ylist_del_init(&cache->dirtyLink);
+
+	cache->dirty = dirty;
+}
+
+/* Forget what a cache entry holds and put it back on the free list. */
+static void yaffs_ReleaseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	if (!cache->object)
+		return;
+
+	yaffs_SetChunkCacheDirty(dev, cache, 0);
+	ylist_del_init(&cache->hashLink);
+	ylist_del(&cache->lruLink);
+	ylist_add(&cache->lruLink, &dev->srFree);
+	cache->object = NULL;
+}
+
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
+	struct ylist_head *i;
 	yaffs_ChunkCache *cache;
-	int nCaches = obj->myDev->param.nShortOpCaches;
 
-	for (i = 0; i < nCaches; i++) {
-		cache = &dev->srCache[i];
-		if (cache->object == obj &&
-		    cache->dirty)
-			return 1;
+	if (dev->param.nShortOpCaches > 0) {
+		ylist_for_each(i, &dev->srDirty) {
+			cache = ylist_entry(i, yaffs_ChunkCache, dirtyLink);
+			if (cache->object == obj)
+				return 1;
+		}
 	}
 
 	return 0;
@@ -3201,27 +3277,21 @@ static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int lowest = -99;	/* Stop compiler whining. */
-	int i;
+	struct ylist_head *i;
 	yaffs_ChunkCache *cache;
+	yaffs_ChunkCache *c;
 	int chunkWritten = 0;
-	int nCaches = obj->myDev->param.nShortOpCaches;
 
-	if (nCaches > 0) {
+	if (dev->param.nShortOpCaches > 0) {
 		do {
 			cache = NULL;
 
 			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < nCaches; i++) {
-				if (dev->srCache[i].object == obj &&
-				    dev->srCache[i].dirty) {
-					if (!cache
-					    || dev->srCache[i].chunkId <
-					    lowest) {
-						cache = &dev->srCache[i];
-						lowest = cache->chunkId;
-					}
-				}
+			ylist_for_each(i, &dev->srDirty) {
+				c = ylist_entry(i, yaffs_ChunkCache, dirtyLink);
+				if (c->object == obj &&
+				    (!cache || c->chunkId < cache->chunkId))
+					cache = c;
 			}
 
 			if (cache && !cache->locked) {
@@ -3233,8 +3303,7 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 								 cache->data,
 								 cache->nBytes,
 								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
+				yaffs_ReleaseChunkCache(dev, cache);
 			}
 
 		} while (cache && chunkWritten > 0);
@@ -3256,116 +3325,126 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 
 void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 {
-	yaffs_Object *obj;
-	int nCaches = dev->param.nShortOpCaches;
-	int i;
+	yaffs_ChunkCache *cache;
 
-	/* Find a dirty object in the cache and flush it...
-	 * until there are no further dirty objects.
-	 */
-	do {
-		obj = NULL;
-		for (i = 0; i < nCaches && !obj; i++) {
-			if (dev->srCache[i].object &&
-			    dev->srCache[i].dirty)
-				obj = dev->srCache[i].object;
+	if (dev->param.nShortOpCaches < 1)
+		return;
 
-		}
-		if (obj)
-			yaffs_FlushFilesChunkCache(obj);
+	/* Flush the object owning the oldest dirty entry...
+	 * until there are no further dirty objects, or it gets stuck.
+	 */
+	while (!ylist_empty(&dev->srDirty)) {
+		cache = ylist_entry(dev->srDirty.next, yaffs_ChunkCache,
+					dirtyLink);
+		yaffs_FlushFilesChunkCache(cache->object);
 
-	} while (obj);
+		if (dev->srDirty.next == &cache->dirtyLink)
+			break;
+	}
 
 }
 
 
-/* Grab us a cache chunk for use.
- * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+/* Grab us an unused cache entry.
+ * First look on the free list, then for the least recently used clean one.
  */
 static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
 {
-	int i;
+	struct ylist_head *i;
+	yaffs_ChunkCache *cache;
 
-	if (dev->param.nShortOpCaches > 0) {
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (!dev->srCache[i].object)
-				return &dev->srCache[i];
+	if (!ylist_empty(&dev->srFree))
+		return ylist_entry(dev->srFree.next, yaffs_ChunkCache, lruLink);
+
+	for (i = dev->srLru.prev; i != &dev->srLru; i = i->prev) {
+		cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+		if (!cache->dirty && !cache->locked) {
+			yaffs_ReleaseChunkCache(dev, cache);
+			return cache;
 		}
 	}
 
 	return NULL;
 }
 
-static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
+/* Grab a cache entry for chunkId of obj.
+ * If everything is dirty and mayFlush is set, write out the object that
+ * owns the least recently used entry and look again. Callers that must
+ * not write (readahead under the reader lock) pass mayFlush = 0.
+ * The entry comes back clean, unlocked and with no data loaded.
+ */
+static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Object *obj, int chunkId,
+						int mayFlush)
 {
+	yaffs_Device *dev = obj->myDev;
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
-	int i;
-	int pushout;
+	yaffs_Object *theObj = NULL;
+	struct ylist_head *i;
 
-	if (dev->param.nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
+	if (dev->param.nShortOpCaches < 1)
+		return NULL;
 
-		cache = yaffs_GrabChunkCacheWorker(dev);
+	cache = yaffs_GrabChunkCacheWorker(dev);
 
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
+	if (!cache && mayFlush) {
+		/* With locking we can't assume we can use the last entry */
+		for (i = dev->srLru.prev; i != &dev->srLru && !theObj;
+		     i = i->prev) {
+			cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+			if (!cache->locked)
+				theObj = cache->object;
+		}
 
-			/* With locking we can't assume we can use entry zero */
+		cache = NULL;
+		if (theObj) {
+			yaffs_FlushFilesChunkCache(theObj);
+			cache = yaffs_GrabChunkCacheWorker(dev);
+		}
+	}
 
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+	if (cache) {
+		ylist_del(&cache->lruLink);
+		ylist_add(&cache->lruLink, &dev->srLru);
+		ylist_add(&cache->hashLink,
+			  yaffs_ChunkCacheBucket(dev, obj, chunkId));
+		cache->object = obj;
+		cache->chunkId = chunkId;
+		cache->dirty = 0;
+		cache->locked = 0;
+		cache->nBytes = 0;
+	}
 
-			for (i = 0; i < dev->param.nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
-			}
+	return cache;
+}
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
-				cache = yaffs_GrabChunkCacheWorker(dev);
-			}
+static yaffs_ChunkCache *yaffs_LookupChunkCache(const yaffs_Object *obj,
+						int chunkId)
+{
+	yaffs_Device *dev = obj->myDev;
+	struct ylist_head *i;
+	yaffs_ChunkCache *cache;
 
+	if (dev->param.nShortOpCaches > 0) {
+		ylist_for_each(i, yaffs_ChunkCacheBucket(dev, obj, chunkId)) {
+			cache = ylist_entry(i, yaffs_ChunkCache, hashLink);
+			if (cache->object == obj &&
+			    cache->chunkId == chunkId)
+				return cache;
 		}
-		return cache;
-	} else
-		return NULL;
-
+	}
+	return NULL;
 }
 
 /* Find a cached chunk */
 static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
-	yaffs_Device *dev = obj->myDev;
-	int i;
-	if (dev->param.nShortOpCaches > 0) {
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
-				dev->cacheHits++;
+	yaffs_ChunkCache *cache = yaffs_LookupChunkCache(obj, chunkId);
 
-				return &dev->srCache[i];
-			}
-		}
-	}
-	return NULL;
+	if (cache)
+		obj->myDev->cacheHits++;
+
+	return cache;
 }
 
 /* Mark the chunk for the least recently used algorithym */
@@ -3374,21 +3453,11 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 {
 
 	if (dev->param.nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->param.nShortOpCaches; i++)
-				dev->srCache[i].lastUse = 0;
-
-			dev->srLastUse = 0;
-		}
-
-		dev->srLastUse++;
-
-		cache->lastUse = dev->srLastUse;
+		ylist_del(&cache->lruLink);
+		ylist_add(&cache->lruLink, &dev->srLru);
 
 		if (isAWrite)
-			cache->dirty = 1;
+			yaffs_SetChunkCacheDirty(dev, cache, 1);
 	}
 }
 
@@ -3402,7 +3471,7 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_ReleaseChunkCache(object->myDev, cache);
 	}
 }
 
@@ -3411,18 +3480,105 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
  */
 static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 {
-	int i;
 	yaffs_Device *dev = in->myDev;
+	struct ylist_head *i;
+	struct ylist_head *n;
+	yaffs_ChunkCache *cache;
 
 	if (dev->param.nShortOpCaches > 0) {
 		/* Invalidate it. */
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+		ylist_for_each_safe(i, n, &dev->srLru) {
+			cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+			if (cache->object == in)
+				yaffs_ReleaseChunkCache(dev, cache);
+		}
+	}
+}
+
+/*
+ * Sequential readahead. When a read misses the cache and follows on from
+ * the previous one, load the next YAFFS_READAHEAD_CHUNKS chunks of the
+ * file into clean cache entries. Chunks that sit next to each other in
+ * NAND are read with one driver call. Nothing is ever flushed to make
+ * room, so this is safe for shared readers under the reader lock.
+ */
+static void yaffs_ReadAhead(yaffs_Object *in, int chunk)
+{
+	yaffs_Device *dev = in->myDev;
+	int nandChunk[YAFFS_READAHEAD_CHUNKS];
+	int maxChunks = YAFFS_READAHEAD_CHUNKS;
+	int lastChunk;
+	__u32 start;
+	int n;
+	int run;
+	int i;
+	int j;
+	yaffs_ChunkCache *cache;
+
+	/* Don't push out what we are loading on a small cache */
+	if (maxChunks > dev->param.nShortOpCaches / 2)
+		maxChunks = dev->param.nShortOpCaches / 2;
+
+	if (in->variant.fileVariant.fileSize <= 0)
+		return;
+	yaffs_AddrToChunk(dev, in->variant.fileVariant.fileSize - 1,
+			  &lastChunk, &start);
+	lastChunk++;
+
+	/* Stop at the end of the file, a hole or something already cached */
+	for (n = 0; n < maxChunks && chunk + n <= lastChunk; n++) {
+		if (yaffs_LookupChunkCache(in, chunk + n))
+			break;
+		nandChunk[n] = yaffs_FindChunkInFile(in, chunk + n, NULL);
+		if (nandChunk[n] < 0)
+			break;
+	}
+
+	for (i = 0; i < n; i += run) {
+		for (run = 1; i + run < n &&
+		     nandChunk[i + run] == nandChunk[i] + run; run++)
+			;
+
+		if (run > 1 && dev->raBuffer &&
+		    yaffs_ReadChunkRunFromNAND(dev, nandChunk[i], run,
+					       dev->raBuffer) == YAFFS_OK) {
+			for (j = 0; j < run; j++) {
+				cache = yaffs_GrabChunkCache(in, chunk + i + j, 0);
+				if (!cache)
+					return;
+				memcpy(cache->data,
+				       dev->raBuffer + j * dev->nDataBytesPerChunk,
+				       dev->nDataBytesPerChunk);
+				dev->readAheadChunks++;
+			}
+		} else {
+			for (j = 0; j < run; j++) {
+				cache = yaffs_GrabChunkCache(in, chunk + i + j, 0);
+				if (!cache)
+					return;
+				yaffs_ReadChunkDataFromObject(in, chunk + i + j,
+							      cache->data);
+				dev->readAheadChunks++;
+			}
 		}
 	}
 }
 
+/*
+ * Note where a read of the file went, and say whether it follows on from
+ * the last one. Kept per file so that readers of different files don't
+ * break each other's streams. Shared readers hold the reader lock here.
+ */
+static int yaffs_ReadIsSequential(yaffs_Object *in, int chunk)
+{
+	yaffs_FileStructure *file = &in->variant.fileVariant;
+	int sequential = (chunk == file->raNextChunk);
+
+	file->raNextChunk = chunk + 1;
+
+	return sequential;
+}
+
 
 /*--------------------- File read/write ------------------------
  * Read and write have very similar structures.
@@ -3434,8 +3590,33 @@ static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
  * Curve-balls: the first chunk might also be the last chunk.
  */
 
-int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
-			int nBytes)
+/* Reads part of a chunk, bypassing the cache */
+static void yaffs_ReadChunkUncached(yaffs_Object *in, int chunk, __u8 *buffer,
+				__u32 start, int nToCopy)
+{
+	yaffs_Device *dev = in->myDev;
+
+	if (nToCopy == dev->nDataBytesPerChunk && !dev->param.inbandTags) {
+		/* A full chunk. Read directly into the supplied buffer. */
+		yaffs_ReadChunkDataFromObject(in, chunk, buffer);
+	} else {
+		/* Read into the local buffer then copy..*/
+
+		__u8 *localBuffer =
+		    yaffs_GetTempBuffer(dev, __LINE__);
+		yaffs_ReadChunkDataFromObject(in, chunk,
+					      localBuffer);
+
+		memcpy(buffer, &localBuffer[start], nToCopy);
+
+
+		yaffs_ReleaseTempBuffer(dev, localBuffer,
+					__LINE__);
+	}
+}
+
+static int yaffs_ReadDataFromFileWorker(yaffs_Object *in, __u8 *buffer,
+				loff_t offset, int nBytes, int shared)
 {
 
 	int chunk;
@@ -3463,29 +3644,53 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 		else
 			nToCopy = dev->nDataBytesPerChunk - start;
 
+		if (shared)
+			yaffs_ReaderLock(dev);
+
 		cache = yaffs_FindChunkCache(in, chunk);
 
+		if (yaffs_ReadIsSequential(in, chunk) && !cache &&
+		    dev->param.nShortOpCaches > 0) {
+			yaffs_ReadAhead(in, chunk);
+			cache = yaffs_LookupChunkCache(in, chunk);
+		}
+
+		if (shared) {
+			/* Shared readers copy cache hits out under the reader
+			 * lock but only load the cache by readahead, which never
+			 * flushes a dirty entry to NAND. Nothing can be dirty
+			 * outside the cache while writers are excluded.
+			 */
+			if (cache) {
+				yaffs_UseChunkCache(dev, cache, 0);
+				memcpy(buffer, &cache->data[start], nToCopy);
+			}
+
+			yaffs_ReaderUnlock(dev);
+
+			if (!cache)
+				yaffs_ReadChunkUncached(in, chunk, buffer,
+							start, nToCopy);
+
 		/* If the chunk is already in the cache or it is less than a whole chunk
 		 * or we're using inband tags then use the cache (if there is caching)
 		 * else bypass the cache.
 		 */
-		if (cache || nToCopy != dev->nDataBytesPerChunk || dev->param.inbandTags) {
-			if (dev->param.nShortOpCaches > 0) {
+		} else if ((cache || nToCopy != dev->nDataBytesPerChunk ||
+			    dev->param.inbandTags) &&
+			   dev->param.nShortOpCaches > 0) {
 
-				/* If we can't find the data in the cache, then load it up. */
+			/* If we can't find the data in the cache, then load it up. */
 
-				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+			if (!cache) {
+				cache = yaffs_GrabChunkCache(in, chunk, 1);
+				if (cache)
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
-					cache->nBytes = 0;
-				}
+			}
 
+			if (cache) {
 				yaffs_UseChunkCache(dev, cache, 0);
 
 				cache->locked = 1;
@@ -3494,26 +3699,12 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 				memcpy(buffer, &cache->data[start], nToCopy);
 
 				cache->locked = 0;
-			} else {
-				/* Read into the local buffer then copy..*/
-
-				__u8 *localBuffer =
-				    yaffs_GetTempBuffer(dev, __LINE__);
-				yaffs_ReadChunkDataFromObject(in, chunk,
-							      localBuffer);
-
-				memcpy(buffer, &localBuffer[start], nToCopy);
-
-
-				yaffs_ReleaseTempBuffer(dev, localBuffer,
-							__LINE__);
-			}
-
+			} else
+				yaffs_ReadChunkUncached(in, chunk, buffer,
+							start, nToCopy);
 		} else {
-
-			/* A full chunk. Read directly into the supplied buffer. */
-			yaffs_ReadChunkDataFromObject(in, chunk, buffer);
-
+			yaffs_ReadChunkUncached(in, chunk, buffer, start,
+						nToCopy);
 		}
 
 		n -= nToCopy;
@@ -3526,6 +3717,22 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 	return nDone;
 }
 
+int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
+			int nBytes)
+{
+	return yaffs_ReadDataFromFileWorker(in, buffer, offset, nBytes, 0);
+}
+
+/*
+ * As yaffs_ReadDataFromFile() but for callers which only hold the OS lock
+ * shared with other readers, see readerLock in yaffs_DeviceParam.
+ */
+int yaffs_ReadDataFromFileShared(yaffs_Object *in, __u8 *buffer,
+				loff_t offset, int nBytes)
+{
+	return yaffs_ReadDataFromFileWorker(in, buffer, offset, nBytes, 1);
+}
+
 int yaffs_DoWriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 			int nBytes, int writeThrough)
 {
@@ -3602,13 +3809,10 @@ int yaffs_DoWriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(dev, 1)) {
-					cache = yaffs_GrabChunkCache(dev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_ReadChunkDataFromObject(in, chunk,
-								      cache->data);
+					cache = yaffs_GrabChunkCache(in, chunk, 1);
+					if (cache)
+						yaffs_ReadChunkDataFromObject(in,
+							chunk, cache->data);
 				} else if (cache &&
 					!cache->dirty &&
 					!yaffs_CheckSpaceForAllocation(dev, 1)) {
@@ -3637,7 +3841,8 @@ int yaffs_DoWriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 						     cache->chunkId,
 						     cache->data, cache->nBytes,
 						     1);
-						cache->dirty = 0;
+						yaffs_SetChunkCacheDirty(dev,
+								cache, 0);
 					}
 
 				} else {
@@ -4362,8 +4567,15 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 		in->lazyLoaded ? "not yet" : "already"));
 #endif
 
+	/* Loaded details never change back, so this check needs no lock */
+	if (!in->lazyLoaded) {
+		Y_SMP_RMB();
+		return;
+	}
+
+	yaffs_ReaderLock(dev);
+
 	if (in->lazyLoaded && in->hdrChunk > 0) {
-		in->lazyLoaded = 0;
 		chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 		result = yaffs_ReadChunkWithTagsFromNAND(dev, in->hdrChunk, chunkData, &tags);
@@ -4396,7 +4608,13 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 		}
 
 		yaffs_ReleaseTempBuffer(dev, chunkData, __LINE__);
+
+		/* Publish the details before the unlocked check can see them */
+		Y_SMP_WMB();
+		in->lazyLoaded = 0;
 	}
+
+	yaffs_ReaderUnlock(dev);
 }
 
 /*------------------------------  Directory Functions ----------------------------- */
@@ -5270,7 +5488,6 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	dev->passiveGCs = 0;
 	dev->oldestDirtyGCs = 0;
 	dev->backgroundGCs = 0;
-	dev->gcBlockFinder = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
 	dev->nDeletedFiles = 0;
@@ -5293,6 +5510,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	dev->srCache = NULL;
+	dev->srHash = NULL;
+	dev->raBuffer = NULL;
 	dev->gcCleanupList = NULL;
 
 
@@ -5300,31 +5519,58 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	    dev->param.nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->param.nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
+		int nBuckets = 1;
 
 		if (dev->param.nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->param.nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->param.nShortOpCaches * sizeof(yaffs_ChunkCache);
+
 		dev->srCache =  YMALLOC(srCacheBytes);
+		if (!dev->srCache) {
+			dev->srCache = YMALLOC_ALT(srCacheBytes);
+			dev->srCacheAlt = 1;
+		} else
+			dev->srCacheAlt = 0;
+
+		while (nBuckets < dev->param.nShortOpCaches)
+			nBuckets <<= 1;
+		dev->srHashMask = nBuckets - 1;
+		dev->srHash = YMALLOC(nBuckets * sizeof(struct ylist_head));
 
-		buf = (__u8 *) dev->srCache;
+		YINIT_LIST_HEAD(&dev->srLru);
+		YINIT_LIST_HEAD(&dev->srFree);
+		YINIT_LIST_HEAD(&dev->srDirty);
 
 		if (dev->srCache)
 			memset(dev->srCache, 0, srCacheBytes);
 
+		if (dev->srHash)
+			for (i = 0; i < nBuckets; i++)
+				YINIT_LIST_HEAD(&dev->srHash[i]);
+
+		buf = dev->srHash ? (__u8 *) dev->srCache : NULL;
+
 		for (i = 0; i < dev->param.nShortOpCaches && buf; i++) {
 			dev->srCache[i].object = NULL;
-			dev->srCache[i].lastUse = 0;
 			dev->srCache[i].dirty = 0;
+			YINIT_LIST_HEAD(&dev->srCache[i].hashLink);
+			YINIT_LIST_HEAD(&dev->srCache[i].dirtyLink);
+			ylist_add_tail(&dev->srCache[i].lruLink, &dev->srFree);
 			dev->srCache[i].data = buf = YMALLOC_DMA(dev->param.totalBytesPerChunk);
 		}
 		if (!buf)
 			init_failed = 1;
 
-		dev->srLastUse = 0;
+		/* Readahead can do without this, it just reads chunk by chunk */
+		if (!init_failed && dev->param.readChunkRunFromNAND)
+			dev->raBuffer = YMALLOC_DMA(YAFFS_READAHEAD_CHUNKS *
+						dev->param.totalBytesPerChunk);
 	}
 
 	dev->cacheHits = 0;
+	dev->readAheadChunks = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->param.nChunksPerBlock * sizeof(__u32));
@@ -5388,6 +5634,10 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 			yaffs_EmptyLostAndFound(dev);
 	}
 
+	/* Block states came from the scan or checkpoint, so refile the lot */
+	if (!init_failed)
+		yaffs_GCIndexRebuild(dev);
+
 	if (init_failed) {
 		/* Clean up the mess */
 		T(YAFFS_TRACE_TRACING,
@@ -5402,6 +5652,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	dev->nPageWrites = 0;
 	dev->nBlockErasures = 0;
 	dev->nGCCopies = 0;
+	dev->bgGCCopies = 0;
+	dev->nGCErasures = 0;
 	dev->nRetriedWrites = 0;
 
 	dev->nRetiredBlocks = 0;
@@ -5435,10 +5687,21 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 				dev->srCache[i].data = NULL;
 			}
 
-			YFREE(dev->srCache);
+			if (dev->srCacheAlt)
+				YFREE_ALT(dev->srCache);
+			else
+				YFREE(dev->srCache);
 			dev->srCache = NULL;
 		}
 
+		if (dev->srHash)
+			YFREE(dev->srHash);
+		dev->srHash = NULL;
+
+		if (dev->raBuffer)
+			YFREE(dev->raBuffer);
+		dev->raBuffer = NULL;
+
 		YFREE(dev->gcCleanupList);
 
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
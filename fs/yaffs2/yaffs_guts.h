@@ -88,7 +88,10 @@
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	4096
+
+/* Chunks loaded into the short op cache when reads are sequential */
+#define YAFFS_READAHEAD_CHUNKS		8
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -113,9 +116,11 @@
 
 /* ChunkCache is used for short read/write operations.*/
 typedef struct {
+	struct ylist_head lruLink;	/* On srLru when in use, else on srFree */
+	struct ylist_head hashLink;	/* On an srHash bucket when in use */
+	struct ylist_head dirtyLink;	/* On srDirty when dirty */
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
-	int lastUse;
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -294,6 +299,13 @@ typedef struct {
 
 } yaffs_BlockInfo;
 
+/* Per-block link in the GC victim index, see yaffs_gcindex.c */
+typedef struct {
+	int next;	/* Block numbers, -1 ends the list */
+	int prev;
+	int bucket;	/* Live chunks when filed, -1 if not filed */
+} yaffs_GCIndexLink;
+
 /* -------------------------- Object structure -------------------------------*/
 /* This is the object structure as stored on NAND */
 
@@ -372,6 +384,7 @@ typedef struct {
 	__u32 shrinkSize;
 	int topLevel;
 	yaffs_Tnode *top;
+	int raNextChunk;	/* Chunk a sequential read would read next */
 } yaffs_FileStructure;
 
 typedef struct {
@@ -534,8 +547,9 @@ struct yaffs_DeviceParamStruct {
 
 
 	int nShortOpCaches;	/* If <= 0, then short op caching is disabled, else
-				 * the number of short op caches (don't use too many).
-                                 * 10 to 20 is a good bet.
+				 * the number of short op caches. Lookups are hashed,
+				 * so up to YAFFS_MAX_SHORT_OP_CACHES is fine if the
+				 * memory (one chunk each) can be spared.
 				 */
 	int useNANDECC;		/* Flag to decide whether or not to use NANDECC on data (yaffs1) */
 	int noTagsECC;		/* Flag to decide whether or not to do ECC on packed tags (yaffs2) */ 
@@ -575,6 +589,14 @@ struct yaffs_DeviceParamStruct {
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct *dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct *dev, int blockNo,
 			       yaffs_BlockState *state, __u32 *sequenceNumber);
+	/* Optional: data of nChunks consecutive chunks, for readahead */
+	int (*readChunkRunFromNAND) (struct yaffs_DeviceStruct *dev,
+				     int chunkInNAND, int nChunks,
+				     __u8 *data);
+	/* Optional: tags of every chunk in a block in one go, for scanning */
+	int (*readBlockTagsFromNAND) (struct yaffs_DeviceStruct *dev,
+				      int blockInNAND,
+				      yaffs_ExtendedTags *tags);
 #endif
 
 	/* The removeObjectCallback function must be supplied by OS flavours that
@@ -590,6 +612,14 @@ struct yaffs_DeviceParamStruct {
 	/*  Callback to control garbage collection. */
 	unsigned (*gcControl)(struct yaffs_DeviceStruct *dev);
 
+	/* Callbacks to serialise the device state that readers still share:
+	 * NAND reads, temp buffers, the short-op cache and lazy loading.
+	 * Only needed by OS flavours that let several readers run at once
+	 * (see yaffs_ReadDataFromFileShared). The lock must be recursive.
+	 */
+	void (*readerLock)(struct yaffs_DeviceStruct *dev);
+	void (*readerUnlock)(struct yaffs_DeviceStruct *dev);
+
         /* Debug control flags. Don't use unless you know what you're doing */
 	int useHeaderFileSize;	/* Flag to determine if we should use file sizes from the header */
 	int disableLazyLoad;	/* Disable lazy loading on this device */
@@ -698,7 +728,6 @@ struct yaffs_DeviceStruct {
 
 	unsigned hasPendingPrioritisedGCs; /* We think this device might have pending prioritised gcs */
 	unsigned gcDisable;
-	unsigned gcBlockFinder;
 	unsigned gcDirtiest;
 	unsigned gcPagesInUse;
 	unsigned gcNotDone;
@@ -706,6 +735,11 @@ struct yaffs_DeviceStruct {
 	unsigned gcChunk;
 	unsigned gcSkip;
 
+	/* GC victim index: FULL blocks bucketed by live chunks */
+	int *gcIndexBuckets;
+	yaffs_GCIndexLink *gcIndexLinks;
+	int gcIndexLinksAlt;
+
 	/* Special directories */
 	yaffs_Object *rootDir;
 	yaffs_Object *lostNFoundDir;
@@ -719,7 +753,15 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	int srCacheAlt;
+	struct ylist_head *srHash;	/* In use entries by object and chunk id */
+	unsigned srHashMask;
+	struct ylist_head srLru;	/* In use entries, most recently used first */
+	struct ylist_head srFree;	/* Unused entries */
+	struct ylist_head srDirty;	/* Entries waiting to be written out */
+
+	/* Readahead into the cache, see raNextChunk in yaffs_FileStructure */
+	__u8 *raBuffer;		/* YAFFS_READAHEAD_CHUNKS chunks */
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -754,6 +796,8 @@ struct yaffs_DeviceStruct {
 	__u32 nBlockErasures;
 	__u32 nErasureFailures;
 	__u32 nGCCopies;
+	__u32 bgGCCopies;	/* Of nGCCopies, those made by background gc */
+	__u32 nGCErasures;	/* Erasures of blocks emptied by gc */
 	__u32 allGCs;
 	__u32 passiveGCs;
 	__u32 oldestDirtyGCs;
@@ -769,6 +813,7 @@ struct yaffs_DeviceStruct {
 	__u32 nUnmarkedDeletions;
 	__u32 refreshCount;
 	__u32 cacheHits;
+	__u32 readAheadChunks;
 
 };
 
@@ -853,6 +898,8 @@ int yaffs_SetAttributes(yaffs_Object *obj, struct iattr *attr);
 int yaffs_GetAttributes(yaffs_Object *obj, struct iattr *attr);
 
 /* File operations */
+int yaffs_ReadDataFromFileShared(yaffs_Object *obj, __u8 *buffer,
+				loff_t offset, int nBytes);
 int yaffs_ReadDataFromFile(yaffs_Object *obj, __u8 *buffer, loff_t offset,
 				int nBytes);
 int yaffs_WriteDataToFile(yaffs_Object *obj, const __u8 *buffer, loff_t offset,
@@ -926,6 +973,9 @@ void yaffs_DeleteChunk(yaffs_Device *dev, int chunkId, int markNAND, int lyn);
 int yaffs_CheckFF(__u8 *buffer, int nBytes);
 void yaffs_HandleChunkError(yaffs_Device *dev, yaffs_BlockInfo *bi);
 
+void yaffs_ReaderLock(yaffs_Device *dev);
+void yaffs_ReaderUnlock(yaffs_Device *dev);
+
 __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo);
 void yaffs_ReleaseTempBuffer(yaffs_Device *dev, __u8 *buffer, int lineNo);
 
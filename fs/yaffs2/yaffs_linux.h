@@ -16,6 +16,9 @@
 #ifndef __YAFFS_LINUX_H__
 #define __YAFFS_LINUX_H__
 
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+
 #include "devextras.h"
 #include "yportenv.h"
 
@@ -25,7 +28,13 @@ struct yaffs_LinuxContext {
 	struct super_block * superBlock;
 	struct task_struct *bgThread; /* Background thread for this device */
 	int bgRunning;
-        struct semaphore grossLock;     /* Gross locking semaphore */
+	unsigned long lastWrite;	/* jiffies of the last file write */
+	unsigned mountTimeMs;		/* Time taken by yaffs_GutsInitialise() */
+	int mountFromCheckpoint;	/* ... and whether it could skip the scan */
+        struct rw_semaphore grossLock;  /* Gross lock, shared by readers */
+	struct mutex readerLock;	/* Device state readers share */
+	struct task_struct *readerOwner;
+	int readerDepth;
 	__u8 *spareBuffer;      /* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 				 */
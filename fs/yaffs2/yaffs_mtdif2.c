@@ -193,6 +193,91 @@ int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 		return YAFFS_FAIL;
 }
 
+/* Read the data of consecutive chunks with a single mtd read.
+ * Any ECC report fails the whole run, see yaffs_ReadChunkRunFromNAND().
+ */
+int nandmtd2_ReadChunkRunFromNAND(yaffs_Device *dev, int chunkInNAND,
+				  int nChunks, __u8 *data)
+{
+	struct mtd_info *mtd = yaffs_DeviceToMtd(dev);
+	loff_t addr = ((loff_t) chunkInNAND) * dev->param.totalBytesPerChunk;
+	size_t len = nChunks * dev->param.totalBytesPerChunk;
+	size_t retlen;
+	int retval;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadChunkRunFromNAND chunk %d count %d" TENDSTR),
+	   chunkInNAND, nChunks));
+
+	if (dev->param.inbandTags)
+		return YAFFS_FAIL;
+
+	retval = mtd->read(mtd, addr, len, &retlen, data);
+
+	return (retval == 0 && retlen == len) ? YAFFS_OK : YAFFS_FAIL;
+}
+
+/* Read the tags of a whole block with a single multi-page oob read.
+ * Only done when a chunk is one NAND page and the tags are in the oob.
+ */
+int nandmtd2_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockInNAND,
+				   yaffs_ExtendedTags *tags)
+{
+#if (MTD_VERSION_CODE > MTD_VERSION(2, 6, 17))
+	struct mtd_info *mtd = yaffs_DeviceToMtd(dev);
+	struct mtd_oob_ops ops;
+	int nChunks = dev->param.nChunksPerBlock;
+	loff_t addr = ((loff_t) blockInNAND) * nChunks *
+			dev->param.totalBytesPerChunk;
+	int retval;
+	int i;
+	__u8 *oob;
+
+	yaffs_PackedTags2 pt;
+
+	int packed_tags_size = dev->param.noTagsECC ? sizeof(pt.t) : sizeof(pt);
+	void * packed_tags_ptr = dev->param.noTagsECC ? (void *) &pt.t: (void *)&pt;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadBlockTagsFromNAND block %d" TENDSTR),
+	   blockInNAND));
+
+	if (dev->param.inbandTags ||
+		dev->param.totalBytesPerChunk != mtd->writesize ||
+		mtd->oobavail < packed_tags_size)
+		return YAFFS_FAIL;
+
+	oob = YMALLOC(nChunks * mtd->oobavail);
+	if (!oob)
+		return YAFFS_FAIL;
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.ooblen = nChunks * mtd->oobavail;
+	ops.len = 0;
+	ops.ooboffs = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = oob;
+	retval = mtd->read_oob(mtd, addr, &ops);
+
+	/* ECC trouble can't be pinned on a chunk, so let the caller
+	 * read them one at a time.
+	 */
+	if (retval == 0) {
+		for (i = 0; i < nChunks; i++) {
+			memcpy(packed_tags_ptr, &oob[i * mtd->oobavail],
+				packed_tags_size);
+			yaffs_UnpackTags2(&tags[i], &pt, !dev->param.noTagsECC);
+		}
+	}
+
+	YFREE(oob);
+
+	return retval == 0 ? YAFFS_OK : YAFFS_FAIL;
+#else
+	return YAFFS_FAIL;
+#endif
+}
+
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo)
 {
 	struct mtd_info *mtd = yaffs_DeviceToMtd(dev);
@@ -26,6 +26,9 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 
 	int realignedChunkInNAND = chunkInNAND - dev->chunkOffset;
 
+	/* Statistics, driver buffers and error handling are shared */
+	yaffs_ReaderLock(dev);
+
 	dev->nPageReads++;
 
 	/* If there are no tags provided, use local tags to get prioritised gc working */
@@ -48,6 +51,69 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 		yaffs_HandleChunkError(dev, bi);
 	}
 
+	yaffs_ReaderUnlock(dev);
+
+	return result;
+}
+
+/*
+ * Read the data of nChunks chunks that follow each other in NAND with one
+ * driver call. Returns YAFFS_FAIL if the driver can't do that or the read
+ * had ECC trouble; the caller should then read the chunks one at a time
+ * so that errors get handled per chunk.
+ */
+int yaffs_ReadChunkRunFromNAND(yaffs_Device *dev, int chunkInNAND,
+					int nChunks, __u8 *buffer)
+{
+	int result;
+
+	if (!dev->param.readChunkRunFromNAND)
+		return YAFFS_FAIL;
+
+	yaffs_ReaderLock(dev);
+
+	result = dev->param.readChunkRunFromNAND(dev,
+					chunkInNAND - dev->chunkOffset,
+					nChunks, buffer);
+	if (result == YAFFS_OK)
+		dev->nPageReads += nChunks;
+
+	yaffs_ReaderUnlock(dev);
+
+	return result;
+}
+
+/*
+ * Read the tags of all the chunks in a block with one driver call.
+ * Returns YAFFS_FAIL if the driver can't do that, in which case the
+ * caller should fall back to yaffs_ReadChunkWithTagsFromNAND().
+ */
+int yaffs_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockInNAND,
+					yaffs_ExtendedTags *tags)
+{
+	int result;
+	int i;
+
+	if (!dev->param.readBlockTagsFromNAND)
+		return YAFFS_FAIL;
+
+	yaffs_ReaderLock(dev);
+
+	result = dev->param.readBlockTagsFromNAND(dev,
+					blockInNAND - dev->blockOffset, tags);
+
+	if (result == YAFFS_OK) {
+		dev->nPageReads += dev->param.nChunksPerBlock;
+
+		for (i = 0; i < dev->param.nChunksPerBlock; i++) {
+			if (tags[i].eccResult > YAFFS_ECC_RESULT_NO_ERROR)
+				yaffs_HandleChunkError(dev,
+					yaffs_GetBlockInfo(dev, blockInNAND));
+		}
+	}
+
+	yaffs_ReaderUnlock(dev);
+
 	return result;
 }
 
@@ -0,0 +1,255 @@
+/*
+ * YAFFS: Yet another Flash File System . A NAND-flash specific file system.
+ *
+ * yaffs_readbench: concurrent read test and throughput benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Reads files on a mounted yaffs2 file system from 1, 2, ... N threads,
+ * each bound to its own CPU, and prints the aggregate throughput for
+ * every thread count. The page cache of each file is dropped before
+ * every pass so that all reads go through yaffs. Thread i reads file
+ * i % nfiles, so pass at least as many files as there are CPUs.
+ *
+ * Before the timed runs every file is read once from a single thread and
+ * its length and CRC32 are recorded. Every concurrent pass must reproduce
+ * both; otherwise the load fails with -EIO, so the exit status of
+ * modprobe is the test result:
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xaa \
+ *		third_id_byte=0x00 fourth_id_byte=0x15
+ *	mount -t yaffs2 /dev/mtdblock0 /mnt
+ *	for i in 0 1 2 3; do dd if=/dev/urandom of=/mnt/f$i bs=64k count=64; done
+ *	modprobe yaffs_readbench files=/mnt/f0,/mnt/f1,/mnt/f2,/mnt/f3
+ *	dmesg | grep yaffs_readbench
+ *	rmmod yaffs_readbench
+ */
+
+#define KMSG_COMPONENT "yaffs_readbench"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/crc32.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#define READBENCH_MAX_FILES	16
+#define READBENCH_BUF_SIZE	(64 * 1024)
+
+/* Module params (documentation at end) */
+static char *files[READBENCH_MAX_FILES];
+static unsigned int nfiles;
+static unsigned int passes = 4;
+static unsigned int max_threads;
+
+/* Length and CRC32 of each file, as read by a single thread */
+static u64 ref_len[READBENCH_MAX_FILES];
+static u32 ref_crc[READBENCH_MAX_FILES];
+
+struct readbench_thread {
+	unsigned int file;
+	u64 bytes;
+	s64 ns;
+	int err;
+	struct completion done;
+};
+
+static int readbench_pass(struct file *filp, char *buf, u64 *len, u32 *crc)
+{
+	loff_t pos = 0;
+	mm_segment_t old_fs;
+	ssize_t n;
+
+	/* make every pass go to yaffs rather than the page cache */
+	invalidate_mapping_pages(filp->f_mapping, 0, -1);
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	do {
+		n = vfs_read(filp, (char __user *)buf, READBENCH_BUF_SIZE,
+			     &pos);
+		if (n > 0)
+			*crc = crc32_le(*crc, (u8 *)buf, n);
+	} while (n > 0);
+	set_fs(old_fs);
+
+	*len = pos;
+	return n < 0 ? n : 0;
+}
+
+/* Record what an uncontended read of every file returns */
+static int readbench_reference(void)
+{
+	struct file *filp;
+	char *buf;
+	unsigned int i;
+	int ret = 0;
+
+	buf = kmalloc(READBENCH_BUF_SIZE, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	for (i = 0; i < nfiles && !ret; i++) {
+		filp = filp_open(files[i], O_RDONLY | O_LARGEFILE, 0);
+		if (IS_ERR(filp)) {
+			ret = PTR_ERR(filp);
+			pr_err("%s: open failed, err=%d\n", files[i], ret);
+			break;
+		}
+		ref_crc[i] = ~0;
+		ret = readbench_pass(filp, buf, &ref_len[i], &ref_crc[i]);
+		filp_close(filp, NULL);
+	}
+
+	kfree(buf);
+	return ret;
+}
+
+static int readbench_thread_fn(void *data)
+{
+	struct readbench_thread *rt = data;
+	struct file *filp;
+	ktime_t start;
+	char *buf;
+	unsigned int i;
+	u64 len;
+	u32 crc;
+	int ret = 0;
+
+	buf = kmalloc(READBENCH_BUF_SIZE, GFP_KERNEL);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	filp = filp_open(files[rt->file], O_RDONLY | O_LARGEFILE, 0);
+	if (IS_ERR(filp)) {
+		ret = PTR_ERR(filp);
+		goto out_free;
+	}
+
+	start = ktime_get();
+	for (i = 0; i < passes && !ret; i++) {
+		crc = ~0;
+		ret = readbench_pass(filp, buf, &len, &crc);
+		if (!ret && (len != ref_len[rt->file] ||
+			     crc != ref_crc[rt->file])) {
+			pr_err("%s: pass %u read %llu bytes crc %08x, "
+			       "expected %llu bytes crc %08x\n",
+			       files[rt->file], i, len, crc,
+			       ref_len[rt->file], ref_crc[rt->file]);
+			ret = -EIO;
+		}
+		rt->bytes += len;
+	}
+	rt->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	filp_close(filp, NULL);
+out_free:
+	kfree(buf);
+out:
+	rt->err = ret;
+	complete(&rt->done);
+	return 0;
+}
+
+static int readbench_run(int nr_threads)
+{
+	struct readbench_thread *rt;
+	u64 bytes = 0;
+	s64 ns = 0;
+	int cpu, i, ret = 0;
+
+	rt = kcalloc(nr_threads, sizeof(*rt), GFP_KERNEL);
+	if (!rt)
+		return -ENOMEM;
+
+	i = 0;
+	for_each_online_cpu(cpu) {
+		struct task_struct *tsk;
+
+		if (i == nr_threads)
+			break;
+		rt[i].file = i % nfiles;
+		init_completion(&rt[i].done);
+
+		tsk = kthread_create(readbench_thread_fn, &rt[i],
+				     "yaffs_rb/%d", cpu);
+		if (IS_ERR(tsk)) {
+			ret = PTR_ERR(tsk);
+			break;
+		}
+		kthread_bind(tsk, cpu);
+		wake_up_process(tsk);
+		i++;
+	}
+
+	while (i--) {
+		wait_for_completion(&rt[i].done);
+		if (rt[i].err && !ret)
+			ret = rt[i].err;
+		bytes += rt[i].bytes;
+		ns = max(ns, rt[i].ns);
+	}
+
+	if (!ret)
+		pr_info("%d thread(s): %llu kB in %lld us, %llu kB/s\n",
+			nr_threads, bytes >> 10, div_s64(ns, NSEC_PER_USEC),
+			ns > 0 ? div64_u64((bytes >> 10) * NSEC_PER_SEC, ns) :
+				 0ULL);
+	else
+		pr_err("%d thread(s): failed, err=%d\n", nr_threads, ret);
+
+	kfree(rt);
+	return ret;
+}
+
+static int __init yaffs_readbench_init(void)
+{
+	int nr_threads, threads;
+	int ret = 0;
+
+	if (!nfiles) {
+		pr_err("no files given\n");
+		return -EINVAL;
+	}
+
+	ret = readbench_reference();
+	if (ret)
+		return ret;
+
+	threads = num_online_cpus();
+	if (max_threads && max_threads < threads)
+		threads = max_threads;
+
+	for (nr_threads = 1; nr_threads <= threads && !ret; nr_threads++)
+		ret = readbench_run(nr_threads);
+
+	return ret;
+}
+
+static void __exit yaffs_readbench_exit(void)
+{
+}
+
+module_param_array(files, charp, &nfiles, 0);
+MODULE_PARM_DESC(files, "Comma separated files to read, one per thread");
+module_param(passes, uint, 0);
+MODULE_PARM_DESC(passes, "Times each thread reads its file");
+module_param(max_threads, uint, 0);
+MODULE_PARM_DESC(max_threads, "Largest thread count (default: online CPUs)");
+
+module_init(yaffs_readbench_init);
+module_exit(yaffs_readbench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("yaffs2 concurrent read test and throughput benchmark");
@@ -175,6 +175,10 @@ unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
+unsigned int yaffs_bg_gc_low;	/* erased blocks, 0: 2 x reserved blocks */
+unsigned int yaffs_bg_gc_high;	/* erased blocks, 0: 4 x reserved blocks */
+unsigned int yaffs_bg_gc_idle_ms = 100;
+unsigned int yaffs_cache_chunks = 64;	/* short op cache entries per mount */
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
@@ -183,11 +187,19 @@ module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_bg_gc_low, uint, 0644);
+module_param(yaffs_bg_gc_high, uint, 0644);
+module_param(yaffs_bg_gc_idle_ms, uint, 0644);
+module_param(yaffs_cache_chunks, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
 MODULE_PARM(yaffs_auto_checkpoint, "i");
 MODULE_PARM(yaffs_gc_control, "i");
+MODULE_PARM(yaffs_bg_gc_low, "i");
+MODULE_PARM(yaffs_bg_gc_high, "i");
+MODULE_PARM(yaffs_bg_gc_idle_ms, "i");
+MODULE_PARM(yaffs_cache_chunks, "i");
 #endif
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 25))
@@ -227,6 +239,7 @@ static void yaffs_put_super(struct super_block *sb);
 
 static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 				loff_t *pos);
+static unsigned yaffs_bg_gc_low_water(yaffs_Device *dev);
 static ssize_t yaffs_hold_space(struct file *f);
 static void yaffs_release_space(struct file *f);
 
@@ -515,14 +528,59 @@ static unsigned yaffs_gc_control_callback(yaffs_Device *dev)
 static void yaffs_GrossLock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locking %p\n"), current));
-	down(&(yaffs_DeviceToLC(dev)->grossLock));
+	down_write(&(yaffs_DeviceToLC(dev)->grossLock));
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locked %p\n"), current));
 }
 
 static void yaffs_GrossUnlock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs unlocking %p\n"), current));
-	up(&(yaffs_DeviceToLC(dev)->grossLock));
+	up_write(&(yaffs_DeviceToLC(dev)->grossLock));
+}
+
+/*
+ * Read paths which only look things up take the gross lock shared. What
+ * they still modify inside yaffs (NAND access, temp buffers, the short-op
+ * cache, lazy loading) is serialised by the reader lock below, which the
+ * core takes through the readerLock/readerUnlock callbacks.
+ */
+static void yaffs_GrossLockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locking shared %p\n"), current));
+	down_read(&(yaffs_DeviceToLC(dev)->grossLock));
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locked shared %p\n"), current));
+}
+
+static void yaffs_GrossUnlockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs unlocking shared %p\n"), current));
+	up_read(&(yaffs_DeviceToLC(dev)->grossLock));
+}
+
+/* The core may nest the reader lock, eg. a NAND read inside lazy loading */
+static void yaffs_ReaderLockCallback(yaffs_Device *dev)
+{
+	struct yaffs_LinuxContext *lc = yaffs_DeviceToLC(dev);
+
+	if (lc->readerOwner == current) {
+		lc->readerDepth++;
+		return;
+	}
+
+	mutex_lock(&lc->readerLock);
+	lc->readerOwner = current;
+	lc->readerDepth = 1;
+}
+
+static void yaffs_ReaderUnlockCallback(yaffs_Device *dev)
+{
+	struct yaffs_LinuxContext *lc = yaffs_DeviceToLC(dev);
+
+	if (--lc->readerDepth)
+		return;
+
+	lc->readerOwner = NULL;
+	mutex_unlock(&lc->readerLock);
 }
 
 #ifdef YAFFS_COMPILE_EXPORTFS
@@ -714,11 +772,11 @@ static int yaffs_readlink(struct dentry *dentry, char __user *buffer,
 
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 
 	if (!alias)
 		return -ENOMEM;
@@ -738,10 +796,10 @@ static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd)
 	int ret;
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 
 	if (!alias) {
 		ret = -ENOMEM;
@@ -787,7 +845,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 	yaffs_Device *dev = yaffs_InodeToObject(dir)->myDev;
 
 	if(current != yaffs_DeviceToLC(dev)->readdirProcess)
-		yaffs_GrossLock(dev);
+		yaffs_GrossLockShared(dev);
 
 	T(YAFFS_TRACE_OS,
 		(TSTR("yaffs_lookup for %d:%s\n"),
@@ -800,7 +858,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 
 	/* Can't hold gross lock when calling yaffs_get_inode() */
 	if(current != yaffs_DeviceToLC(dev)->readdirProcess)
-		yaffs_GrossUnlock(dev);
+		yaffs_GrossUnlockShared(dev);
 
 	if (obj) {
 		T(YAFFS_TRACE_OS,
@@ -1014,13 +1072,13 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
-	ret = yaffs_ReadDataFromFile(obj, pg_buf,
+	ret = yaffs_ReadDataFromFileShared(obj, pg_buf,
 				pg->index << PAGE_CACHE_SHIFT,
 				PAGE_CACHE_SIZE);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 
 	if (ret >= 0)
 		ret = 0;
@@ -1443,6 +1501,8 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 	int nWritten, ipos;
 	struct inode *inode;
 	yaffs_Device *dev;
+	struct yaffs_LinuxContext *context;
+	int wakeGC;
 
 	obj = yaffs_DentryToObject(f->f_dentry);
 
@@ -1488,7 +1548,18 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 		}
 
 	}
+
+	/* Background gc holds off while we write, unless space gets tight */
+	context = yaffs_DeviceToLC(dev);
+	context->lastWrite = jiffies;
+	wakeGC = context->bgThread &&
+		dev->nErasedBlocks < yaffs_bg_gc_low_water(dev);
+
 	yaffs_GrossUnlock(dev);
+
+	if (wakeGC)
+		wake_up_process(context->bgThread);
+
 	return (nWritten == 0) && (n > 0) ? -ENOSPC : nWritten;
 }
 
@@ -2240,14 +2311,41 @@ static void yaffs_FlushSuperBlock(struct super_block *sb, int do_checkpoint)
 }
 
 
-static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev)
+/*
+ * Erased block watermarks for background gc. Below the low water mark gc
+ * is urgent and runs even while files are being written. Below the high
+ * water mark the background thread pre-cleans blocks once writers have
+ * been quiet for yaffs_bg_gc_idle_ms.
+ */
+static unsigned yaffs_bg_gc_low_water(yaffs_Device *dev)
+{
+	return yaffs_bg_gc_low ? yaffs_bg_gc_low : dev->param.nReservedBlocks * 2;
+}
+
+static unsigned yaffs_bg_gc_high_water(yaffs_Device *dev)
+{
+	unsigned low = yaffs_bg_gc_low_water(dev);
+	unsigned high = yaffs_bg_gc_high ?
+			yaffs_bg_gc_high : dev->param.nReservedBlocks * 4;
+
+	return high > low ? high : low;
+}
+
+/* Free chunks not in an erased block, ie. what gc can win back */
+static unsigned yaffs_bg_gc_scattered(yaffs_Device *dev)
 {
 	unsigned erasedChunks = dev->nErasedBlocks * dev->param.nChunksPerBlock;
-	struct yaffs_LinuxContext *context = yaffs_DeviceToLC(dev);
-	unsigned scatteredFree = 0; /* Free chunks not in an erased block */
 
 	if(erasedChunks < dev->nFreeChunks)
-		scatteredFree = (dev->nFreeChunks - erasedChunks);
+		return dev->nFreeChunks - erasedChunks;
+	return 0;
+}
+
+static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev)
+{
+	unsigned erasedChunks = dev->nErasedBlocks * dev->param.nChunksPerBlock;
+	struct yaffs_LinuxContext *context = yaffs_DeviceToLC(dev);
+	unsigned scatteredFree = yaffs_bg_gc_scattered(dev);
 
 	if(!context->bgRunning)
 		return 0;
@@ -2261,6 +2359,30 @@ static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev)
 		return 2;
 }
 
+/*
+ * Should the background thread collect now?
+ * Returns 2 if it must, even while files are being written, 1 if it
+ * should because writers have gone idle, 0 otherwise.
+ */
+static int yaffs_bg_gc_wanted(yaffs_Device *dev, unsigned long now)
+{
+	struct yaffs_LinuxContext *context = yaffs_DeviceToLC(dev);
+	unsigned long idle = msecs_to_jiffies(yaffs_bg_gc_idle_ms);
+	unsigned urgency = yaffs_bg_gc_urgency(dev);
+
+	if(urgency == 0 &&
+		yaffs_bg_gc_scattered(dev) < dev->param.nChunksPerBlock * 2)
+		return 0;	/* nothing to win */
+
+	if(urgency > 1 || dev->nErasedBlocks < yaffs_bg_gc_low_water(dev))
+		return 2;
+	if(time_before(now, context->lastWrite + idle))
+		return 0;
+	if(urgency > 0 || dev->nErasedBlocks < yaffs_bg_gc_high_water(dev))
+		return 1;
+	return 0;
+}
+
 static int yaffs_do_sync_fs(struct super_block *sb,
 				int request_checkpoint)
 {
@@ -2321,8 +2443,8 @@ static int yaffs_BackgroundThread(void *data)
 	unsigned long next_gc = now;
 	unsigned long expires;
 	unsigned int urgency;
+	int gcWanted;
 
-	int gcResult;
 	struct timer_list timer;
 
 	T(YAFFS_TRACE_BACKGROUND,
@@ -2352,14 +2474,25 @@ static int yaffs_BackgroundThread(void *data)
 			next_dir_update = now + HZ;
 		}
 
-		if(time_after(now,next_gc) && yaffs_bg_enable){
+		gcWanted = yaffs_bg_gc_wanted(dev, now);
+
+		/* Writers wake us early when erased blocks run low */
+		if((time_after(now,next_gc) || gcWanted > 1) && yaffs_bg_enable){
 			if(!dev->isCheckpointed){
 				urgency = yaffs_bg_gc_urgency(dev);
-				gcResult = yaffs_BackgroundGarbageCollect(dev, urgency);
-				if(urgency > 1)
+				if(gcWanted)
+					yaffs_BackgroundGarbageCollect(dev, urgency);
+				if(gcWanted > 1 && dev->gcBlock > 0)
+					next_gc = now + 1; /* keep at it */
+				else if(gcWanted > 1)
 					next_gc = now + HZ/20+1;
-				else if(urgency > 0)
+				else if(gcWanted)
 					next_gc = now + HZ/10+1;
+				else if(urgency > 0 ||
+					dev->nErasedBlocks < yaffs_bg_gc_high_water(dev))
+					/* see if the writers have gone idle */
+					next_gc = now +
+						msecs_to_jiffies(yaffs_bg_gc_idle_ms) + 1;
 				else
 					next_gc = now + HZ * 2;
 			} else /*
@@ -2402,6 +2535,7 @@ static int yaffs_BackgroundStart(yaffs_Device *dev)
 		return -1;
 
 	context->bgRunning = 1;
+	context->lastWrite = jiffies;
 
 	context->bgThread = kthread_run(yaffs_BackgroundThread,
 	                        (void *)dev,"yaffs-bg-%d",context->mount_id);
@@ -2697,6 +2831,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	yaffs_options options;
 
 	unsigned mount_id;
+	unsigned long mountStart;
 	int found;
 	struct yaffs_LinuxContext *context_iterator;
 	struct ylist_head *l;
@@ -2916,7 +3051,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	param->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	param->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	param->nReservedBlocks = 5;
-	param->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	param->nShortOpCaches = (options.no_cache) ? 0 : yaffs_cache_chunks;
 	param->inbandTags = options.inband_tags;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
@@ -2965,6 +3100,8 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		    nandmtd2_ReadChunkWithTagsFromNAND;
 		param->markNANDBlockBad = nandmtd2_MarkNANDBlockBad;
 		param->queryNANDBlock = nandmtd2_QueryNANDBlock;
+		param->readBlockTagsFromNAND = nandmtd2_ReadBlockTagsFromNAND;
+		param->readChunkRunFromNAND = nandmtd2_ReadChunkRunFromNAND;
 		yaffs_DeviceToLC(dev)->spareBuffer = YMALLOC(mtd->oobsize);
 		param->isYaffs2 = 1;
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
@@ -3001,6 +3138,8 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 
 	param->markSuperBlockDirty = yaffs_MarkSuperBlockDirty;
 	param->gcControl = yaffs_gc_control_callback;
+	param->readerLock = yaffs_ReaderLockCallback;
+	param->readerUnlock = yaffs_ReaderUnlockCallback;
 
 	yaffs_DeviceToLC(dev)->superBlock= sb;
 	
@@ -3036,11 +3175,15 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         YINIT_LIST_HEAD(&(yaffs_DeviceToLC(dev)->searchContexts));
         param->removeObjectCallback = yaffs_RemoveObjectCallback;
 
-	init_MUTEX(&(yaffs_DeviceToLC(dev)->grossLock));
+	init_rwsem(&(yaffs_DeviceToLC(dev)->grossLock));
+	mutex_init(&(yaffs_DeviceToLC(dev)->readerLock));
 
 	yaffs_GrossLock(dev);
 
+	mountStart = jiffies;
 	err = yaffs_GutsInitialise(dev);
+	context->mountTimeMs = jiffies_to_msecs(jiffies - mountStart);
+	context->mountFromCheckpoint = dev->isCheckpointed;
 
 	T(YAFFS_TRACE_OS,
 	  (TSTR("yaffs_read_super: guts initialised %s\n"),
@@ -3209,11 +3352,20 @@ static char *yaffs_dump_dev_part0(char *buf, yaffs_Device * dev)
 
 static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 {
+	/* Page writes per page the user asked for, in hundredths */
+	__u32 hostWrites = dev->nPageWrites - dev->nGCCopies;
+	unsigned writeAmp = hostWrites ?
+		(unsigned)div_u64((__u64)dev->nPageWrites * 100, hostWrites) : 100;
+
 	buf += sprintf(buf, "nDataBytesPerChunk. %d\n", dev->nDataBytesPerChunk);
 	buf += sprintf(buf, "chunkGroupBits..... %d\n", dev->chunkGroupBits);
 	buf += sprintf(buf, "chunkGroupSize..... %d\n", dev->chunkGroupSize);
 	buf += sprintf(buf, "nErasedBlocks...... %d\n", dev->nErasedBlocks);
 	buf += sprintf(buf, "blocksInCheckpoint. %d\n", dev->blocksInCheckpoint);
+	buf += sprintf(buf, "mountTimeMs........ %u\n",
+			yaffs_DeviceToLC(dev)->mountTimeMs);
+	buf += sprintf(buf, "mountFromCheckpoint %d\n",
+			yaffs_DeviceToLC(dev)->mountFromCheckpoint);
 	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "nTnodes............ %d\n", dev->nTnodes);
 	buf += sprintf(buf, "nObjects........... %d\n", dev->nObjects);
@@ -3223,6 +3375,10 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "nPageReads......... %u\n", dev->nPageReads);
 	buf += sprintf(buf, "nBlockErasures..... %u\n", dev->nBlockErasures);
 	buf += sprintf(buf, "nGCCopies.......... %u\n", dev->nGCCopies);
+	buf += sprintf(buf, "bgGCCopies......... %u\n", dev->bgGCCopies);
+	buf += sprintf(buf, "nGCErasures........ %u\n", dev->nGCErasures);
+	buf += sprintf(buf, "writeAmplification. %u.%02u\n",
+			writeAmp / 100, writeAmp % 100);
 	buf += sprintf(buf, "allGCs............. %u\n", dev->allGCs);
 	buf += sprintf(buf, "passiveGCs......... %u\n", dev->passiveGCs);
 	buf += sprintf(buf, "oldestDirtyGCs..... %u\n", dev->oldestDirtyGCs);
@@ -3235,6 +3391,7 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %u\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %u\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %u\n", dev->cacheHits);
+	buf += sprintf(buf, "readAheadChunks.... %u\n", dev->readAheadChunks);
 	buf += sprintf(buf, "nDeletedFiles...... %u\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %u\n", dev->nUnlinkedFiles);
 	buf += sprintf(buf, "refreshCount....... %u\n", dev->refreshCount);
@@ -943,6 +943,9 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 	yaffs_BlockIndex *blockIndex = NULL;
 	int altBlockIndex = 0;
 
+	yaffs_ExtendedTags *blockTags = NULL;	/* Tags read a block at a time */
+	int haveBlockTags;
+
 	T(YAFFS_TRACE_SCAN,
 	  (TSTR
 	   ("yaffs2_ScanBackwards starts  intstartblk %d intendblk %d..."
@@ -966,6 +969,11 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 
 	dev->blocksInCheckpoint = 0;
 
+	/* Not having this just means reading tags a chunk at a time */
+	if (dev->param.readBlockTagsFromNAND)
+		blockTags = YMALLOC(dev->param.nChunksPerBlock *
+					sizeof(yaffs_ExtendedTags));
+
 	chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 	/* Scan all the blocks to determine their state */
@@ -1063,6 +1071,11 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		haveBlockTags = blockTags &&
+			(state == YAFFS_BLOCK_STATE_NEEDS_SCANNING ||
+			 state == YAFFS_BLOCK_STATE_ALLOCATING) &&
+			yaffs_ReadBlockTagsFromNAND(dev, blk, blockTags) == YAFFS_OK;
+
 		/* For each chunk in each block that needs scanning.... */
 		foundChunksInBlock = 0;
 		for (c = dev->param.nChunksPerBlock - 1;
@@ -1075,8 +1088,12 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->param.nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			if (haveBlockTags) {
+				tags = blockTags[c];
+				result = YAFFS_OK;
+			} else
+				result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk,
+							NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -1521,6 +1538,9 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 	else
 		YFREE(blockIndex);
 
+	if (blockTags)
+		YFREE(blockTags);
+
 	/* Ok, we've done all the scanning.
 	 * Fix up the hard link chains.
 	 * We should now have scanned all the objects, now it's time to add these
@@ -75,6 +75,8 @@
 
 #define YYIELD() schedule()
 #define Y_DUMP_STACK() dump_stack()
+#define Y_SMP_WMB() smp_wmb()
+#define Y_SMP_RMB() smp_rmb()
 
 #define YAFFS_ROOT_MODE			0755
 #define YAFFS_LOSTNFOUND_MODE		0700
@@ -16,7 +16,9 @@
 #ifndef _LINUX_WAKELOCK_H
 #define _LINUX_WAKELOCK_H
 
+#include <linux/types.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/ktime.h>
 
 /* A wake_lock prevents the system from entering suspend or other low power
@@ -32,9 +34,27 @@ enum {
 	WAKE_LOCK_TYPE_COUNT
 };
 
+/* /proc/wakelock_stats holds one of these per wake lock, times in ns. Each
+ * record is followed by the NUL terminated name of the lock and padded to a
+ * multiple of 8 bytes; 'size' covers both.
+ */
+struct wake_lock_stat_record {
+	__u32	size;
+	__u32	count;
+	__u32	expire_count;
+	__u32	wakeup_count;
+	__s64	active_since;
+	__s64	total_time;
+	__s64	sleep_time;
+	__s64	max_time;
+	__s64	last_change;
+	char	name[0];
+};
+
 struct wake_lock {
 #ifdef CONFIG_HAS_WAKELOCK
 	struct list_head    link;
+	struct rb_node      timed_node;
 	int                 flags;
 	const char         *name;
 	unsigned long       expires;
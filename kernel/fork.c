@@ -38,6 +38,7 @@
 #include <linux/syscalls.h>
 #include <linux/jiffies.h>
 #include <linux/tracehook.h>
+#include <linux/oom.h>
 #include <linux/futex.h>
 #include <linux/compat.h>
 #include <linux/task_io_accounting_ops.h>
@@ -1455,6 +1456,11 @@ long do_fork(unsigned long clone_flags,
 		}
 
 		audit_finish_fork(p);
+
+		/* a new process inherits oom_adj without it being written */
+		if (!(clone_flags & CLONE_THREAD) && p->signal->oom_adj)
+			oom_adj_changed(p, p->signal->oom_adj);
+
 		tracehook_report_clone(regs, clone_flags, nr, p);
 
 		/*
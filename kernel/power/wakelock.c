@@ -21,6 +21,7 @@
 #include <linux/wakelock.h>
 #ifdef CONFIG_WAKELOCK_STAT
 #include <linux/proc_fs.h>
+#include <linux/vmalloc.h>
 #endif
 #include "power.h"
 
@@ -43,6 +44,11 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+/* active locks with a timeout, by expiry, and the one to expire last */
+static struct rb_root active_timed_locks[WAKE_LOCK_TYPE_COUNT];
+static struct wake_lock *last_timed_lock[WAKE_LOCK_TYPE_COUNT];
+/* active locks without a timeout */
+static int untimed_locks[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 struct workqueue_struct *suspend_work_queue;
 struct wake_lock main_wake_lock;
@@ -81,7 +87,8 @@ int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 }
 
 
-static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
+static void get_lock_stat(struct wake_lock *lock,
+			  struct wake_lock_stat_record *rec)
 {
 	int lock_count = lock->stat.count;
 	int expire_count = lock->stat.expire_count;
@@ -109,36 +116,152 @@ static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
 			max_time = add_time;
 	}
 
-	return seq_printf(m,
-		     "\"%s\"\t%d\t%d\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\n",
-		     lock->name, lock_count, expire_count,
-		     lock->stat.wakeup_count, ktime_to_ns(active_time),
-		     ktime_to_ns(total_time),
-		     ktime_to_ns(prevent_suspend_time), ktime_to_ns(max_time),
-		     ktime_to_ns(lock->stat.last_time));
+	rec->count = lock_count;
+	rec->expire_count = expire_count;
+	rec->wakeup_count = lock->stat.wakeup_count;
+	rec->active_since = ktime_to_ns(active_time);
+	rec->total_time = ktime_to_ns(total_time);
+	rec->sleep_time = ktime_to_ns(prevent_suspend_time);
+	rec->max_time = ktime_to_ns(max_time);
+	rec->last_change = ktime_to_ns(lock->stat.last_time);
 }
 
-static int wakelock_stats_show(struct seq_file *m, void *unused)
+static size_t fill_lock_stat(struct wake_lock *lock, void *buf, size_t used,
+			     size_t size)
+{
+	struct wake_lock_stat_record *rec = buf + used;
+	size_t name_len = strlen(lock->name) + 1;
+	size_t rec_size = ALIGN(sizeof(*rec) + name_len, 8);
+
+	if (used + rec_size <= size) {
+		get_lock_stat(lock, rec);
+		rec->size = rec_size;
+		memcpy(rec->name, lock->name, name_len);
+		memset(rec->name + name_len, 0,
+		       rec_size - sizeof(*rec) - name_len);
+	}
+	return used + rec_size;
+}
+
+/* Caller must acquire the list_lock spinlock. Returns the size needed. */
+static size_t fill_stats_locked(void *buf, size_t size)
 {
-	unsigned long irqflags;
 	struct wake_lock *lock;
-	int ret;
+	size_t used = 0;
 	int type;
 
-	spin_lock_irqsave(&list_lock, irqflags);
-
-	ret = seq_puts(m, "name\tcount\texpire_count\twake_count\tactive_since"
-			"\ttotal_time\tsleep_time\tmax_time\tlast_change\n");
 	list_for_each_entry(lock, &inactive_locks, link)
-		ret = print_lock_stat(m, lock);
+		used = fill_lock_stat(lock, buf, used, size);
 	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
 		list_for_each_entry(lock, &active_wake_locks[type], link)
-			ret = print_lock_stat(m, lock);
+			used = fill_lock_stat(lock, buf, used, size);
 	}
-	spin_unlock_irqrestore(&list_lock, irqflags);
+	return used;
+}
+
+/*
+ * Takes a snapshot of the stats of all the wake locks as a run of
+ * wake_lock_stat_records, so that list_lock is only held to copy them
+ * out and not while they are formatted or copied to user space.
+ */
+static void *snapshot_stats(size_t *len)
+{
+	static size_t size_hint = PAGE_SIZE;
+	unsigned long irqflags;
+	size_t size = size_hint;
+	size_t used;
+	void *buf;
+
+	for (;;) {
+		buf = vmalloc(size);
+		if (!buf)
+			return NULL;
+		spin_lock_irqsave(&list_lock, irqflags);
+		used = fill_stats_locked(buf, size);
+		spin_unlock_irqrestore(&list_lock, irqflags);
+		if (used <= size)
+			break;
+		vfree(buf);
+		/* leave room for a few more locks next time */
+		size = used + used / 4;
+	}
+	size_hint = size;
+	*len = used;
+	return buf;
+}
+
+static int wakelock_stats_show(struct seq_file *m, void *unused)
+{
+	struct wake_lock_stat_record *rec;
+	size_t len, pos;
+	void *buf;
+
+	buf = snapshot_stats(&len);
+	if (!buf)
+		return -ENOMEM;
+
+	seq_puts(m, "name\tcount\texpire_count\twake_count\tactive_since"
+			"\ttotal_time\tsleep_time\tmax_time\tlast_change\n");
+	for (pos = 0; pos < len; pos += rec->size) {
+		rec = buf + pos;
+		seq_printf(m,
+		     "\"%s\"\t%d\t%d\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\n",
+		     rec->name, rec->count, rec->expire_count,
+		     rec->wakeup_count, rec->active_since, rec->total_time,
+		     rec->sleep_time, rec->max_time, rec->last_change);
+	}
+
+	vfree(buf);
 	return 0;
 }
 
+struct wakelock_bin_stats {
+	size_t len;
+	void *buf;
+};
+
+static int wakelock_bin_stats_open(struct inode *inode, struct file *file)
+{
+	struct wakelock_bin_stats *stats;
+
+	stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+	stats->buf = snapshot_stats(&stats->len);
+	if (!stats->buf) {
+		kfree(stats);
+		return -ENOMEM;
+	}
+	file->private_data = stats;
+	return 0;
+}
+
+static ssize_t wakelock_bin_stats_read(struct file *file, char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct wakelock_bin_stats *stats = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, stats->buf,
+				       stats->len);
+}
+
+static int wakelock_bin_stats_release(struct inode *inode, struct file *file)
+{
+	struct wakelock_bin_stats *stats = file->private_data;
+
+	vfree(stats->buf);
+	kfree(stats);
+	return 0;
+}
+
+static const struct file_operations wakelock_bin_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = wakelock_bin_stats_open,
+	.read = wakelock_bin_stats_read,
+	.llseek = default_llseek,
+	.release = wakelock_bin_stats_release,
+};
+
 static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 {
 	ktime_t duration;
@@ -193,11 +316,54 @@ static void update_sleep_wait_stats_locked(int done)
 #endif
 
 
+/* Caller must acquire the list_lock spinlock */
+static void insert_timed_lock(struct wake_lock *lock, int type)
+{
+	struct rb_node **p = &active_timed_locks[type].rb_node;
+	struct rb_node *parent = NULL;
+	struct wake_lock *entry;
+	bool last = true;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct wake_lock, timed_node);
+		if (time_before(lock->expires, entry->expires)) {
+			p = &parent->rb_left;
+			last = false;
+		} else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&lock->timed_node, parent, p);
+	rb_insert_color(&lock->timed_node, &active_timed_locks[type]);
+	if (last)
+		last_timed_lock[type] = lock;
+}
+
+/* Take an active lock out of the timeout tree or the untimed count.
+ * Caller must acquire the list_lock spinlock.
+ */
+static void deactivate_lock(struct wake_lock *lock, int type)
+{
+	if (!(lock->flags & WAKE_LOCK_ACTIVE))
+		return;
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
+		if (last_timed_lock[type] == lock) {
+			struct rb_node *prev = rb_prev(&lock->timed_node);
+			last_timed_lock[type] = prev ?
+				rb_entry(prev, struct wake_lock, timed_node) :
+				NULL;
+		}
+		rb_erase(&lock->timed_node, &active_timed_locks[type]);
+	} else
+		untimed_locks[type]--;
+}
+
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
+	deactivate_lock(lock, lock->flags & WAKE_LOCK_TYPE_MASK);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -228,23 +394,26 @@ static void print_active_locks(int type)
 	}
 }
 
+/* Expires the timed out locks, earliest first, and reads the time until
+ * the last one expires off the lock cached in last_timed_lock.
+ */
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct wake_lock *lock;
+	struct rb_node *n;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	if (untimed_locks[type])
+		return -1;
+	while ((n = rb_first(&active_timed_locks[type]))) {
+		lock = rb_entry(n, struct wake_lock, timed_node);
+		if ((long)(lock->expires - jiffies) > 0)
+			break;
+		expire_wake_lock(lock);
 	}
-	return max_timeout;
+	if (!last_timed_lock[type])
+		return 0;
+	return last_timed_lock[type]->expires - jiffies;
 }
 
 long has_wake_lock(int type)
@@ -368,7 +537,9 @@ void wake_lock_destroy(struct wake_lock *lock)
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_destroy name=%s\n", lock->name);
 	spin_lock_irqsave(&list_lock, irqflags);
-	lock->flags &= ~WAKE_LOCK_INITIALIZED;
+	deactivate_lock(lock, lock->flags & WAKE_LOCK_TYPE_MASK);
+	lock->flags &= ~(WAKE_LOCK_INITIALIZED | WAKE_LOCK_ACTIVE |
+			 WAKE_LOCK_AUTO_EXPIRE);
 #ifdef CONFIG_WAKELOCK_STAT
 	if (lock->stat.count) {
 		deleted_wake_locks.stat.count += lock->stat.count;
@@ -413,6 +584,7 @@ static void wake_lock_internal(
 		lock->stat.last_time = ktime_get();
 	}
 #endif
+	deactivate_lock(lock, type);
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
@@ -428,12 +600,14 @@ static void wake_lock_internal(
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
 		list_add_tail(&lock->link, &active_wake_locks[type]);
+		insert_timed_lock(lock, type);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
 		list_add(&lock->link, &active_wake_locks[type]);
+		untimed_locks[type]++;
 	}
 	if (type == WAKE_LOCK_SUSPEND) {
 		current_event_num++;
@@ -487,6 +661,7 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	deactivate_lock(lock, type);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -541,8 +716,10 @@ static int __init wakelocks_init(void)
 	int ret;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++)
+	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++) {
 		INIT_LIST_HEAD(&active_wake_locks[i]);
+		active_timed_locks[i] = RB_ROOT;
+	}
 
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
@@ -571,6 +748,7 @@ static int __init wakelocks_init(void)
 
 #ifdef CONFIG_WAKELOCK_STAT
 	proc_create("wakelocks", S_IRUGO, NULL, &wakelock_stats_fops);
+	proc_create("wakelock_stats", S_IRUGO, NULL, &wakelock_bin_stats_fops);
 #endif
 
 	return 0;
@@ -591,6 +769,7 @@ err_platform_device_register:
 static void  __exit wakelocks_exit(void)
 {
 #ifdef CONFIG_WAKELOCK_STAT
+	remove_proc_entry("wakelock_stats", NULL);
 	remove_proc_entry("wakelocks", NULL);
 #endif
 	destroy_workqueue(suspend_work_queue);
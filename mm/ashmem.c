@@ -27,6 +27,8 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,21 +39,24 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its own `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
 	struct list_head unpinned_list;	/* list of all ashmem areas */
+	unsigned int nr_unpinned;	/* ranges on unpinned_list */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	struct mutex mutex;		/* protects all of the above */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's mutex; `lru' and `purged' are also
+ * protected by `ashmem_lru_lock'
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
@@ -62,18 +67,32 @@ struct ashmem_range {
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
+/* Pages the shrinker left to the purge worker, ditto */
+static unsigned long purge_pending;
+
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and the purged state of ranges
+ *
+ * Lock Ordering: asma->mutex -> ashmem_lru_lock
+ *                asma->mutex -> i_mutex -> i_alloc_sem
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Purging only ever trylocks an area's mutex under this lock.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/* Purges what the shrinker could not do itself */
+static struct workqueue_struct *ashmem_purge_wq;
+static void ashmem_purge_work_func(struct work_struct *work);
+static DECLARE_WORK(ashmem_purge_work, ashmem_purge_work_func);
+
+/* Ranges purged per pass of the worker before it reschedules */
+#define ASHMEM_PURGE_BATCH	32
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -102,12 +121,14 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
+/* Caller must hold ashmem_lru_lock. */
 static inline void lru_add(struct ashmem_range *range)
 {
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
 }
 
+/* Caller must hold ashmem_lru_lock. */
 static inline void lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
@@ -123,7 +144,7 @@ static inline void lru_del(struct ashmem_range *range)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int range_alloc(struct ashmem_area *asma,
 		       struct ashmem_range *prev_range, unsigned int purged,
@@ -141,36 +162,47 @@ static int range_alloc(struct ashmem_area *asma,
 	range->purged = purged;
 
 	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	asma->nr_unpinned++;
 
+	spin_lock(&ashmem_lru_lock);
 	if (range_on_lru(range))
 		lru_add(range);
+	spin_unlock(&ashmem_lru_lock);
 
 	return 0;
 }
 
+/* Caller must hold range->asma->mutex. */
 static void range_del(struct ashmem_range *range)
 {
 	list_del(&range->unpinned);
+	range->asma->nr_unpinned--;
+
+	spin_lock(&ashmem_lru_lock);
 	if (range_on_lru(range))
 		lru_del(range);
+	spin_unlock(&ashmem_lru_lock);
+
 	kmem_cache_free(ashmem_range_cachep, range);
 }
 
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold range->asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
 {
 	size_t pre = range_size(range);
 
+	spin_lock(&ashmem_lru_lock);
 	range->pgstart = start;
 	range->pgend = end;
 
 	if (range_on_lru(range))
 		lru_count -= pre - range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -187,6 +219,7 @@ static int ashmem_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -199,10 +232,10 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -217,7 +250,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -238,7 +271,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -247,7 +280,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -268,7 +301,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -285,7 +318,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -328,10 +361,87 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/*
+ * ashmem_purge - jettison up to 'nr_to_purge' unpinned pages, LRU-wise
+ *
+ * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
+ * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_purge'
+ * pages freed. At most 'batch' ranges are purged.
+ *
+ * An area whose mutex is busy is skipped by rotating its range to the tail of
+ * the LRU, so a pin/unpin storm on one area does not hold up the others.
+ *
+ * Returns the number of pages purged.
+ */
+static unsigned long ashmem_purge(unsigned long nr_to_purge, int batch)
+{
+	struct ashmem_range *range;
+	unsigned long purged = 0;
+	unsigned long skipped = 0;
+
+	spin_lock(&ashmem_lru_lock);
+	while (purged < nr_to_purge && batch-- > 0 &&
+	       !list_empty(&ashmem_lru_list) && skipped < lru_count) {
+		struct ashmem_area *asma;
+		struct inode *inode;
+		loff_t start, end;
+		size_t size;
+
+		range = list_first_entry(&ashmem_lru_list, struct ashmem_range,
+					 lru);
+		asma = range->asma;
+		if (!mutex_trylock(&asma->mutex)) {
+			skipped += range_size(range);
+			list_move_tail(&range->lru, &ashmem_lru_list);
+			continue;
+		}
+		spin_unlock(&ashmem_lru_lock);
+
+		/* asma->mutex keeps the range and the area alive */
+		inode = asma->file->f_dentry->d_inode;
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE - 1;
+		size = range_size(range);
+		vmtruncate_range(inode, start, end);
+
+		spin_lock(&ashmem_lru_lock);
+		range->purged = ASHMEM_WAS_PURGED;
+		lru_del(range);
+		mutex_unlock(&asma->mutex);
+		purged += size;
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	return purged;
+}
+
+static void ashmem_purge_work_func(struct work_struct *work)
+{
+	unsigned long nr, done;
+
+	for (;;) {
+		spin_lock(&ashmem_lru_lock);
+		nr = purge_pending;
+		spin_unlock(&ashmem_lru_lock);
+		if (!nr)
+			break;
+
+		done = ashmem_purge(nr, ASHMEM_PURGE_BATCH);
+
+		spin_lock(&ashmem_lru_lock);
+		if (!done || !lru_count)
+			purge_pending = 0;
+		else
+			purge_pending -= min(done, purge_pending);
+		spin_unlock(&ashmem_lru_lock);
+		cond_resched();
+	}
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -340,40 +450,31 @@ out:
  *
  * 'gfp_mask' is the mask of the allocation that got us into this mess.
  *
- * Return value is the number of objects (pages) remaining, or -1 if we cannot
- * proceed without risk of deadlock (due to gfp_mask).
+ * Return value is the number of objects (pages) remaining.
  *
- * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
- * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * Truncating shmem ranges takes i_mutex and may recurse into filesystem
+ * code, so a bounded batch is purged here only when 'gfp_mask' allows
+ * __GFP_FS; whatever is left is handed to the purge worker. Only pages that
+ * are really gone are subtracted from the count returned.
  */
 static int ashmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
-	struct ashmem_range *range, *next;
-
-	/* We might recurse into filesystem code, so bail out if necessary */
-	if (nr_to_scan && !(gfp_mask & __GFP_FS))
-		return -1;
-	if (!nr_to_scan)
-		return lru_count;
-
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	unsigned long remaining;
+	unsigned long purged = 0;
 
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+	if (nr_to_scan && (gfp_mask & __GFP_FS))
+		purged = ashmem_purge(nr_to_scan, ASHMEM_PURGE_BATCH);
 
-		nr_to_scan -= range_size(range);
-		if (nr_to_scan <= 0)
-			break;
+	spin_lock(&ashmem_lru_lock);
+	if (nr_to_scan > purged && lru_count) {
+		purge_pending = min(purge_pending + nr_to_scan - purged,
+				    lru_count);
+		queue_work(ashmem_purge_wq, &ashmem_purge_work);
 	}
-	mutex_unlock(&ashmem_mutex);
+	remaining = lru_count;
+	spin_unlock(&ashmem_lru_lock);
 
-	return lru_count;
+	return remaining;
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -385,7 +486,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -400,7 +501,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -408,7 +509,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -422,7 +523,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -431,7 +532,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -448,7 +549,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -457,7 +558,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -523,7 +624,7 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -558,7 +659,7 @@ restart:
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
@@ -607,7 +708,15 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	/*
+	 * Fast path: nothing in the area is unpinned, so pinning is a no-op
+	 * and nothing can have been purged. Racing with an unpin of the same
+	 * area is no different from pinning just before it.
+	 */
+	if (cmd != ASHMEM_UNPIN && !ACCESS_ONCE(asma->nr_unpinned))
+		return cmd == ASHMEM_PIN ? ASHMEM_NOT_PURGED : ASHMEM_IS_PINNED;
+
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -621,7 +730,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -663,7 +772,7 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		ret = -EPERM;
 		if (capable(CAP_SYS_ADMIN)) {
 			ret = ashmem_shrink(&ashmem_shrinker, 0, GFP_KERNEL);
-			ashmem_shrink(&ashmem_shrinker, ret, GFP_KERNEL);
+			ashmem_purge(ret, INT_MAX);
 		}
 		break;
 	}
@@ -708,9 +817,16 @@ static int __init ashmem_init(void)
 		return -ENOMEM;
 	}
 
+	ashmem_purge_wq = create_singlethread_workqueue("ashmem_purge");
+	if (unlikely(!ashmem_purge_wq)) {
+		printk(KERN_ERR "ashmem: failed to create workqueue\n");
+		return -ENOMEM;
+	}
+
 	ret = misc_register(&ashmem_misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "ashmem: failed to register misc device!\n");
+		destroy_workqueue(ashmem_purge_wq);
 		return ret;
 	}
 
@@ -726,6 +842,7 @@ static void __exit ashmem_exit(void)
 	int ret;
 
 	unregister_shrinker(&ashmem_shrinker);
+	destroy_workqueue(ashmem_purge_wq);
 
 	ret = misc_deregister(&ashmem_misc);
 	if (unlikely(ret))
@@ -504,6 +504,27 @@ int unregister_oom_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL_GPL(unregister_oom_notifier);
 
+/* Called with the new value whenever /proc/<pid>/oom_adj is written */
+static BLOCKING_NOTIFIER_HEAD(oom_adj_notify_list);
+
+int register_oom_adj_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_oom_adj_notifier);
+
+int unregister_oom_adj_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_oom_adj_notifier);
+
+void oom_adj_changed(struct task_struct *task, int oom_adj)
+{
+	blocking_notifier_call_chain(&oom_adj_notify_list,
+				     (unsigned long)oom_adj, task);
+}
+
 /*
  * Try to acquire the OOM killer lock for the zones in zonelist.  Returns zero
  * if a parallel OOM killing is already taking place that includes a zone in
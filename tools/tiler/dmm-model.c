@@ -0,0 +1,411 @@
+/*
+ * dmm-model.c -- exercise the DMM PAT refill engine against a software
+ * model of the DMM registers
+ *
+ * Build (from this directory):
+ *
+ *	cc -Wall -O2 -Iinclude -I../../arch/arm/mach-omap2/include \
+ *		-o dmm-model dmm-model.c ../../drivers/media/video/dmm/dmm_pat.c
+ *
+ * The model implements PAT engine 0: the interrupt status, enable and EOI
+ * registers, manual refills through DMM_PAT_AREA/CTRL/DATA, and chained
+ * refills that walk descriptors in memory from DMM_PAT_DESCR.  Refilled
+ * entries land in a shadow LUT that is checked against every request.  Each
+ * refill started by the CPU, manual or chained, counts as one operation, and
+ * register accesses are counted to show how much the CPU spins.
+ *
+ *	./dmm-model [-n refills] [-s seed] [-p]
+ *
+ * -p runs without an interrupt, so refills are polled.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <getopt.h>
+
+#include "include/dmm-kernel.h"
+#include <mach/dmm.h>
+
+#define LUT_W		256
+#define LUT_H		128
+#define PA_BASE		0x80000000u
+#define MAX_CHUNKS	64
+
+/* --- the model --- */
+
+static u32 regs[DMM_SIZE / 4];
+static u32 irq_raw, irq_enable;
+static u32 lut[LUT_H][LUT_W];
+
+static irq_handler_t handler;
+static void *handler_data;
+static int no_irq;
+
+static unsigned long nr_ops, nr_mmio, nr_irqs;
+unsigned long jiffies;
+
+/* coherent allocations, so that physical addresses can be followed */
+static struct chunk {
+	void *va;
+	dma_addr_t pa;
+	size_t size;
+} chunks[MAX_CHUNKS];
+static dma_addr_t next_pa = PA_BASE;
+
+void *dma_alloc_coherent(void *dev, size_t size, dma_addr_t *pa, int gfp)
+{
+	int i;
+
+	for (i = 0; i < MAX_CHUNKS && chunks[i].va; i++)
+		;
+	if (i == MAX_CHUNKS)
+		return NULL;
+
+	chunks[i].va = aligned_alloc(PAGE_SIZE, ALIGN(size, PAGE_SIZE));
+	chunks[i].pa = *pa = next_pa;
+	chunks[i].size = size;
+	next_pa += ALIGN(size, PAGE_SIZE);
+	return chunks[i].va;
+}
+
+void dma_free_coherent(void *dev, size_t size, void *va, dma_addr_t pa)
+{
+	int i;
+
+	for (i = 0; i < MAX_CHUNKS; i++)
+		if (chunks[i].va == va) {
+			free(va);
+			chunks[i].va = NULL;
+		}
+}
+
+static void *phys_to_virt(dma_addr_t pa, size_t size)
+{
+	int i;
+
+	for (i = 0; i < MAX_CHUNKS; i++)
+		if (chunks[i].va && pa >= chunks[i].pa &&
+		    pa + size <= chunks[i].pa + chunks[i].size)
+			return (char *)chunks[i].va + (pa - chunks[i].pa);
+	return NULL;
+}
+
+void __iomem *ioremap(unsigned long phys, size_t size)
+{
+	return phys == DMM_BASE && size <= sizeof(regs) ? regs : NULL;
+}
+
+void iounmap(volatile void __iomem *addr)
+{
+}
+
+int request_irq(unsigned int irq, irq_handler_t h, unsigned long flags,
+		const char *name, void *data)
+{
+	if (no_irq || irq != DMM_PAT_IRQ)
+		return -EBUSY;
+	handler = h;
+	handler_data = data;
+	return 0;
+}
+
+void free_irq(unsigned int irq, void *data)
+{
+	handler = NULL;
+}
+
+static void raise(u32 bits)
+{
+	irq_raw |= bits;
+	if (handler && (irq_raw & irq_enable)) {
+		nr_irqs++;
+		handler(DMM_PAT_IRQ, handler_data);
+	}
+}
+
+/* run one descriptor; returns the error bits */
+static u32 run_descriptor(struct pat *d)
+{
+	u32 x0 = (u8)d->area.x0, y0 = (u8)d->area.y0;
+	u32 x1 = (u8)d->area.x1, y1 = (u8)d->area.y1;
+	u32 x, y, *pages;
+
+	if (x0 > x1 || y0 > y1 || x1 >= LUT_W || y1 >= LUT_H ||
+	    !d->ctrl.start)
+		return 1 << 2;
+
+	pages = (d->data & 0xF) ? NULL :
+		phys_to_virt(d->data, (x1 - x0 + 1) * (y1 - y0 + 1) * 4);
+	if (!pages)
+		return 1 << 3;
+
+	for (y = y0; y <= y1; y++)
+		for (x = x0; x <= x1; x++)
+			lut[y][x] = *pages++;
+	return 0;
+}
+
+static void run_chain(dma_addr_t pa)
+{
+	struct pat *d;
+	u32 err = 0;
+
+	nr_ops++;
+	while (pa && !err) {
+		d = phys_to_virt(pa, sizeof(*d));
+		err = d ? run_descriptor(d) : 1 << 2;
+		if (!err) {
+			raise(DMM_PAT_IRQ_DST);
+			pa = (u32)(unsigned long)d->next;
+		}
+	}
+
+	if (err) {
+		regs[DMM_PAT_STATUS__0 / 4] |= err << 8;
+		raise(err);
+	} else {
+		raise(DMM_PAT_IRQ_LST);
+	}
+}
+
+u32 __raw_readl(const volatile void __iomem *addr)
+{
+	u32 r = (const volatile u32 *)addr - regs;
+
+	nr_mmio++;
+	switch (r * 4) {
+	case DMM_PAT_IRQSTATUS_RAW:
+		return irq_raw;
+	case DMM_PAT_IRQSTATUS:
+		return irq_raw & irq_enable;
+	case DMM_PAT_IRQENABLE_SET:
+	case DMM_PAT_IRQENABLE_CLR:
+		return irq_enable;
+	}
+	return regs[r];
+}
+
+void __raw_writel(u32 val, volatile void __iomem *addr)
+{
+	u32 r = (volatile u32 *)addr - regs;
+	struct pat d;
+
+	nr_mmio++;
+	switch (r * 4) {
+	case DMM_PAT_IRQSTATUS_RAW:
+		raise(val);
+		return;
+	case DMM_PAT_IRQSTATUS:
+		irq_raw &= ~val;
+		return;
+	case DMM_PAT_IRQENABLE_SET:
+		irq_enable |= val;
+		return;
+	case DMM_PAT_IRQENABLE_CLR:
+		irq_enable &= ~val;
+		return;
+	case DMM_PAT_IRQ_EOI:
+		return;
+	case DMM_PAT_DESCR__0:
+		regs[r] = val;
+		if (val & ~0xF)
+			run_chain(val & ~0xF);
+		else
+			regs[DMM_PAT_STATUS__0 / 4] = 0;
+		return;
+	case DMM_PAT_CTRL__0:
+		regs[r] = val;
+		if (!(val & 1))
+			return;
+
+		/* manual refill from the registers */
+		nr_ops++;
+		memset(&d, 0, sizeof(d));
+		d.area.x0 = regs[DMM_PAT_AREA__0 / 4];
+		d.area.y0 = regs[DMM_PAT_AREA__0 / 4] >> 8;
+		d.area.x1 = regs[DMM_PAT_AREA__0 / 4] >> 16;
+		d.area.y1 = regs[DMM_PAT_AREA__0 / 4] >> 24;
+		d.ctrl.start = 1;
+		d.data = regs[DMM_PAT_DATA__0 / 4];
+		regs[r] &= ~1;
+
+		val = run_descriptor(&d);
+		if (val)
+			raise(val);
+		else
+			raise(DMM_PAT_IRQ_DST | DMM_PAT_IRQ_LST);
+		return;
+	}
+	regs[r] = val;
+}
+
+/* --- the test --- */
+
+struct request {
+	int n;
+	struct pat desc[3];
+	u32 *pages;
+	dma_addr_t pages_pa;
+};
+
+/* a random 2D area, or a 1D area split in up to 3 slices like tcm does */
+static void make_request(struct request *q, int max_pages)
+{
+	u32 x0, y0, x1, y1, i, total = 0, offs = 0;
+	struct pat_area a[3];
+
+	memset(q->desc, 0, sizeof(q->desc));
+	if (rand() & 1) {
+		x0 = rand() % LUT_W;
+		y0 = rand() % LUT_H;
+		x1 = x0 + rand() % min(LUT_W - x0, 64u);
+		y1 = y0 + rand() % min(LUT_H - y0, 32u);
+		a[0] = (struct pat_area) { x0, y0, x1, y1 };
+		q->n = 1;
+	} else {
+		y0 = rand() % (LUT_H - 3);
+		x0 = rand() % LUT_W;
+		y1 = y0 + 1 + rand() % 2;
+		x1 = rand() % LUT_W;
+		q->n = 0;
+		a[q->n++] = (struct pat_area) { x0, y0, LUT_W - 1, y0 };
+		if (y1 > y0 + 1)
+			a[q->n++] = (struct pat_area) { 0, y0 + 1, LUT_W - 1,
+							y1 - 1 };
+		a[q->n++] = (struct pat_area) { 0, y1, x1, y1 };
+	}
+
+	for (i = 0; i < q->n; i++) {
+		q->desc[i].area = a[i];
+		q->desc[i].ctrl.start = 1;
+		q->desc[i].next = i + 1 < q->n ? &q->desc[i + 1] : NULL;
+		q->desc[i].data = q->pages_pa + offs * 4;
+		total = ((u8)a[i].x1 - (u8)a[i].x0 + 1) *
+			((u8)a[i].y1 - (u8)a[i].y0 + 1);
+		while (total--)
+			q->pages[offs++] = (rand() & ~0xFFF) | 0x80000000;
+		offs = ALIGN(offs, 4);
+	}
+	if (offs > max_pages)
+		abort();
+}
+
+static int check_request(struct request *q)
+{
+	u32 i, x, y, *p;
+
+	for (i = 0; i < q->n; i++) {
+		struct pat_area *a = &q->desc[i].area;
+
+		p = q->pages + (q->desc[i].data - q->pages_pa) / 4;
+		for (y = (u8)a->y0; y <= (u8)a->y1; y++)
+			for (x = (u8)a->x0; x <= (u8)a->x1; x++)
+				if (lut[y][x] != *p++)
+					return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int c, i, n = 10000, bad = 0, max_pages = LUT_W * LUT_H + 12;
+	unsigned long ops[2] = { 0 }, mmio[2] = { 0 }, descs = 0;
+	enum pat_mode mode;
+	struct request q;
+	struct pat *chain;
+	struct dmm *dmm;
+	s32 r;
+
+	while ((c = getopt(argc, argv, "n:s:p")) != -1) {
+		switch (c) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 's':
+			srand(atoi(optarg));
+			break;
+		case 'p':
+			no_irq = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n refills] [-s seed] "
+				"[-p]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	dmm = dmm_pat_init(0);
+	if (!dmm) {
+		fprintf(stderr, "dmm_pat_init failed\n");
+		return 1;
+	}
+	q.pages = dma_alloc_coherent(NULL, max_pages * 4, &q.pages_pa, 0);
+
+	/* the same refills, programmed manually and as chains */
+	for (i = 0; i < n; i++) {
+		make_request(&q, max_pages);
+		descs += q.n;
+		for (mode = MANUAL; mode <= AUTO; mode++) {
+			memset(lut, 0, sizeof(lut));
+			nr_ops = nr_mmio = 0;
+			r = dmm_pat_refill(dmm, q.desc, mode);
+			ops[mode] += nr_ops;
+			mmio[mode] += nr_mmio;
+			if (r || check_request(&q)) {
+				printf("refill %d (%s, %d areas): %s\n", i,
+					mode == AUTO ? "auto" : "manual", q.n,
+					r ? "failed" : "wrong LUT contents");
+				bad++;
+			}
+		}
+	}
+	printf("%d refills, %lu areas, %s\n", n, descs,
+		dmm->irq >= 0 ? "interrupt" : "polled");
+	printf("  manual: %lu DMM operations, %lu register accesses\n",
+		ops[MANUAL], mmio[MANUAL]);
+	printf("  auto:   %lu DMM operations, %lu register accesses, "
+		"%lu interrupts\n", ops[AUTO], mmio[AUTO], nr_irqs);
+
+	/* a chain longer than the descriptor buffer takes several runs */
+	n = dmm->max_descs * 2 + 1;
+	chain = calloc(n, sizeof(*chain));
+	for (i = 0; i < n; i++) {
+		chain[i].area = (struct pat_area) { i % LUT_W, i / LUT_W,
+						    i % LUT_W, i / LUT_W };
+		chain[i].ctrl.start = 1;
+		chain[i].data = q.pages_pa + i * 16;
+		chain[i].next = i + 1 < n ? &chain[i + 1] : NULL;
+		q.pages[i * 4] = i << 12;
+	}
+	memset(lut, 0, sizeof(lut));
+	nr_ops = 0;
+	r = dmm_pat_refill(dmm, chain, AUTO);
+	for (i = 0; i < n && !r; i++)
+		if (lut[i / LUT_W][i % LUT_W] != i << 12)
+			r = -1;
+	printf("  chain of %d areas: %s (%lu DMM operations)\n", n,
+		r ? "FAILED" : "ok", nr_ops);
+	bad += !!r;
+
+	/* an invalid descriptor must fail the refill, not hang it */
+	make_request(&q, max_pages);
+	q.desc[q.n - 1].data |= 4;
+	r = dmm_pat_refill(dmm, q.desc, AUTO);
+	printf("  invalid descriptor: %s (%d)\n", r == -EIO ? "ok" : "FAILED",
+		r);
+	bad += r != -EIO;
+
+	/* and the engine must be usable afterwards */
+	make_request(&q, max_pages);
+	r = dmm_pat_refill(dmm, q.desc, AUTO);
+	r = r ? r : check_request(&q);
+	printf("  refill after error: %s\n", r ? "FAILED" : "ok");
+	bad += !!r;
+
+	free(chain);
+	dma_free_coherent(NULL, max_pages * 4, q.pages, q.pages_pa);
+	dmm_pat_release(dmm);
+	return bad ? 1 : 0;
+}
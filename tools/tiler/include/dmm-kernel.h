@@ -0,0 +1,73 @@
+/*
+ * dmm-kernel.h -- the kernel API used by the DMM PAT refill engine
+ * (drivers/media/video/dmm/dmm_pat.c), on top of tcm-kernel.h.  Register
+ * accesses, interrupts and coherent memory are provided by the software
+ * DMM model in dmm-model.c.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _DMM_KERNEL_H
+#define _DMM_KERNEL_H
+
+#include "tcm-kernel.h"
+
+typedef int8_t s8;
+typedef u32 dma_addr_t;
+
+#define __iomem
+#define PAGE_SIZE	4096UL
+#define KERN_WARNING	""
+
+#define kcalloc(n, size, flags)	calloc(n, size)
+#define mb()		__sync_synchronize()
+#define wmb()		__sync_synchronize()
+
+/* registers */
+u32 __raw_readl(const volatile void __iomem *addr);
+void __raw_writel(u32 val, volatile void __iomem *addr);
+void __iomem *ioremap(unsigned long phys, size_t size);
+void iounmap(volatile void __iomem *addr);
+
+/* coherent memory, at made up physical addresses */
+void *dma_alloc_coherent(void *dev, size_t size, dma_addr_t *pa, int gfp);
+void dma_free_coherent(void *dev, size_t size, void *va, dma_addr_t pa);
+
+/* interrupts are delivered synchronously by the model */
+typedef int irqreturn_t;
+#define IRQ_NONE	0
+#define IRQ_HANDLED	1
+typedef irqreturn_t (*irq_handler_t)(int irq, void *data);
+
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags,
+		const char *name, void *data);
+void free_irq(unsigned int irq, void *data);
+
+/* time only passes while polling */
+extern unsigned long jiffies;
+#define msecs_to_jiffies(ms)	((unsigned long)(ms))
+#define time_before(a, b)	((long)((a) - (b)) < 0)
+#define cpu_relax()		(jiffies++)
+
+struct completion {
+	unsigned int done;
+};
+
+#define init_completion(c)	((c)->done = 0)
+#define INIT_COMPLETION(c)	((c).done = 0)
+#define complete(c)		((c)->done++)
+
+static inline unsigned long
+wait_for_completion_timeout(struct completion *c, unsigned long timeout)
+{
+	if (!c->done) {
+		jiffies += timeout;
+		return 0;
+	}
+	c->done--;
+	return timeout;
+}
+
+#endif /* _DMM_KERNEL_H */
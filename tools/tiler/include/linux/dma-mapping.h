@@ -0,0 +1 @@
+#include "../dmm-kernel.h"
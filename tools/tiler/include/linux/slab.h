@@ -0,0 +1 @@
+#include "../tcm-kernel.h"
@@ -0,0 +1,3 @@
+#include "../dmm-kernel.h"
+
+#define OMAP44XX_IRQ_GIC_START	32
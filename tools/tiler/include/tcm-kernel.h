@@ -0,0 +1,238 @@
+/*
+ * tcm-kernel.h -- just enough of the kernel API to build the TILER
+ * container managers (drivers/media/video/tiler/tcm) in user space.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _TCM_KERNEL_H
+#define _TCM_KERNEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <errno.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int16_t s16;
+typedef int32_t s32;
+
+#define EXPORT_SYMBOL(sym)
+#define __init
+#define __exit
+
+#define KERN_ERR	""
+#define KERN_NOTICE	""
+#define KERN_INFO	""
+#define KERN_DEBUG	""
+#define printk		printf
+
+#define GFP_KERNEL	0
+#define kmalloc(size, flags)	malloc(size)
+#define kzalloc(size, flags)	calloc(1, size)
+#define kfree(ptr)		free(ptr)
+
+#define min(x, y) ({ typeof(x) _x = (x); typeof(y) _y = (y); _x < _y ? _x : _y; })
+#define max(x, y) ({ typeof(x) _x = (x); typeof(y) _y = (y); _x > _y ? _x : _y; })
+#define ALIGN(x, a)	(((x) + (a) - 1) & ~((typeof(x))(a) - 1))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* the replay is single threaded */
+struct mutex {
+	int locked;
+};
+#define mutex_init(m)		((m)->locked = 0)
+#define mutex_destroy(m)	do { } while (0)
+#define mutex_lock(m)		((m)->locked++)
+#define mutex_unlock(m)		((m)->locked--)
+
+/* lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD(name) struct list_head name = { &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list->prev = list;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	new->next = head->next;
+	new->prev = head;
+	head->next->prev = new;
+	head->next = new;
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	list_add(new, head->prev);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline int list_is_singular(const struct list_head *head)
+{
+	return !list_empty(head) && head->next == head->prev;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry((ptr)->next, type, member)
+
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+#define list_for_each_entry_continue(pos, head, member)		\
+	for (pos = list_entry(pos->member.next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+#define list_for_each_entry_safe(pos, n, head, member)			\
+	for (pos = list_entry((head)->next, typeof(*pos), member),	\
+	     n = list_entry(pos->member.next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+#define INIT_HLIST_HEAD(ptr) ((ptr)->first = NULL)
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	n->next = h->first;
+	if (h->first)
+		h->first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void hlist_del(struct hlist_node *n)
+{
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+}
+
+#define hlist_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define hlist_for_each_entry(tpos, pos, head, member)			\
+	for (pos = (head)->first;					\
+	     pos && ((tpos = hlist_entry(pos, typeof(*tpos), member)), 1); \
+	     pos = pos->next)
+
+#define hlist_for_each_entry_safe(tpos, pos, n, head, member)		\
+	for (pos = (head)->first;					\
+	     pos && ((n = pos->next), 1) &&				\
+		((tpos = hlist_entry(pos, typeof(*tpos), member)), 1);	\
+	     pos = n)
+
+/* hashing */
+#define GOLDEN_RATIO_PRIME_32 0x9e370001UL
+
+static inline u32 hash_32(u32 val, unsigned int bits)
+{
+	u32 hash = val * GOLDEN_RATIO_PRIME_32;
+
+	return hash >> (32 - bits);
+}
+
+/* bitmaps */
+#define BITS_PER_LONG		(8 * sizeof(long))
+#define BITS_TO_LONGS(nr)	(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+static inline unsigned long __fls(unsigned long word)
+{
+	return BITS_PER_LONG - 1 - __builtin_clzl(word);
+}
+
+static inline int test_bit(int nr, const unsigned long *addr)
+{
+	return (addr[BIT_WORD(nr)] & BIT_MASK(nr)) != 0;
+}
+
+static inline unsigned long __find_next(const unsigned long *addr,
+					unsigned long size,
+					unsigned long offset,
+					unsigned long invert)
+{
+	unsigned long word;
+
+	while (offset < size) {
+		word = (addr[BIT_WORD(offset)] ^ invert) >>
+			(offset % BITS_PER_LONG);
+		if (word) {
+			offset += __builtin_ctzl(word);
+			return offset < size ? offset : size;
+		}
+		offset = (BIT_WORD(offset) + 1) * BITS_PER_LONG;
+	}
+	return size;
+}
+
+#define find_next_bit(addr, size, offset) \
+	__find_next((addr), (size), (offset), 0UL)
+#define find_next_zero_bit(addr, size, offset) \
+	__find_next((addr), (size), (offset), ~0UL)
+
+#define find_first_bit(addr, size) find_next_bit((addr), (size), 0)
+#define find_first_zero_bit(addr, size) find_next_zero_bit((addr), (size), 0)
+
+static inline void bitmap_set(unsigned long *map, int start, int nr)
+{
+	for (; nr; nr--, start++)
+		map[BIT_WORD(start)] |= BIT_MASK(start);
+}
+
+static inline void bitmap_clear(unsigned long *map, int start, int nr)
+{
+	for (; nr; nr--, start++)
+		map[BIT_WORD(start)] &= ~BIT_MASK(start);
+}
+
+static inline void bitmap_copy(unsigned long *dst, const unsigned long *src,
+			       int nbits)
+{
+	memcpy(dst, src, BITS_TO_LONGS(nbits) * sizeof(long));
+}
+
+static inline void bitmap_or(unsigned long *dst, const unsigned long *src1,
+			     const unsigned long *src2, int nbits)
+{
+	int k;
+
+	for (k = 0; k < BITS_TO_LONGS(nbits); k++)
+		dst[k] = src1[k] | src2[k];
+}
+
+#endif /* _TCM_KERNEL_H */
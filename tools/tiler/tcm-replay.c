@@ -0,0 +1,440 @@
+/*
+ * tcm-replay.c -- replay TILER container traces against SiTA and ITA
+ *
+ * Build (from this directory):
+ *
+ *	cc -Wall -O2 -Iinclude -o tcm-replay tcm-replay.c \
+ *		../../drivers/media/video/tiler/tcm/tcm_sita.c \
+ *		../../drivers/media/video/tiler/tcm/tcm_ita.c
+ *
+ * Record a trace on the target with tiler_omap.alloc_debug=8 (or by writing 8
+ * to /sys/module/tiler_omap/parameters/alloc_debug), run the workload, then
+ *
+ *	dmesg | grep tcm_trace: > trace.txt
+ *	./tcm-replay trace.txt
+ *
+ * Without a trace file, -g generates a random mix of camera/video sized
+ * buffers.  Every reservation and free is timed, every result is checked
+ * against a shadow slot map, and fragmentation is sampled as
+ *
+ *	1 - largest free rectangle / free slots
+ *
+ * which is 0 while all free space is in one rectangle.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <getopt.h>
+#include <time.h>
+
+#include "include/tcm-kernel.h"
+#include "../../drivers/media/video/tiler/tcm/tcm_sita.h"
+#include "../../drivers/media/video/tiler/tcm/tcm_ita.h"
+
+enum { OP_2D, OP_1D, OP_FREE, OP_TYPES };
+
+static const char *op_name[OP_TYPES] = { "2d", "1d", "free" };
+
+struct op {
+	int type;
+	u16 w, h, align;	/* 2d */
+	u32 slots;		/* 1d */
+	int id;			/* allocation freed by OP_FREE */
+};
+
+struct allocator {
+	const char *name;
+	struct tcm *(*init)(u16 width, u16 height, struct tcm_pt *attr);
+};
+
+static struct allocator allocators[] = {
+	{ "sita", sita_init },
+	{ "ita", ita_init },
+};
+
+static u16 width = 256, height = 128;
+static struct op *ops;
+static int nr_ops, max_ops;
+
+static struct op *new_op(int type)
+{
+	if (nr_ops == max_ops) {
+		max_ops = max_ops ? 2 * max_ops : 1024;
+		ops = realloc(ops, max_ops * sizeof(*ops));
+		if (!ops) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memset(&ops[nr_ops], 0, sizeof(*ops));
+	ops[nr_ops].type = type;
+	ops[nr_ops].id = nr_ops;
+	return &ops[nr_ops++];
+}
+
+/*
+ * Trace lines are "tcm_trace: 2d w h align x0 y0 x1 y1",
+ * "tcm_trace: 1d slots x0 y0 x1 y1" and "tcm_trace: free x0 y0 x1 y1".
+ * Frees refer to the area recorded at the same first slot.
+ */
+static void read_trace(FILE *f)
+{
+	int *live = malloc(width * height * sizeof(*live));
+	char line[256], *p;
+	unsigned a, b, c, x0, y0, x1, y1;
+	struct op *op;
+	int n = 0;
+
+	for (x0 = 0; x0 < width * height; x0++)
+		live[x0] = -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		n++;
+		p = strstr(line, "tcm_trace: ");
+		if (!p)
+			continue;
+		p += strlen("tcm_trace: ");
+
+		if (sscanf(p, "2d %u %u %u %u %u %u %u", &a, &b, &c,
+			   &x0, &y0, &x1, &y1) == 7) {
+			op = new_op(OP_2D);
+			op->w = a;
+			op->h = b;
+			op->align = c;
+		} else if (sscanf(p, "1d %u %u %u %u %u", &a,
+				  &x0, &y0, &x1, &y1) == 5) {
+			op = new_op(OP_1D);
+			op->slots = a;
+		} else if (sscanf(p, "free %u %u %u %u",
+				  &x0, &y0, &x1, &y1) == 4) {
+			if (x0 >= width || y0 >= height ||
+			    live[y0 * width + x0] < 0) {
+				fprintf(stderr, "line %d: unknown area\n", n);
+				continue;
+			}
+			op = new_op(OP_FREE);
+			op->id = live[y0 * width + x0];
+			live[y0 * width + x0] = -1;
+			continue;
+		} else {
+			fprintf(stderr, "line %d: cannot parse\n", n);
+			continue;
+		}
+
+		if (x0 >= width || y0 >= height) {
+			fprintf(stderr, "line %d: area outside container\n", n);
+			nr_ops--;
+			continue;
+		}
+		live[y0 * width + x0] = op->id;
+	}
+	free(live);
+}
+
+/* a random mix of tiled NV12/RGBA frame buffers and page mode buffers */
+static void generate_trace(int count, unsigned seed)
+{
+	static const struct {
+		u16 w, h, align;
+	} bufs[] = {
+		{ 64, 17, 64 }, { 32, 17, 32 },	/* 1080p NV12 */
+		{ 64, 12, 64 }, { 32, 12, 32 },	/* 720p NV12 */
+		{ 64, 8, 64 }, { 32, 8, 32 },	/* VGA NV12 */
+		{ 32, 15, 32 },			/* WVGA RGBA */
+		{ 12, 4, 0 }, { 5, 3, 0 },	/* small unaligned */
+	};
+	int *live = malloc(count * sizeof(*live));
+	int nr_live = 0, i, k;
+	struct op *op;
+
+	srand(seed);
+	for (i = 0; i < count; i++) {
+		/* keep about 40 buffers around */
+		if (nr_live && rand() % 80 < nr_live) {
+			k = rand() % nr_live;
+			op = new_op(OP_FREE);
+			op->id = live[k];
+			live[k] = live[--nr_live];
+			continue;
+		}
+
+		if (rand() % 4) {
+			k = rand() % (sizeof(bufs) / sizeof(*bufs));
+			op = new_op(OP_2D);
+			op->w = bufs[k].w;
+			op->h = bufs[k].h;
+			op->align = bufs[k].align;
+		} else {
+			op = new_op(OP_1D);
+			op->slots = 1 + rand() % 1024;
+		}
+		live[nr_live++] = op->id;
+	}
+	free(live);
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* largest free rectangle, using the histogram of free slots per column */
+static u32 largest_free_rect(u8 *map, u16 *hist, u16 *stack)
+{
+	u32 best = 0, area;
+	int x, y, top, left;
+
+	memset(hist, 0, width * sizeof(*hist));
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++)
+			hist[x] = map[y * width + x] ? 0 : hist[x] + 1;
+
+		top = 0;
+		for (x = 0; x <= width; x++) {
+			u16 hx = x < width ? hist[x] : 0;
+
+			while (top && hist[stack[top - 1]] >= hx) {
+				u16 hh = hist[stack[--top]];
+
+				left = top ? stack[top - 1] + 1 : 0;
+				area = (u32)hh * (x - left);
+				if (area > best)
+					best = area;
+			}
+			stack[top++] = x;
+		}
+	}
+	return best;
+}
+
+/* mark the slots of an area in the shadow map; returns slots or -1 */
+static int shadow(u8 *map, struct tcm_area *a, u8 busy)
+{
+	int x, y, n = 0;
+	int first, last;
+
+	if (a->p1.x >= width || a->p1.y >= height)
+		return -1;
+
+	if (a->is2d) {
+		if (a->p0.x > a->p1.x || a->p0.y > a->p1.y)
+			return -1;
+		for (y = a->p0.y; y <= a->p1.y; y++)
+			for (x = a->p0.x; x <= a->p1.x; x++, n++) {
+				if (map[y * width + x] == busy)
+					return -1;
+				map[y * width + x] = busy;
+			}
+		return n;
+	}
+
+	first = a->p0.y * width + a->p0.x;
+	last = a->p1.y * width + a->p1.x;
+	if (first > last)
+		return -1;
+	for (x = first; x <= last; x++, n++) {
+		if (map[x] == busy)
+			return -1;
+		map[x] = busy;
+	}
+	return n;
+}
+
+struct result {
+	int count[OP_TYPES], fail[OP_TYPES];
+	u64 *lat[OP_TYPES];
+	double frag_sum, frag_max;
+	int frag_samples, errors;
+};
+
+static void replay(struct allocator *alg, struct result *res, int interval)
+{
+	struct tcm_pt div_pt = { width, (3 * height) / 4 };
+	struct tcm_area *areas = calloc(nr_ops, sizeof(*areas));
+	u8 *map = calloc(width * height, 1);
+	u16 *hist = malloc(width * sizeof(*hist));
+	u16 *stack = malloc((width + 1) * sizeof(*stack));
+	struct tcm *tcm;
+	u32 used = 0, rect;
+	u64 t;
+	int i, r, n;
+	struct op *op;
+
+	memset(res, 0, sizeof(*res));
+	for (i = 0; i < OP_TYPES; i++)
+		res->lat[i] = malloc(nr_ops * sizeof(u64));
+
+	tcm = alg->init(width, height, &div_pt);
+	if (!tcm) {
+		fprintf(stderr, "%s: init failed\n", alg->name);
+		exit(1);
+	}
+
+	for (i = 0; i < nr_ops; i++) {
+		op = &ops[i];
+		t = now_ns();
+		switch (op->type) {
+		case OP_2D:
+			r = tcm_reserve_2d(tcm, op->w, op->h, op->align,
+					   &areas[i]);
+			break;
+		case OP_1D:
+			r = tcm_reserve_1d(tcm, op->slots, &areas[i]);
+			break;
+		default:
+			/* frees of areas that could not be reserved are no-ops */
+			if (!areas[op->id].tcm)
+				continue;
+			r = tcm_free(&areas[op->id]);
+			break;
+		}
+		t = now_ns() - t;
+
+		res->lat[op->type][res->count[op->type]++] = t;
+		if (r) {
+			res->fail[op->type]++;
+			continue;
+		}
+
+		if (op->type == OP_FREE) {
+			used -= shadow(map, &areas[op->id], 0);
+		} else {
+			n = shadow(map, &areas[i], 1);
+			if (n != (op->type == OP_2D ? op->w * op->h :
+				  (int)op->slots)) {
+				fprintf(stderr, "%s: op %d: bad area "
+					"(%d %d)-(%d %d)\n", alg->name, i,
+					areas[i].p0.x, areas[i].p0.y,
+					areas[i].p1.x, areas[i].p1.y);
+				res->errors++;
+				areas[i].tcm = NULL;
+				continue;
+			}
+			used += n;
+		}
+
+		if (interval && i % interval == 0 &&
+		    used < (u32)width * height) {
+			rect = largest_free_rect(map, hist, stack);
+			t = (u32)width * height - used;
+			res->frag_sum += 1.0 - (double)rect / t;
+			if (1.0 - (double)rect / t > res->frag_max)
+				res->frag_max = 1.0 - (double)rect / t;
+			res->frag_samples++;
+		}
+	}
+
+	tcm_deinit(tcm);
+	free(areas);
+	free(map);
+	free(hist);
+	free(stack);
+}
+
+static void report(struct allocator *alg, struct result *res)
+{
+	u64 sum, *lat;
+	int i, k, n;
+
+	for (i = 0; i < OP_TYPES; i++) {
+		n = res->count[i];
+		lat = res->lat[i];
+		if (!n)
+			continue;
+		qsort(lat, n, sizeof(*lat), cmp_u64);
+		for (sum = 0, k = 0; k < n; k++)
+			sum += lat[k];
+		printf("%-5s %-5s %8d %6d %9llu %9llu %9llu\n",
+		       alg->name, op_name[i], n, res->fail[i],
+		       (unsigned long long)(sum / n),
+		       (unsigned long long)lat[n * 99 / 100],
+		       (unsigned long long)lat[n - 1]);
+	}
+	if (res->frag_samples)
+		printf("%-5s fragmentation: avg %.3f max %.3f\n", alg->name,
+		       res->frag_sum / res->frag_samples, res->frag_max);
+	if (res->errors)
+		printf("%-5s %d invalid areas\n", alg->name, res->errors);
+
+	for (i = 0; i < OP_TYPES; i++)
+		free(res->lat[i]);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-W width] [-H height] [-i interval] [trace]\n"
+		"       %s [-W width] [-H height] [-i interval] -g ops [-s seed]\n"
+		"  -i  sample fragmentation every interval ops (0: never)\n",
+		prog, prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct result res;
+	int generate = 0, interval = 1, errors = 0, c;
+	unsigned seed = 1;
+	size_t i;
+	FILE *f;
+
+	while ((c = getopt(argc, argv, "W:H:i:g:s:")) != -1) {
+		switch (c) {
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'g':
+			generate = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!width || !height)
+		usage(argv[0]);
+
+	if (generate) {
+		generate_trace(generate, seed);
+	} else {
+		f = optind < argc ? fopen(argv[optind], "r") : stdin;
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+		read_trace(f);
+	}
+
+	printf("%d operations on a %ux%u container\n", nr_ops, width, height);
+	printf("%-5s %-5s %8s %6s %9s %9s %9s\n", "tcm", "op", "count",
+	       "fail", "avg ns", "p99 ns", "max ns");
+	for (i = 0; i < sizeof(allocators) / sizeof(*allocators); i++) {
+		replay(&allocators[i], &res, interval);
+		errors += res.errors;
+		report(&allocators[i], &res);
+	}
+
+	free(ops);
+	return errors ? 1 : 0;
+}